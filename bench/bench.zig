@@ -0,0 +1,325 @@
+// Throughput and latency of the filter library.
+//
+//   zig build bench -Dbench-out=results.json
+//
+// or, without the build script:
+//   zig run bench/bench.zig --release-fast \
+//       --pkg-begin cuckoofilter src/lib/zig-cuckoofilter.zig --pkg-end -- [options]
+//
+// Options:
+//   --out FILE        write the JSON results to FILE instead of stdout
+//   --max-size SIZE   skip filters bigger than SIZE (default 1G), use
+//                     e.g. `--max-size 8G` to include the multi-GB runs
+//   --ops N           operations per throughput measurement (default 1M)
+//   --samples N       timed operations per latency measurement (default 100K)
+//
+// Every filter type and size gets filled in steps, one per load factor in
+// `LoadFactors`. At each step we measure:
+//   add      the inserts that brought the filter to the new load factor
+//   lookup   random lookups, with 0%, 50% and 100% of them being hits
+//   remove   removal of the last items added (added back afterwards)
+// Throughput is measured on untimed loops, latency on a separate pass that
+// times each operation, with the cost of reading the timer subtracted.
+// Progress goes to stderr.
+const std = @import("std");
+const builtin = @import("builtin");
+const cuckoo = @import("cuckoofilter");
+
+const Filters = []type{ cuckoo.Filter8, cuckoo.Filter16, cuckoo.Filter32 };
+const FilterNames = [][]const u8{ "Filter8", "Filter16", "Filter32" };
+
+// From L1-resident to multi-GB.
+const Sizes = []usize{ 32 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024, 1024 * 1024 * 1024, 4 * 1024 * 1024 * 1024, 8 * 1024 * 1024 * 1024 };
+
+const LoadFactors = []usize{ 10, 25, 50, 75, 90, 95 };
+
+const HitRatios = []usize{ 0, 50, 100 };
+
+const Options = struct {
+    out: ?[]const u8,
+    max_size: usize,
+    ops: usize,
+    samples: usize,
+};
+
+pub fn main() !void {
+    var direct_allocator = std.heap.DirectAllocator.init();
+    defer direct_allocator.deinit();
+    const allocator = &direct_allocator.allocator;
+
+    const args = try std.os.argsAlloc(allocator);
+    defer std.os.argsFree(allocator, args);
+    const options = parseOptions(args) catch {
+        std.debug.warn("usage: bench [--out FILE] [--max-size SIZE] [--ops N] [--samples N]\n");
+        return error.InvalidArgs;
+    };
+
+    var file = if (options.out) |path| try std.os.File.openWrite(path) else try std.io.getStdOut();
+    defer if (options.out != null) file.close();
+    var file_stream = file.outStream();
+    const out = &file_stream.stream;
+
+    const samples = try allocator.alloc(u64, options.samples);
+    defer allocator.free(samples);
+
+    var report = Report{ .out = out, .first = true };
+    try out.print("{{\"timer_overhead_ns\":{},\"results\":[", timerOverhead());
+    inline for (Filters) |CF, f| {
+        for (Sizes) |size| {
+            if (size > options.max_size) continue;
+            const memory = try allocator.alignedAlloc(u8, CF.Align, size);
+            defer allocator.free(memory);
+            try benchFilter(CF, FilterNames[f], memory, options, samples, &report);
+        }
+    }
+    try out.print("\n]}}\n");
+}
+
+fn parseOptions(args: []const []const u8) !Options {
+    var options = Options{
+        .out = null,
+        .max_size = 1024 * 1024 * 1024,
+        .ops = 1000 * 1000,
+        .samples = 100 * 1000,
+    };
+    var i: usize = 1;
+    while (i < args.len) : (i += 2) {
+        if (i + 1 == args.len) return error.InvalidArgs;
+        const value = args[i + 1];
+        if (std.mem.eql(u8, args[i], "--out")) {
+            options.out = value;
+        } else if (std.mem.eql(u8, args[i], "--max-size")) {
+            options.max_size = try parseSize(value);
+        } else if (std.mem.eql(u8, args[i], "--ops")) {
+            options.ops = try std.fmt.parseUnsigned(usize, value, 10);
+        } else if (std.mem.eql(u8, args[i], "--samples")) {
+            options.samples = try std.fmt.parseUnsigned(usize, value, 10);
+        } else {
+            return error.InvalidArgs;
+        }
+    }
+    if (options.ops == 0 or options.samples == 0) return error.InvalidArgs;
+    return options;
+}
+
+// Same suffixes as CF.INIT: K, M, G.
+fn parseSize(str: []const u8) !usize {
+    if (str.len == 0) return error.InvalidArgs;
+    const unit: usize = switch (str[str.len - 1]) {
+        'K', 'k' => 1024,
+        'M', 'm' => 1024 * 1024,
+        'G', 'g' => 1024 * 1024 * 1024,
+        else => 1,
+    };
+    const digits = if (unit == 1) str else str[0 .. str.len - 1];
+    return (try std.fmt.parseUnsigned(usize, digits, 10)) * unit;
+}
+
+// Items are derived from their index, so that hits can be picked at
+// random among the items added so far without having to store them.
+// Indexes from `MissBase` up are never added.
+const MissBase: u64 = 1 << 63;
+
+fn mix(x: u64) u64 {
+    var z = x +% 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) *% 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) *% 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+fn itemHash(i: u64) u64 {
+    return mix(i);
+}
+
+fn itemFP(comptime Tfp: type, i: u64) Tfp {
+    return @truncate(Tfp, mix(i ^ 0x5555555555555555));
+}
+
+// Index of a random item, a hit (an item already added) with probability `hit_ratio`%.
+fn randomItem(random: *std.rand.Random, added: u64, hit_ratio: usize) u64 {
+    if (added > 0 and random.intRangeLessThan(usize, 0, 100) < hit_ratio) return random.intRangeLessThan(u64, 0, added);
+    return MissBase + random.int(u32);
+}
+
+fn benchFilter(comptime CF: type, name: []const u8, memory: []align(CF.Align) u8, options: Options, samples: []u64, report: *Report) !void {
+    const Tfp = CF.FPType;
+    // Fresh pages from the direct allocator are already zeroed
+    var cf = try CF.init_zeroed(memory);
+    const capacity = CF.capacity(memory.len);
+    var prng = std.rand.DefaultPrng.init(42);
+    const random = &prng.random;
+    var added: u64 = 0;
+
+    var info = Run{
+        .filter = name,
+        .fpbits = Tfp.bit_count,
+        .size = memory.len,
+        .load_factor = 0,
+        .op = undefined,
+        .hit_ratio = 0,
+    };
+
+    for (LoadFactors) |lf| {
+        const target = capacity / 100 * lf;
+        if (target <= added) continue;
+        std.debug.warn("{} {} bytes, {}% full\n", info.filter, memory.len, lf);
+
+        // Add: latency on the first half of the step (at most `samples` items),
+        // throughput on the rest. Both stop as soon as the filter is too full.
+        var too_full = false;
+        const timed = std.math.min(samples.len, (target - added) / 2);
+        var timer = try std.os.time.Timer.start();
+        var n: usize = 0;
+        while (n < timed) : (n += 1) {
+            const start = timer.read();
+            cf.add(itemHash(added), itemFP(Tfp, added)) catch {
+                too_full = true;
+                break;
+            };
+            samples[n] = timer.read() - start;
+            added += 1;
+        }
+        const latency_count = n;
+
+        const block_start = added;
+        timer.reset();
+        while (!too_full and added < target) {
+            cf.add(itemHash(added), itemFP(Tfp, added)) catch {
+                too_full = true;
+                break;
+            };
+            added += 1;
+        }
+        const elapsed = timer.read();
+
+        info.load_factor = @intToFloat(f64, added) / @intToFloat(f64, capacity);
+        info.op = "add";
+        info.hit_ratio = 0;
+        try report.write(info, added - block_start, elapsed, samples[0..latency_count], null);
+
+        // Lookups
+        for (HitRatios) |hit_ratio| {
+            info.op = "lookup";
+            info.hit_ratio = hit_ratio;
+
+            var found: usize = 0;
+            timer.reset();
+            n = 0;
+            while (n < options.ops) : (n += 1) {
+                const i = randomItem(random, added, hit_ratio);
+                if (try cf.maybe_contains(itemHash(i), itemFP(Tfp, i))) found += 1;
+            }
+            const lookup_elapsed = timer.read();
+
+            n = 0;
+            while (n < samples.len) : (n += 1) {
+                const i = randomItem(random, added, hit_ratio);
+                const start = timer.read();
+                if (try cf.maybe_contains(itemHash(i), itemFP(Tfp, i))) found += 1;
+                samples[n] = timer.read() - start;
+            }
+            try report.write(info, options.ops, lookup_elapsed, samples, @intToFloat(f64, found) / @intToFloat(f64, options.ops + samples.len));
+        }
+
+        // Removals of the most recent items, added back afterwards so that
+        // the next step starts from (almost) the same state. The latency
+        // pass adds each item back right away, so it can't lose any.
+        info.op = "remove";
+        info.hit_ratio = 100;
+        const remove_timed = std.math.min(samples.len, added);
+        var i = added - remove_timed;
+        while (i < added) : (i += 1) {
+            const start = timer.read();
+            try cf.remove(itemHash(i), itemFP(Tfp, i));
+            samples[i - (added - remove_timed)] = timer.read() - start;
+            try cf.add(itemHash(i), itemFP(Tfp, i));
+        }
+
+        const removed = std.math.min(options.ops, added);
+        timer.reset();
+        i = added - removed;
+        while (i < added) : (i += 1) try cf.remove(itemHash(i), itemFP(Tfp, i));
+        const remove_elapsed = timer.read();
+        try report.write(info, removed, remove_elapsed, samples[0..remove_timed], null);
+
+        // Adding back in a different order can fail on a very full filter,
+        // items that don't make it back are gone and the filter is done.
+        i = added - removed;
+        while (i < added) : (i += 1) {
+            cf.add(itemHash(i), itemFP(Tfp, i)) catch {
+                added = i;
+                too_full = true;
+                break;
+            };
+        }
+
+        if (too_full) break;
+    }
+}
+
+// What a result is about.
+const Run = struct {
+    filter: []const u8,
+    fpbits: usize,
+    size: usize,
+    load_factor: f64,
+    op: []const u8,
+    hit_ratio: usize,
+};
+
+// Writes results as elements of a JSON array.
+const Report = struct {
+    out: *std.io.OutStream(std.os.File.WriteError),
+    first: bool,
+
+    fn write(self: *Report, run: Run, ops: usize, elapsed_ns: u64, latencies: []u64, found_ratio: ?f64) !void {
+        const overhead = timerOverhead();
+        for (latencies) |*l| l.* = if (l.* > overhead) l.* - overhead else 0;
+        std.sort.sort(u64, latencies, std.sort.asc(u64));
+
+        const ops_per_sec = if (elapsed_ns == 0) 0 else @intToFloat(f64, ops) * 1e9 / @intToFloat(f64, elapsed_ns);
+        try self.out.print(
+            "{}\n{{\"filter\":\"{}\",\"fpbits\":{},\"size\":{},\"load_factor\":{.4},\"op\":\"{}\",\"hit_ratio\":{},",
+            if (self.first) "" else ",",
+            run.filter,
+            run.fpbits,
+            run.size,
+            run.load_factor,
+            run.op,
+            run.hit_ratio,
+        );
+        try self.out.print(
+            "\"ops\":{},\"ops_per_sec\":{.1},\"p50_ns\":{},\"p99_ns\":{},\"p999_ns\":{}",
+            ops,
+            ops_per_sec,
+            percentile(latencies, 500),
+            percentile(latencies, 990),
+            percentile(latencies, 999),
+        );
+        if (found_ratio) |ratio| try self.out.print(",\"found_ratio\":{.6}", ratio);
+        try self.out.print("}}");
+        self.first = false;
+    }
+};
+
+// `p`/1000 quantile of sorted samples.
+fn percentile(sorted: []const u64, p: usize) u64 {
+    if (sorted.len == 0) return 0;
+    return sorted[std.math.min(sorted.len - 1, sorted.len * p / 1000)];
+}
+
+var timer_overhead: ?u64 = null;
+
+// Smallest time measured between two consecutive timer reads.
+fn timerOverhead() u64 {
+    if (timer_overhead) |overhead| return overhead;
+    var timer = std.os.time.Timer.start() catch return 0;
+    var min: u64 = std.math.maxInt(u64);
+    var i: usize = 0;
+    while (i < 10000) : (i += 1) {
+        const start = timer.read();
+        min = std.math.min(min, timer.read() - start);
+    }
+    timer_overhead = min;
+    return min;
+}
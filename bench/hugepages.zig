@@ -0,0 +1,59 @@
+// Lookup throughput of a big filter on regular pages vs huge pages.
+//
+//   zig run bench/hugepages.zig --release-fast \
+//       --pkg-begin cuckoofilter src/lib/zig-cuckoofilter.zig --pkg-end \
+//       --pkg-begin hugepages src/hugepages.zig --pkg-end
+//
+// Explicit huge pages have to be reserved beforehand, e.g.:
+//   echo 1024 > /proc/sys/vm/nr_hugepages
+// otherwise the huge pages run falls back to transparent huge pages.
+// With THP set to `always` the regular run can get huge pages too,
+// use `madvise` (or `never`) to see the difference.
+const std = @import("std");
+const cuckoo = @import("cuckoofilter");
+const hugepages = @import("hugepages");
+
+const FilterSize = 1024 * 1024 * 1024;
+const LoadFactor = 80;
+const Lookups = 20 * 1000 * 1000;
+
+pub fn main() !void {
+    var direct_allocator = std.heap.DirectAllocator.init();
+    defer direct_allocator.deinit();
+    const allocator = &direct_allocator.allocator;
+
+    const heap_memory = try allocator.alignedAlloc(u8, cuckoo.Filter8.Align, FilterSize);
+    defer allocator.free(heap_memory);
+    try run("regular pages", heap_memory);
+
+    const huge_memory = try hugepages.alloc(FilterSize);
+    defer hugepages.free(huge_memory);
+    try run("huge pages", huge_memory);
+}
+
+fn run(name: []const u8, memory: []align(cuckoo.Filter8.Align) u8) !void {
+    var cf = try cuckoo.Filter8.init(memory);
+    var prng = std.rand.DefaultPrng.init(42);
+
+    // Fill the filter, this also faults in all the pages.
+    const items = cuckoo.Filter8.capacity(FilterSize) / 100 * LoadFactor;
+    var i: usize = 0;
+    while (i < items) : (i += 1) {
+        try cf.add(prng.random.int(u64), prng.random.intRangeAtMost(u8, 1, 255));
+    }
+
+    // Random lookups, half of them hits.
+    prng = std.rand.DefaultPrng.init(42);
+    var miss_prng = std.rand.DefaultPrng.init(1337);
+    var found: usize = 0;
+    var timer = try std.os.time.Timer.start();
+    i = 0;
+    while (i < Lookups) : (i += 1) {
+        const r = if (i % 2 == 0) &prng.random else &miss_prng.random;
+        if (try cf.maybe_contains(r.int(u64), r.intRangeAtMost(u8, 1, 255))) found += 1;
+    }
+    const elapsed = timer.read();
+
+    const ns_per_op = @intToFloat(f64, elapsed) / @intToFloat(f64, Lookups);
+    std.debug.warn("{}: {.2} ns/lookup, {.2} Mlookups/s ({} found)\n", name, ns_per_op, 1000.0 / ns_per_op, found);
+}
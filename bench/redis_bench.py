@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+"""Throughput and latency of the CF.* commands on a real redis-server.
+
+    zig build bench-redis -Dbench-out=redis.json
+
+or, with an already built module:
+
+    python3 bench/redis_bench.py --module ./libredis-cuckoofilter.so
+
+Spawns a redis-server (persistence off) on a free port with the module
+loaded, then drives it from `--clients` processes, each with its own
+connection sending pipelines of `--pipeline` commands. Every run creates
+a fresh filter, fills it to each load factor in turn and measures:
+
+    add      CF.ADD (or CF.MADD with --batch) up to the load factor
+    check    CF.CHECK (or CF.MCHECK) with 0%, 50% and 100% hits
+    rem      CF.REM (or CF.MREM) of the last items added, added back after
+
+Latencies are per pipeline round trip. Results are written as JSON,
+together with the final CF.INFO of every filter and the module section
+of INFO. Only the standard library is needed.
+"""
+
+import argparse
+import json
+import multiprocessing
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+LOAD_FACTORS = [10, 25, 50, 75, 90, 95]
+HIT_RATIOS = [0, 50, 100]
+MISS_BASE = 1 << 62  # indexes from here up are never added
+
+
+def encode(*args):
+    out = [b"*%d\r\n" % len(args)]
+    for arg in args:
+        arg = arg if isinstance(arg, bytes) else str(arg).encode()
+        out.append(b"$%d\r\n%s\r\n" % (len(arg), arg))
+    return b"".join(out)
+
+
+class Connection:
+    """Just enough RESP to pipeline commands and read replies back."""
+
+    def __init__(self, port):
+        self.sock = socket.create_connection(("127.0.0.1", port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b""
+        self.pos = 0
+
+    def send(self, payload):
+        self.sock.sendall(payload)
+
+    def _line(self):
+        while True:
+            end = self.buf.find(b"\r\n", self.pos)
+            if end >= 0:
+                line = self.buf[self.pos:end]
+                self.pos = end + 2
+                return line
+            self.buf = self.buf[self.pos:] + self.sock.recv(1 << 20)
+            self.pos = 0
+
+    def _bytes(self, n):
+        while len(self.buf) - self.pos < n + 2:
+            self.buf = self.buf[self.pos:] + self.sock.recv(1 << 20)
+            self.pos = 0
+        data = self.buf[self.pos:self.pos + n]
+        self.pos += n + 2
+        return data
+
+    def read(self):
+        line = self._line()
+        kind, rest = line[:1], line[1:]
+        if kind == b"+":
+            return rest.decode()
+        if kind == b"-":
+            return RuntimeError(rest.decode())
+        if kind == b":":
+            return int(rest)
+        if kind == b",":
+            return float(rest)
+        if kind == b"$":
+            n = int(rest)
+            return None if n < 0 else self._bytes(n)
+        if kind == b"*":
+            n = int(rest)
+            return None if n < 0 else [self.read() for _ in range(n)]
+        raise RuntimeError("bad reply: %r" % line)
+
+    def call(self, *args):
+        self.send(encode(*args))
+        reply = self.read()
+        if isinstance(reply, RuntimeError):
+            raise reply
+        return reply
+
+
+M64 = (1 << 64) - 1
+
+
+def item(i):
+    """Items are derived from their index (splitmix64), so any process can rebuild them."""
+    z = (i + 0x9E3779B97F4A7C15) & M64
+    z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & M64
+    z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & M64
+    z ^= z >> 31
+    return z >> 1, z % 255 + 1
+
+
+def worker(job):
+    """Runs the commands for `indexes` over a pipelined connection."""
+    port, op, key, indexes, pipeline, batch = job
+    conn = Connection(port)
+    name = op if batch == 1 else "CF.M" + op[3:]
+
+    # Commands are encoded upfront, so that only the round trips get timed.
+    rounds = []
+    step = pipeline * batch
+    for first in range(0, len(indexes), step):
+        chunk = indexes[first:first + step]
+        commands = []
+        for b in range(0, len(chunk), batch):
+            args = []
+            for i in chunk[b:b + batch]:
+                args.extend(item(i))
+            commands.append(encode(name, key, *args))
+        rounds.append((len(commands), b"".join(commands)))
+
+    latencies = []
+    errors = 0
+    found = 0
+    start = time.perf_counter()
+    for count, payload in rounds:
+        t = time.perf_counter()
+        conn.send(payload)
+        for _ in range(count):
+            reply = conn.read()
+            for r in (reply if isinstance(reply, list) else [reply]):
+                if isinstance(r, RuntimeError):
+                    errors += 1
+                elif r == "1":
+                    found += 1
+        latencies.append(time.perf_counter() - t)
+    return time.perf_counter() - start, latencies, errors, found
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0
+    return sorted_values[min(len(sorted_values) - 1, len(sorted_values) * p // 1000)]
+
+
+class Bench:
+    def __init__(self, args, port):
+        self.args = args
+        self.port = port
+        self.conn = Connection(port)
+        self.pool = multiprocessing.Pool(args.clients)
+        self.results = []
+
+    def run(self, op, key, indexes, meta, record=True):
+        """Splits `indexes` among the clients and records one result."""
+        a = self.args
+        parts = [indexes[c::a.clients] for c in range(a.clients)]
+        jobs = [(self.port, op, key, p, a.pipeline, a.batch) for p in parts if p]
+        outcomes = self.pool.map(worker, jobs)
+        # Clients run in parallel, the slowest one sets the pace
+        elapsed = max(o[0] for o in outcomes)
+        if not record:
+            return
+        latencies = sorted(l for o in outcomes for l in o[1])
+        result = dict(meta)
+        result.update({
+            "op": op.lower(),
+            "ops": len(indexes),
+            "ops_per_sec": len(indexes) / elapsed if elapsed > 0 else 0,
+            "p50_us": percentile(latencies, 500) * 1e6,
+            "p99_us": percentile(latencies, 990) * 1e6,
+            "p999_us": percentile(latencies, 999) * 1e6,
+            "errors": sum(o[2] for o in outcomes),
+        })
+        if op == "CF.CHECK":
+            result["found_ratio"] = sum(o[3] for o in outcomes) / len(indexes)
+        self.results.append(result)
+        print("%(fpsize)s %(size)s %(load_factor)d%% %(op)s %(hit_ratio)s: %(ops_per_sec).0f ops/s" % result, file=sys.stderr)
+
+    def filter(self, size, fpsize):
+        a = self.args
+        key = "bench:%s:%s" % (size, fpsize)
+        self.conn.call("DEL", key)
+        self.conn.call("CF.INIT", key, size, fpsize)
+        capacity = self.conn.call("CF.CAPACITY", size, fpsize)
+        rng = random.Random(42)
+        added = 0
+        for lf in LOAD_FACTORS:
+            target = capacity * lf // 100
+            meta = {"size": size, "fpsize": fpsize, "load_factor": lf, "hit_ratio": None}
+            self.run("CF.ADD", key, list(range(added, target)), meta)
+            added = target
+
+            for hit_ratio in HIT_RATIOS:
+                meta["hit_ratio"] = hit_ratio
+                indexes = [rng.randrange(added) if rng.randrange(100) < hit_ratio
+                           else MISS_BASE + rng.getrandbits(32) for _ in range(a.ops)]
+                self.run("CF.CHECK", key, indexes, meta)
+
+            meta["hit_ratio"] = 100
+            removed = list(range(max(0, added - a.ops), added))
+            self.run("CF.REM", key, removed, meta)
+            self.run("CF.ADD", key, removed, meta, record=False)
+        info = self.conn.call("CF.INFO", key)
+        return dict(zip(info[0::2], info[1::2]))
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--module", required=True, help="path of the built module")
+    parser.add_argument("--redis-server", default="redis-server")
+    parser.add_argument("--sizes", default="64K,1M,16M", help="comma separated CF.INIT sizes")
+    parser.add_argument("--fpsizes", default="1,2,4", help="comma separated CF.INIT fpsizes")
+    parser.add_argument("--ops", type=int, default=200000, help="commands per check/rem measurement")
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--pipeline", type=int, default=64, help="commands per round trip")
+    parser.add_argument("--batch", type=int, default=1, help="items per command, >1 uses CF.MADD/CF.MCHECK/CF.MREM")
+    parser.add_argument("--out", help="JSON output file (default: stdout)")
+    args = parser.parse_args()
+
+    port = free_port()
+    workdir = tempfile.mkdtemp(prefix="cf-bench-")
+    server = subprocess.Popen(
+        [args.redis_server, "--port", str(port), "--save", "", "--appendonly", "no",
+         "--dir", workdir, "--loadmodule", os.path.abspath(args.module)],
+        stdout=subprocess.DEVNULL)
+    try:
+        deadline = time.time() + 10
+        while True:
+            try:
+                bench = Bench(args, port)
+                bench.conn.call("PING")
+                break
+            except OSError:
+                if time.time() > deadline or server.poll() is not None:
+                    raise RuntimeError("redis-server did not start")
+                time.sleep(0.1)
+
+        filters = {}
+        for size in args.sizes.split(","):
+            for fpsize in args.fpsizes.split(","):
+                filters["%s:%s" % (size, fpsize)] = bench.filter(size, fpsize)
+        bench.pool.close()
+
+        report = {
+            "redis_version": bench.conn.call("INFO", "server").decode().split("redis_version:")[1].split()[0],
+            "clients": args.clients,
+            "pipeline": args.pipeline,
+            "batch": args.batch,
+            "results": bench.results,
+            "filters": filters,
+            "module_info": bench.conn.call("INFO", "cuckoofilter").decode(),
+        }
+    finally:
+        server.terminate()
+        server.wait()
+
+    out = open(args.out, "w") if args.out else sys.stdout
+    json.dump(report, out, indent=1, default=lambda v: v.decode() if isinstance(v, bytes) else str(v))
+    out.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,63 @@
+const builtin = @import("builtin");
+const Builder = @import("std").build.Builder;
+
+pub fn build(b: *Builder) void {
+    const mode = b.standardReleaseOptions();
+
+    // The module, same as `zig build-lib -dynamic -isystem src src/redis-cuckoofilter.zig`
+    const lib = b.addSharedLibrary("redis-cuckoofilter", "src/redis-cuckoofilter.zig", b.version(1, 2, 0));
+    lib.setBuildMode(mode);
+    lib.addIncludeDir("src");
+    lib.linkSystemLibrary("c");
+    b.installArtifact(lib);
+
+    // Unit tests
+    const test_step = b.step("test", "Run the unit tests");
+    const lib_tests = b.addTest("src/lib/zig-cuckoofilter.zig");
+    lib_tests.setBuildMode(mode);
+    test_step.dependOn(&lib_tests.step);
+    const hashing_tests = b.addTest("src/hashing.zig");
+    hashing_tests.setBuildMode(mode);
+    test_step.dependOn(&hashing_tests.step);
+    const xor_tests = b.addTest("src/xorfilter.zig");
+    xor_tests.setBuildMode(mode);
+    test_step.dependOn(&xor_tests.step);
+    const metrics_tests = b.addTest("src/metrics.zig");
+    metrics_tests.setBuildMode(mode);
+    metrics_tests.addIncludeDir("src");
+    metrics_tests.linkSystemLibrary("c");
+    test_step.dependOn(&metrics_tests.step);
+    const type_tests = b.addTest("src/t_cuckoofilter.zig");
+    type_tests.setBuildMode(mode);
+    type_tests.addIncludeDir("src");
+    type_tests.linkSystemLibrary("c");
+    test_step.dependOn(&type_tests.step);
+    const hugepages_tests = b.addTest("src/hugepages.zig");
+    hugepages_tests.setBuildMode(mode);
+    test_step.dependOn(&hugepages_tests.step);
+
+    // Benchmarks always run in release-fast.
+    const bench_out = b.option([]const u8, "bench-out", "Write benchmark results (JSON) to this file");
+    const bench_max_size = b.option([]const u8, "bench-max-size", "Biggest filter for `bench`, e.g. 8G (default 1G)");
+
+    // Filter library
+    const bench = b.addExecutable("bench", "bench/bench.zig");
+    bench.setBuildMode(builtin.Mode.ReleaseFast);
+    bench.addPackagePath("cuckoofilter", "src/lib/zig-cuckoofilter.zig");
+    const run_bench = bench.run();
+    if (bench_out) |out| run_bench.addArgs([][]const u8{ "--out", out });
+    if (bench_max_size) |size| run_bench.addArgs([][]const u8{ "--max-size", size });
+    const bench_step = b.step("bench", "Benchmark the filter library");
+    bench_step.dependOn(&run_bench.step);
+
+    // Module commands, on a redis-server spawned by the script
+    const bench_lib = b.addSharedLibrary("redis-cuckoofilter-bench", "src/redis-cuckoofilter.zig", b.version(1, 2, 0));
+    bench_lib.setBuildMode(builtin.Mode.ReleaseFast);
+    bench_lib.addIncludeDir("src");
+    bench_lib.linkSystemLibrary("c");
+    const run_redis_bench = b.addSystemCommand([][]const u8{ "python3", "bench/redis_bench.py", "--module" });
+    run_redis_bench.addArtifactArg(bench_lib);
+    if (bench_out) |out| run_redis_bench.addArgs([][]const u8{ "--out", out });
+    const redis_bench_step = b.step("bench-redis", "Benchmark the module commands on a local redis-server");
+    redis_bench_step.dependOn(&run_redis_bench.step);
+}
@@ -0,0 +1,328 @@
+const std = @import("std");
+const mem = std.mem;
+
+// Hash functions used by the item commands (CF.ADDITEM & co.) to derive
+// hash and fingerprint from the raw bytes of an item, server side.
+// Each key picks its function and seed when it gets created and keeps them
+// forever (they are persisted): changing either would make every item
+// already in the filter unreachable.
+//
+// Both are ports of the reference implementations of xxHash
+// (https://github.com/Cyan4973/xxHash) and produce the same values:
+//   XXH3    XXH3_64bits_withSeed, the default, fastest on short items.
+//   XXH64   XXH64, for clients that already hash items with it.
+pub const Hash = enum {
+    XXH3,
+    XXH64,
+};
+
+// A hash function and its seed: everything a key needs to hash items.
+pub const Hasher = struct {
+    kind: Hash,
+    seed: u64,
+
+    pub const Default = Hasher{ .kind = Hash.XXH3, .seed = 0 };
+
+    pub fn digest(self: Hasher, bytes: []const u8) u64 {
+        return switch (self.kind) {
+            .XXH3 => xxh3(bytes, self.seed),
+            .XXH64 => xxh64(bytes, self.seed),
+        };
+    }
+};
+
+// Ids used to persist the hash function of a key.
+// Never reuse or renumber them.
+pub fn toId(kind: Hash) u64 {
+    return switch (kind) {
+        .XXH3 => 1,
+        .XXH64 => 2,
+    };
+}
+
+pub fn fromId(id: u64) !Hash {
+    return switch (id) {
+        1 => Hash.XXH3,
+        2 => Hash.XXH64,
+        else => error.BadHash,
+    };
+}
+
+// Fingerprint of an item with hash `h`.
+// Bucket indexes come from the low bits of the hash (31 of them at most,
+// for the biggest filters) so fingerprints are taken from the high half,
+// to keep the two independent. Filters with fingerprints narrower than
+// 32 bits use the low bits of the result.
+pub fn fingerprint(h: u64) u32 {
+    return @truncate(u32, h >> 32);
+}
+
+const P64_1: u64 = 0x9E3779B185EBCA87;
+const P64_2: u64 = 0xC2B2AE3D27D4EB4F;
+const P64_3: u64 = 0x165667B19E3779F9;
+const P64_4: u64 = 0x85EBCA77C2B2AE63;
+const P64_5: u64 = 0x27D4EB2F165667C5;
+const P32_1: u64 = 0x9E3779B1;
+const P32_2: u64 = 0x85EBCA77;
+const P32_3: u64 = 0xC2B2AE3D;
+
+inline fn read64(bytes: []const u8, i: usize) u64 {
+    return mem.readIntSliceLittle(u64, bytes[i .. i + 8]);
+}
+
+inline fn read32(bytes: []const u8, i: usize) u64 {
+    return u64(mem.readIntSliceLittle(u32, bytes[i .. i + 4]));
+}
+
+inline fn rotl(x: u64, comptime r: comptime_int) u64 {
+    return (x << r) | (x >> (64 - r));
+}
+
+pub fn xxh64(bytes: []const u8, seed: u64) u64 {
+    const len = bytes.len;
+    var i: usize = 0;
+    var h: u64 = undefined;
+    if (len >= 32) {
+        var v1 = seed +% P64_1 +% P64_2;
+        var v2 = seed +% P64_2;
+        var v3 = seed;
+        var v4 = seed -% P64_1;
+        while (i + 32 <= len) : (i += 32) {
+            v1 = xxh64Round(v1, read64(bytes, i));
+            v2 = xxh64Round(v2, read64(bytes, i + 8));
+            v3 = xxh64Round(v3, read64(bytes, i + 16));
+            v4 = xxh64Round(v4, read64(bytes, i + 24));
+        }
+        h = rotl(v1, 1) +% rotl(v2, 7) +% rotl(v3, 12) +% rotl(v4, 18);
+        h = xxh64Merge(h, v1);
+        h = xxh64Merge(h, v2);
+        h = xxh64Merge(h, v3);
+        h = xxh64Merge(h, v4);
+    } else {
+        h = seed +% P64_5;
+    }
+
+    h +%= u64(len);
+    while (i + 8 <= len) : (i += 8) {
+        h ^= xxh64Round(0, read64(bytes, i));
+        h = rotl(h, 27) *% P64_1 +% P64_4;
+    }
+    if (i + 4 <= len) {
+        h ^= read32(bytes, i) *% P64_1;
+        h = rotl(h, 23) *% P64_2 +% P64_3;
+        i += 4;
+    }
+    while (i < len) : (i += 1) {
+        h ^= u64(bytes[i]) *% P64_5;
+        h = rotl(h, 11) *% P64_1;
+    }
+    return xxh64Avalanche(h);
+}
+
+inline fn xxh64Round(acc: u64, input: u64) u64 {
+    return rotl(acc +% input *% P64_2, 31) *% P64_1;
+}
+
+inline fn xxh64Merge(acc: u64, val: u64) u64 {
+    return (acc ^ xxh64Round(0, val)) *% P64_1 +% P64_4;
+}
+
+inline fn xxh64Avalanche(x: u64) u64 {
+    var h = x;
+    h ^= h >> 33;
+    h *%= P64_2;
+    h ^= h >> 29;
+    h *%= P64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Default XXH3 secret.
+const Secret = []u8{
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+const SecretSizeMin = 136;
+const StripeLen = 64;
+
+pub fn xxh3(bytes: []const u8, seed: u64) u64 {
+    if (bytes.len <= 16) return xxh3Short(bytes, seed);
+    if (bytes.len <= 128) return xxh3Medium(bytes, seed);
+    if (bytes.len <= 240) return xxh3Mid(bytes, seed);
+    return xxh3Long(bytes, seed);
+}
+
+fn xxh3Short(bytes: []const u8, seed: u64) u64 {
+    const len = bytes.len;
+    const s = Secret[0..];
+    if (len > 8) {
+        const lo = read64(bytes, 0) ^ ((read64(s, 24) ^ read64(s, 32)) +% seed);
+        const hi = read64(bytes, len - 8) ^ ((read64(s, 40) ^ read64(s, 48)) -% seed);
+        return xxh3Avalanche(u64(len) +% @bswap(u64, lo) +% hi +% fold64(lo, hi));
+    }
+    if (len >= 4) {
+        const seed2 = seed ^ (u64(@bswap(u32, @truncate(u32, seed))) << 32);
+        const input = read32(bytes, len - 4) +% (read32(bytes, 0) << 32);
+        var k = input ^ ((read64(s, 8) ^ read64(s, 16)) -% seed2);
+        k ^= rotl(k, 49) ^ rotl(k, 24);
+        k *%= 0x9FB21C651E98DF25;
+        k ^= (k >> 35) +% u64(len);
+        k *%= 0x9FB21C651E98DF25;
+        return k ^ (k >> 28);
+    }
+    if (len > 0) {
+        const combo = (u32(bytes[0]) << 16) | (u32(bytes[len >> 1]) << 24) | u32(bytes[len - 1]) | (@intCast(u32, len) << 8);
+        return xxh64Avalanche(u64(combo) ^ ((read32(s, 0) ^ read32(s, 4)) +% seed));
+    }
+    return xxh64Avalanche(seed ^ read64(s, 56) ^ read64(s, 64));
+}
+
+// 17 to 128 bytes.
+fn xxh3Medium(bytes: []const u8, seed: u64) u64 {
+    const len = bytes.len;
+    const s = Secret[0..];
+    var acc = u64(len) *% P64_1;
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) {
+                acc +%= mix16(bytes, 48, s, 96, seed) +% mix16(bytes, len - 64, s, 112, seed);
+            }
+            acc +%= mix16(bytes, 32, s, 64, seed) +% mix16(bytes, len - 48, s, 80, seed);
+        }
+        acc +%= mix16(bytes, 16, s, 32, seed) +% mix16(bytes, len - 32, s, 48, seed);
+    }
+    acc +%= mix16(bytes, 0, s, 0, seed) +% mix16(bytes, len - 16, s, 16, seed);
+    return xxh3Avalanche(acc);
+}
+
+// 129 to 240 bytes.
+fn xxh3Mid(bytes: []const u8, seed: u64) u64 {
+    const len = bytes.len;
+    const s = Secret[0..];
+    var acc = u64(len) *% P64_1;
+    var i: usize = 0;
+    while (i < 8) : (i += 1) acc +%= mix16(bytes, 16 * i, s, 16 * i, seed);
+    acc = xxh3Avalanche(acc);
+    while (i < len / 16) : (i += 1) acc +%= mix16(bytes, 16 * i, s, 16 * (i - 8) + 3, seed);
+    acc +%= mix16(bytes, len - 16, s, SecretSizeMin - 17, seed);
+    return xxh3Avalanche(acc);
+}
+
+// Over 240 bytes: stripes of 64 bytes go through 8 accumulators,
+// with the seed mixed into the secret instead of the input.
+fn xxh3Long(bytes: []const u8, seed: u64) u64 {
+    var secret = Secret;
+    if (seed != 0) {
+        var j: usize = 0;
+        while (j < Secret.len) : (j += 16) {
+            mem.writeIntSliceLittle(u64, secret[j .. j + 8], read64(Secret[0..], j) +% seed);
+            mem.writeIntSliceLittle(u64, secret[j + 8 .. j + 16], read64(Secret[0..], j + 8) -% seed);
+        }
+    }
+    const s = secret[0..];
+    const len = bytes.len;
+    var acc = [8]u64{ P32_3, P64_1, P64_2, P64_3, P64_4, P32_2, P64_5, P32_1 };
+
+    const stripes = (s.len - StripeLen) / 8;
+    const block_len = StripeLen * stripes;
+    const blocks = (len - 1) / block_len;
+    var b: usize = 0;
+    while (b < blocks) : (b += 1) {
+        var st: usize = 0;
+        while (st < stripes) : (st += 1) accumulate(&acc, bytes, b * block_len + st * StripeLen, s, st * 8);
+        scramble(&acc, s);
+    }
+    const last_stripes = (len - 1 - block_len * blocks) / StripeLen;
+    var st: usize = 0;
+    while (st < last_stripes) : (st += 1) accumulate(&acc, bytes, blocks * block_len + st * StripeLen, s, st * 8);
+    accumulate(&acc, bytes, len - StripeLen, s, s.len - StripeLen - 7);
+
+    var res = u64(len) *% P64_1;
+    var i: usize = 0;
+    while (i < 4) : (i += 1) res +%= fold64(acc[2 * i] ^ read64(s, 11 + 16 * i), acc[2 * i + 1] ^ read64(s, 19 + 16 * i));
+    return xxh3Avalanche(res);
+}
+
+inline fn accumulate(acc: *[8]u64, bytes: []const u8, offset: usize, s: []const u8, secret_offset: usize) void {
+    var i: usize = 0;
+    while (i < 8) : (i += 1) {
+        const data = read64(bytes, offset + 8 * i);
+        const key = data ^ read64(s, secret_offset + 8 * i);
+        acc[i ^ 1] +%= data;
+        acc[i] +%= (key & 0xffffffff) *% (key >> 32);
+    }
+}
+
+inline fn scramble(acc: *[8]u64, s: []const u8) void {
+    var i: usize = 0;
+    while (i < 8) : (i += 1) {
+        const a = acc[i] ^ (acc[i] >> 47) ^ read64(s, s.len - StripeLen + 8 * i);
+        acc[i] = a *% P32_1;
+    }
+}
+
+inline fn mix16(bytes: []const u8, i: usize, s: []const u8, j: usize, seed: u64) u64 {
+    const lo = read64(bytes, i) ^ (read64(s, j) +% seed);
+    const hi = read64(bytes, i + 8) ^ (read64(s, j + 8) -% seed);
+    return fold64(lo, hi);
+}
+
+// Folds the 128 bit product of `a` and `b` into 64 bits.
+inline fn fold64(a: u64, b: u64) u64 {
+    const product = u128(a) * u128(b);
+    return @truncate(u64, product) ^ @truncate(u64, product >> 64);
+}
+
+inline fn xxh3Avalanche(x: u64) u64 {
+    var h = x ^ (x >> 37);
+    h *%= 0x165667919E3779F9;
+    return h ^ (h >> 32);
+}
+
+test "reference values" {
+    var buf: [1000]u8 = undefined;
+    for (buf) |*b, i| b.* = @intCast(u8, i % 251);
+
+    // Every code path of both functions, seeded and not.
+    const inputs = [][]const u8{ "", "a", "abc", "redis-cuckoofilter", buf[0..100], buf[0..200], buf[0..1000] };
+    const xxh3_values = [][2]u64{
+        []u64{ 0x2d06800538d394c2, 0xb029411ff43d84d2 },
+        []u64{ 0xe6c632b61e964e1f, 0x4c437dd47f0716f4 },
+        []u64{ 0x78af5f94892f3950, 0xd8438def21bbdcc3 },
+        []u64{ 0x5ab1fb189cad88f9, 0x354d6f86bdb4da44 },
+        []u64{ 0x004e4f921a64bd1c, 0xa5cd98c344a5633a },
+        []u64{ 0xf42a8864feaf0703, 0xc335a2de8a09a90e },
+        []u64{ 0x33ef703fb2b20ed1, 0x0f580bfa20541114 },
+    };
+    const xxh64_values = [][2]u64{
+        []u64{ 0xef46db3751d8e999, 0x98b1582b0977e704 },
+        []u64{ 0xd24ec4f1a98c6e5b, 0x88e4fe59adf7b0cc },
+        []u64{ 0x44bc2cf5ad770999, 0x13c1d910702770e6 },
+        []u64{ 0x7020afc76584b7bf, 0x02c55bb265e1bdf5 },
+        []u64{ 0x6ac1e58032166597, 0x819d2b726001d507 },
+        []u64{ 0x50dc1079b99e879c, 0xc22d00b9fd05a710 },
+        []u64{ 0xf306f04aa88b54d3, 0x7c09c65249ea7a94 },
+    };
+    for (inputs) |input, i| {
+        std.testing.expect(xxh3(input, 0) == xxh3_values[i][0]);
+        std.testing.expect(xxh3(input, 42) == xxh3_values[i][1]);
+        std.testing.expect(xxh64(input, 0) == xxh64_values[i][0]);
+        std.testing.expect(xxh64(input, 42) == xxh64_values[i][1]);
+    }
+}
+
+test "persisted ids" {
+    std.testing.expect((fromId(toId(Hash.XXH3)) catch unreachable) == Hash.XXH3);
+    std.testing.expect((fromId(toId(Hash.XXH64)) catch unreachable) == Hash.XXH64);
+    std.testing.expectError(error.BadHash, fromId(0));
+}
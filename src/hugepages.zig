@@ -0,0 +1,63 @@
+const builtin = @import("builtin");
+const std = @import("std");
+
+// Huge-page backed memory for bucket storage.
+// Big filters get probed at random offsets, so with regular 4K pages almost
+// every lookup is also a TLB miss. Mapping them with 2M pages makes the page
+// table small enough to stay in the TLB.
+//
+// Memory obtained here is mapped directly from the kernel, bypassing the
+// Redis allocator, so it does not show up in `used_memory`.
+
+pub const HugePageSize = 2 * 1024 * 1024;
+
+// Not available in the std of all the Zig versions we care about.
+const MAP_HUGETLB = 0x40000;
+const MADV_HUGEPAGE = 14;
+
+// Returns the number of bytes that will be actually mapped for `size` bytes.
+pub fn mappedSize(size: usize) usize {
+    const granularity = if (size >= HugePageSize) usize(HugePageSize) else usize(std.os.page_size);
+    return (size + granularity - 1) & ~(granularity - 1);
+}
+
+// Maps `size` bytes of zeroed memory. Explicit huge pages (hugetlbfs) are
+// tried first and, if none are reserved, we fall back to a regular mapping
+// marked as eligible for transparent huge pages.
+pub fn alloc(size: usize) ![]align(std.os.page_size) u8 {
+    if (builtin.os == builtin.Os.linux) {
+        const linux = std.os.linux;
+        const len = mappedSize(size);
+        const prot = linux.PROT_READ | linux.PROT_WRITE;
+        const flags = linux.MAP_PRIVATE | linux.MAP_ANONYMOUS;
+
+        if (len >= HugePageSize) {
+            const addr = linux.syscall6(linux.SYS_mmap, 0, len, prot, flags | MAP_HUGETLB, @bitCast(usize, isize(-1)), 0);
+            if (linux.getErrno(addr) == 0) return @intToPtr([*]align(std.os.page_size) u8, addr)[0..size];
+        }
+
+        const addr = linux.syscall6(linux.SYS_mmap, 0, len, prot, flags, @bitCast(usize, isize(-1)), 0);
+        if (linux.getErrno(addr) != 0) return error.OutOfMemory;
+
+        // Just a hint, the mapping is good anyway if THP are disabled.
+        _ = linux.syscall3(linux.SYS_madvise, addr, len, MADV_HUGEPAGE);
+        return @intToPtr([*]align(std.os.page_size) u8, addr)[0..size];
+    } else {
+        return error.Unsupported;
+    }
+}
+
+pub fn free(memory: []u8) void {
+    if (builtin.os == builtin.Os.linux) {
+        const linux = std.os.linux;
+        _ = linux.syscall2(linux.SYS_munmap, @ptrToInt(memory.ptr), mappedSize(memory.len));
+    } else {
+        unreachable;
+    }
+}
+
+test "mapped size" {
+    std.testing.expect(mappedSize(1024) == std.os.page_size);
+    std.testing.expect(mappedSize(HugePageSize) == HugePageSize);
+    std.testing.expect(mappedSize(HugePageSize + 1) == 2 * HugePageSize);
+}
@@ -4,45 +4,438 @@ const testing = std.testing;
 
 const FREE_SLOT = 0;
 
-// Use the provided function to re-seed the default PRNG implementation.
-var xoro = std.rand.Xoroshiro128.init(42);
-pub fn seed_default_prng(seed: u64) void {
-    xoro.seed(seed);
+// Each filter picks the fingerprints to evict with its own xoroshiro128+
+// PRNG, whose state lives in the filter (`prng_state`): save and restore it
+// together with the buckets to get fully deterministic insertions.
+// Every new filter starts from this state, use `seed_prng` to change it.
+// By overriding .rand_fn you can provide your own custom PRNG implementation,
+// useful in adversarial situations (CSPRNG).
+// You can use Filter<X>.RandomFn to see the function type you need to fulfill.
+pub const DefaultPrngState: [2]u64 = comptime std.rand.Xoroshiro128.init(42).s;
+
+// Outcome of a single item processed by one of the batch functions.
+// Mirrors the return values and errors of the single-item functions.
+pub const BatchResult = enum {
+    Ok,
+    NotFound,
+    TooFull,
+    Broken,
+};
+
+// Length of the kick-chain histogram in Stats.
+pub const KickHistogramLen = 10;
+
+// Counters a filter keeps up to date when its `stats` field is set.
+// `kicks[0]` counts insertions that found a free slot right away,
+// `kicks[i]` insertions that had to relocate between 2^(i-1) and 2^i - 1
+// fingerprints (the last one also counts chains that gave up and left a
+// fingerprint in the homeless slot, those are counted in `homeless` too).
+// Lookups are counted by where the fingerprint was found.
+pub const Stats = struct {
+    kicks: [KickHistogramLen]u64,
+    evictions: u64,
+    homeless: u64,
+    rejected: u64,
+    primary_hits: u64,
+    alt_hits: u64,
+    homeless_hits: u64,
+    misses: u64,
+
+    pub fn init() Stats {
+        return Stats{
+            .kicks = []u64{0} ** KickHistogramLen,
+            .evictions = 0,
+            .homeless = 0,
+            .rejected = 0,
+            .primary_hits = 0,
+            .alt_hits = 0,
+            .homeless_hits = 0,
+            .misses = 0,
+        };
+    }
+
+    pub fn merge(self: *Stats, other: Stats) void {
+        for (self.kicks) |*k, i| k.* += other.kicks[i];
+        self.evictions += other.evictions;
+        self.homeless += other.homeless;
+        self.rejected += other.rejected;
+        self.primary_hits += other.primary_hits;
+        self.alt_hits += other.alt_hits;
+        self.homeless_hits += other.homeless_hits;
+        self.misses += other.misses;
+    }
+};
+
+// How `add` makes room for a fingerprint when its primary bucket is full.
+//   RandomWalk  evicts a random fingerprint and moves it to its other bucket,
+//               repeating up to 500 times (the original cuckoo filter insertion).
+//   BFS         searches breadth-first for the shortest chain of displacements
+//               that ends in a free slot, scanning at most `BfsMaxNodes` buckets
+//               and `BfsMaxDepth` displacements, then moves the fingerprints along
+//               it. Worst-case latency stays bounded and fills of ~95% are
+//               reliable with 4-slot buckets. The PRNG is not used.
+// Both are deterministic: the same sequence of operations gives the same buckets.
+pub const Insertion = enum {
+    RandomWalk,
+    BFS,
+};
+
+// Where the alternate bucket of a fingerprint can be.
+//   Table     anywhere in the table (the original cuckoo filter placement).
+//   Page      in the same 4KB block of bucket memory as the primary bucket,
+//             so that a lookup never needs more than one TLB entry.
+//   HugePage  same, within 2MB: one TLB entry when buckets live in huge pages.
+//   Line      half of the fingerprints (picked by their hash) keep both buckets
+//             in the same 64 byte block, the others in the same 4KB block.
+//             Keeping all of them within a cache line would cap the load
+//             factor around 70%, mixing in a wider range like vacuum filters
+//             do keeps it close to Page.
+// Blocks are aligned to their size within bucket memory, buckets that
+// are not a power of 2 bytes wide (6b and 12b) can straddle two blocks.
+// Restricted placements trade some of the maximum load factor (a few percent
+// for Page) for one memory access per lookup instead of two.
+pub const Locality = enum {
+    Table,
+    Line,
+    Page,
+    HugePage,
+};
+
+// Everything that decides the two buckets of a fingerprint. Filters
+// with the same shape put an item in the same buckets, and the shape
+// alone is enough to tell which items a lookup could match (see `item_key`).
+pub const Shape = struct {
+    bucket_count: usize,
+    locality: Locality,
+    alt_masks: [2]usize,
+};
+
+pub const BfsMaxDepth = 5;
+pub const BfsMaxNodes = 128;
+
+// A filter as a single blob, to build filters in one place and load them in
+// another (e.g. with CF.LOADIMAGE): `ImageHeaderSize` bytes of header followed
+// by the bucket memory, as returned by `image_header` and `@sliceToBytes(buckets)`.
+// Header layout, all numbers little endian:
+//   0 "ZCF1"       4 fp bits      5 encoding (0 plain, 1 semi-sorted)
+//   6 insertion    7 locality     8 homeless fp (u32)   12 broken
+//  16 homeless bucket index (u64)  24 fpcount (u64)  32 bucket bytes (u64)
+//  40 prng state (2 x u64)        56 reserved, 0
+pub const ImageHeaderSize = 64;
+const ImageMagic = "ZCF1";
+
+pub const ImageHeader = struct {
+    fp_bits: u8,
+    semi_sorted: bool,
+    insertion: Insertion,
+    locality: Locality,
+    broken: bool,
+    homeless_fp: u32,
+    homeless_bucket_idx: u64,
+    fpcount: u64,
+    bucket_bytes: u64,
+    prng_state: [2]u64,
+
+    pub fn parse(bytes: []const u8) !ImageHeader {
+        if (bytes.len < ImageHeaderSize or !std.mem.eql(u8, bytes[0..4], ImageMagic)) return error.BadImage;
+        if (bytes[5] > 1 or bytes[6] > @enumToInt(Insertion.BFS) or bytes[7] > @enumToInt(Locality.HugePage) or bytes[12] > 1) return error.BadImage;
+        return ImageHeader{
+            .fp_bits = bytes[4],
+            .semi_sorted = bytes[5] == 1,
+            .insertion = @intToEnum(Insertion, @truncate(@TagType(Insertion), bytes[6])),
+            .locality = @intToEnum(Locality, @truncate(@TagType(Locality), bytes[7])),
+            .broken = bytes[12] == 1,
+            .homeless_fp = std.mem.readIntSliceLittle(u32, bytes[8..12]),
+            .homeless_bucket_idx = std.mem.readIntSliceLittle(u64, bytes[16..24]),
+            .fpcount = std.mem.readIntSliceLittle(u64, bytes[24..32]),
+            .bucket_bytes = std.mem.readIntSliceLittle(u64, bytes[32..40]),
+            .prng_state = []u64{ std.mem.readIntSliceLittle(u64, bytes[40..48]), std.mem.readIntSliceLittle(u64, bytes[48..56]) },
+        };
+    }
+};
+
+// Change tracking, to keep copies of a filter in sync by shipping only the
+// parts of bucket memory that changed. Bucket memory is split in ranges of
+// `DirtyRangeBytes`, each one remembers the epoch of its last change. The
+// epoch goes up by one at every bucket write, so a copy that is up to date
+// as of epoch E needs the ranges changed after E (see `changes_since`) and
+// the filter's image header. Copies apply them with `apply_delta` and
+// `apply_image_header`.
+// Epochs only make sense within the same tracking: `id`, chosen by the
+// caller, tells them apart (e.g. tracking starting over after a restart
+// or on another filter), copies from another one need a full resync.
+// The memory for the epochs is provided by the caller, like `Stats`.
+pub const DirtyRangeBytes = 4096;
+
+pub const Dirty = struct {
+    id: u64,
+    epoch: u64,
+    range_epochs: []u64,
+
+    pub fn ranges_for(bucket_bytes: usize) usize {
+        return (bucket_bytes + DirtyRangeBytes - 1) / DirtyRangeBytes;
+    }
+
+    // Every range starts as changed at `epoch`: copies older than
+    // that get all of bucket memory as their next delta.
+    pub fn init(range_epochs: []u64, id: u64, epoch: u64) Dirty {
+        for (range_epochs) |*e| e.* = epoch;
+        return Dirty{ .id = id, .epoch = epoch, .range_epochs = range_epochs };
+    }
+
+    fn mark(self: *Dirty, offset: usize, len: usize) void {
+        self.epoch += 1;
+        var range = offset / DirtyRangeBytes;
+        while (range <= (offset + len - 1) / DirtyRangeBytes) : (range += 1) {
+            self.range_epochs[range] = self.epoch;
+        }
+    }
+};
+
+// A run of bucket memory, starting at byte `offset`.
+pub const DeltaRun = struct {
+    offset: usize,
+    bytes: []const u8,
+};
+
+// Runs of bucket memory changed after `epoch`, adjacent ranges
+// are merged in a single run. Runs point straight into the buckets.
+pub const ChangeIterator = struct {
+    bytes: []const u8,
+    range_epochs: []const u64,
+    epoch: u64,
+    range: usize,
+
+    pub fn next(it: *ChangeIterator) ?DeltaRun {
+        while (it.range < it.range_epochs.len and it.range_epochs[it.range] <= it.epoch) it.range += 1;
+        if (it.range == it.range_epochs.len) return null;
+
+        const first = it.range;
+        while (it.range < it.range_epochs.len and it.range_epochs[it.range] > it.epoch) it.range += 1;
+        const from = first * DirtyRangeBytes;
+        const to = std.math.min(it.range * DirtyRangeBytes, it.bytes.len);
+        return DeltaRun{ .offset = from, .bytes = it.bytes[from..to] };
+    }
+};
+
+// Number of items whose buckets get prefetched before any of them is scanned.
+// Big enough to keep several cache misses in flight at once, small enough
+// to keep the precomputed bucket indices on the stack.
+pub const BatchWindow = 16;
+
+// An item of a batch, as produced by the sources of the `*_batch_from` functions.
+pub fn BatchItem(comptime Tfp: type) type {
+    return struct {
+        hash: u64,
+        fingerprint: Tfp,
+    };
 }
 
-// If you want to read the state of the default PRNG impl:
-pub fn get_default_prng_state() [2]u64 {
-    return xoro.s;
+// Batch source over parallel slices of hashes and fingerprints, used by the
+// plain batch functions. Other sources need the same two functions:
+// `len` returns the number of items, `get(i)` returns item `i`. Each item
+// is fetched exactly once and in order.
+pub fn SliceSource(comptime Tfp: type) type {
+    return struct {
+        hashes: []const u64,
+        fingerprints: []const Tfp,
+
+        pub fn len(self: @This()) usize {
+            return self.hashes.len;
+        }
+
+        pub fn get(self: @This(), i: usize) BatchItem(Tfp) {
+            return BatchItem(Tfp){ .hash = self.hashes[i], .fingerprint = self.fingerprints[i] };
+        }
+    };
 }
 
-// If you want to set the state of the default PRNG impl:
-pub fn set_default_prng_state(s: [2]u64) void {
-    xoro.s = s;
+// Tells the CPU that we are busy-waiting on another thread.
+inline fn spin_hint() void {
+    switch (builtin.arch) {
+        builtin.Arch.x86_64 => asm volatile ("pause"
+            :
+            :
+            : "memory"
+        ),
+        builtin.Arch.aarch64 => asm volatile ("yield"
+            :
+            :
+            : "memory"
+        ),
+        else => {},
+    }
 }
 
-// Default PRNG implementation.
-// By overriding .rand_fn you can provide your own custom PRNG implementation.
-// Useful in adversarial situations (CSPRNG) or when you need deterministic behavior
-// from the filter, as it requires to be able to save and restore the PRNG's state.
-// You can use Filter<X>.RandomFn to see the function type you need to fulfill.
-fn XoroRandFnImpl(comptime T: type) type {
+// Hints the CPU to start loading the cache line that contains `ptr`.
+// Compiles to nothing on architectures we don't know how to prefetch on.
+pub inline fn prefetch(ptr: var) void {
+    switch (builtin.arch) {
+        builtin.Arch.x86_64 => asm volatile ("prefetcht0 (%[ptr])"
+            :
+            : [ptr] "r" (ptr)
+        ),
+        builtin.Arch.aarch64 => asm volatile ("prfm pldl1keep, [%[ptr]]"
+            :
+            : [ptr] "r" (ptr)
+        ),
+        else => {},
+    }
+}
+
+// SWAR (SIMD within a register) kernels used to scan a whole bucket at once.
+// A bucket of `lanes` fingerprints of type `Tfp` is loaded as a single integer
+// and all of its slots are compared with a handful of arithmetic operations,
+// instead of branching on each slot.
+fn SwarKernels(comptime Tfp: type, comptime lanes: usize) type {
+    return struct {
+        pub const LaneBits = @typeInfo(Tfp).Int.bits;
+        pub const Word = @IntType(false, lanes * LaneBits);
+
+        // Lowest and highest bit of each lane.
+        const LoBits = comptime blk: {
+            var res: Word = 0;
+            var i: usize = 0;
+            while (i < lanes) : (i += 1) res |= Word(1) << @intCast(std.math.Log2Int(Word), i * LaneBits);
+            break :blk res;
+        };
+        const HiBits = LoBits << (LaneBits - 1);
+
+        // Returns a non-zero mask if at least one lane of `word` equals `fp`.
+        // The lowest set bit of the mask is always the top bit of the first
+        // matching lane, higher bits can be false positives caused by borrows
+        // and must be ignored.
+        pub inline fn match(word: Word, fp: Tfp) Word {
+            const x = word ^ (LoBits *% Word(fp));
+            return (x -% LoBits) & ~x & HiBits;
+        }
+
+        // Index of the first matching lane of a non-zero mask returned by `match`.
+        pub inline fn first_lane(mask: Word) usize {
+            return @ctz(mask) / LaneBits;
+        }
+    };
+}
+
+// Semi-sorting, from "Cuckoo Filter: Practically Better Than Bloom" (Fan et al.).
+// The 4 fingerprints of a bucket are kept sorted, so their high nibbles form a
+// non-decreasing sequence. There are only 3876 such sequences, so they fit in a
+// 12 bit index instead of 16 bits, saving one bit per fingerprint. The low bits
+// of each fingerprint are stored as they are, after the index.
+// Decoding takes a single lookup in a comptime-generated table.
+fn SemiSortKernels(comptime Tfp: type) type {
     return struct {
-        fn random() T {
-            return xoro.random.int(T);
+        const FPBits = @typeInfo(Tfp).Int.bits;
+        const LowBits = FPBits - 4;
+        const Low = @IntType(false, LowBits);
+        const IndexBits = 12;
+        pub const Word = @IntType(false, 4 * FPBits);
+        pub const Encoded = @IntType(false, 4 * FPBits - 4);
+
+        // High nibbles of each sequence (4 bits each, first one in the lowest bits),
+        // indexed by the rank of the sequence. Padded to the full 12 bit range, so
+        // that decoding garbage (e.g. a torn read in a concurrent filter) is safe.
+        const DecodeTable = comptime blk: {
+            @setEvalBranchQuota(100000);
+            var table = []u16{0} ** 4096;
+            var a: usize = 0;
+            while (a < 16) : (a += 1) {
+                var b: usize = a;
+                while (b < 16) : (b += 1) {
+                    var c: usize = b;
+                    while (c < 16) : (c += 1) {
+                        var d: usize = c;
+                        while (d < 16) : (d += 1) {
+                            table[rank(a, b, c, d)] = @intCast(u16, a | (b << 4) | (c << 8) | (d << 12));
+                        }
+                    }
+                }
+            }
+            break :blk table;
+        };
+
+        // Position of a non-decreasing sequence of nibbles in
+        // the combinatorial number system, between 0 and 3875.
+        inline fn rank(a: usize, b: usize, c: usize, d: usize) usize {
+            return a + choose(b + 1, 2) + choose(c + 2, 3) + choose(d + 3, 4);
+        }
+
+        inline fn choose(n: usize, comptime k: usize) usize {
+            var res: usize = 1;
+            comptime var i = 0;
+            inline while (i < k) : (i += 1) res = res * (n - i) / (i + 1);
+            return res;
+        }
+
+        // Returns the 4 fingerprints of an encoded bucket, sorted, as lanes of a word.
+        pub inline fn decode(bucket: Encoded) Word {
+            const nibbles = DecodeTable[@truncate(u12, bucket)];
+            var word: Word = 0;
+            comptime var i = 0;
+            inline while (i < 4) : (i += 1) {
+                const high = Word((nibbles >> (i * 4)) & 0xf);
+                const low = Word(@truncate(Low, bucket >> (IndexBits + i * LowBits)));
+                word |= ((high << LowBits) | low) << (i * FPBits);
+            }
+            return word;
+        }
+
+        // Sorts the lanes of `word` and encodes them.
+        pub inline fn encode(word: Word) Encoded {
+            var fps: [4]Tfp = undefined;
+            comptime var i = 0;
+            inline while (i < 4) : (i += 1) fps[i] = @truncate(Tfp, word >> (i * FPBits));
+
+            // Sorting network
+            sort2(&fps[0], &fps[1]);
+            sort2(&fps[2], &fps[3]);
+            sort2(&fps[0], &fps[2]);
+            sort2(&fps[1], &fps[3]);
+            sort2(&fps[1], &fps[2]);
+
+            var res = @intCast(Encoded, rank(fps[0] >> LowBits, fps[1] >> LowBits, fps[2] >> LowBits, fps[3] >> LowBits));
+            i = 0;
+            inline while (i < 4) : (i += 1) res |= Encoded(@truncate(Low, fps[i])) << (IndexBits + i * LowBits);
+            return res;
+        }
+
+        inline fn sort2(x: *Tfp, y: *Tfp) void {
+            if (x.* > y.*) {
+                const tmp = x.*;
+                x.* = y.*;
+                y.* = tmp;
+            }
         }
     };
 }
 
+// How fingerprints are laid out in a bucket.
+const Encoding = enum {
+    Plain,
+    SemiSorted,
+};
+
 // Supported CuckooFilter implementations.
 // Bucket size is chosen mainly to keep the bucket 64bit word-sized, or under.
 // This way reading a bucket requires a single memory fetch.
 // Filter8 does not have 8-fp wide buckets to keep the error rate under 3%,
 // as this is the cutoff point where Cuckoo Filters become more space-efficient
 // than Bloom. We also enforce memory alignment.
-pub const Filter8 = CuckooFilter(u8, 4);
-pub const Filter16 = CuckooFilter(u16, 4);
-pub const Filter32 = CuckooFilter(u32, 2);
-fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
+// Filter6 and Filter12 use fingerprints that are not byte-aligned: their
+// buckets are bit-packed (3 and 6 bytes respectively) and slots are read
+// and written by shifting and masking the whole bucket word.
+// SemiSortedFilterN uses N-bit fingerprints, semi-sorted, in the same memory
+// as a plain filter with (N-1)-bit fingerprints: SemiSortedFilter9 has 4 byte
+// buckets like Filter8, but half its error rate.
+pub const Filter6 = CuckooFilter(u6, 4, .Plain);
+pub const Filter8 = CuckooFilter(u8, 4, .Plain);
+pub const Filter12 = CuckooFilter(u12, 4, .Plain);
+pub const Filter16 = CuckooFilter(u16, 4, .Plain);
+pub const Filter32 = CuckooFilter(u32, 2, .Plain);
+pub const SemiSortedFilter9 = CuckooFilter(u9, 4, .SemiSorted);
+pub const SemiSortedFilter13 = CuckooFilter(u13, 4, .SemiSorted);
+pub const SemiSortedFilter17 = CuckooFilter(u17, 4, .SemiSorted);
+fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize, comptime encoding: Encoding) type {
     return struct {
         homeless_fp: Tfp,
         homeless_bucket_idx: usize,
@@ -50,15 +443,48 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
         fpcount: usize,
         broken: bool,
         rand_fn: ?RandomFn,
+        prng_state: [2]u64,
+        insertion: Insertion,
+        locality: Locality,
+        alt_masks: [2]usize,
+        stats: ?*Stats,
+        dirty: ?*Dirty,
 
         pub const FPType = Tfp;
-        pub const Align = std.math.min(@alignOf(usize), @alignOf(@IntType(false, buckSize * @typeInfo(Tfp).Int.bits)));
+        pub const BucketSize = buckSize;
+        pub const IsSemiSorted = encoding == .SemiSorted;
+        pub const Align = std.math.min(@alignOf(usize), @alignOf(Word));
         pub const MaxError = 2.0 * @intToFloat(f32, buckSize) / @intToFloat(f32, 1 << @typeInfo(Tfp).Int.bits);
         pub const RandomFn = fn () BucketSizeType;
 
         const BucketSizeType = @IntType(false, comptime std.math.log2(buckSize));
-        const Bucket = [buckSize]Tfp;
-        const MinSize = @sizeOf(Tfp) * buckSize * 2;
+        const FPBits = @typeInfo(Tfp).Int.bits;
+        const Word = @IntType(false, buckSize * FPBits);
+        const Swar = SwarKernels(Tfp, buckSize);
+
+        // Fingerprints that don't fill whole bytes are packed back to back,
+        // slot `i` lives in bits [i*FPBits, (i+1)*FPBits) of the little
+        // endian word made of the bucket bytes.
+        // Semi-sorted buckets are always packed, and get decoded into the
+        // same layout by load_word (and encoded back by store_word).
+        const Packed = IsSemiSorted or FPBits % 8 != 0;
+        const BucketBits = if (IsSemiSorted) buckSize * FPBits - 4 else buckSize * FPBits;
+        const Bucket = if (Packed) [@divExact(BucketBits, 8)]u8 else [buckSize]Tfp;
+        const BucketWord = @IntType(false, BucketBits);
+        const WordShift = std.math.Log2Int(Word);
+        const SemiSort = SemiSortKernels(Tfp);
+
+        // Nominal number of bytes of a slot, see bytes_for.
+        const SlotSize = if (IsSemiSorted) @sizeOf(@IntType(false, FPBits - 1)) else @sizeOf(Tfp);
+
+        comptime {
+            if (IsSemiSorted and (buckSize != 4 or FPBits <= 4)) @compileError("semi-sorting needs 4 slots per bucket and fingerprints wider than 4 bits");
+        }
+
+        // Buckets that fit in a machine word are scanned with SWAR kernels,
+        // wider layouts fall back to comparing one slot at a time.
+        const UseSwar = @sizeOf(Word) <= @sizeOf(u64);
+        const MinSize = SlotSize * buckSize * 2;
         const Self = @This();
         const ScanMode = enum {
             Set,
@@ -74,25 +500,47 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
         pub fn size_for_exactly(min_capacity: usize) usize {
             var res = std.math.pow(usize, 2, std.math.log2(min_capacity));
             if (res != min_capacity) res <<= 1;
-            const requested_size = res * @sizeOf(Tfp);
+            const requested_size = res * SlotSize;
             return if (MinSize > requested_size) MinSize else requested_size;
         }
 
         pub fn capacity(size: usize) usize {
-            return size / @sizeOf(Tfp);
+            return size / SlotSize;
+        }
+
+        // Sizes used by `size_for` and `capacity` are nominal: they count
+        // every fingerprint as @sizeOf(Tfp) bytes (@sizeOf of a 1 bit narrower
+        // fingerprint for semi-sorted filters). Packed filters need less
+        // memory than that, use bytes_for to know how much.
+        pub fn bytes_for(size: usize) usize {
+            return size / (SlotSize * buckSize) * @sizeOf(Bucket);
+        }
+
+        // Inverse of bytes_for.
+        pub fn nominal_size(self: *const Self) usize {
+            return self.buckets.len * SlotSize * buckSize;
         }
 
         // Use bytesToBuckets when you have persisted the filter and need to restore it.
         // This will allow to cast back your bytes slice in the correct type for the .buckets
         // property. Make sure you still have the right alignment when loading the data back!
         pub fn bytesToBuckets(memory: []align(Align) u8) ![]align(Align) Bucket {
-            const not_pow2 = memory.len != std.math.pow(usize, 2, std.math.log2(memory.len));
-            if (not_pow2 or memory.len < MinSize) return error.BadLength;
+            if (memory.len % @sizeOf(Bucket) != 0) return error.BadLength;
+            const bucket_count = memory.len / @sizeOf(Bucket);
+            if (bucket_count < 2) return error.BadLength;
+            if (bucket_count != std.math.pow(usize, 2, std.math.log2(bucket_count))) return error.BadLength;
             return @bytesToSlice(Bucket, memory);
         }
 
         pub fn init(memory: []align(Align) u8) !Self {
             for (memory) |*x| x.* = 0;
+            return init_zeroed(memory);
+        }
+
+        // Same as init, but trusts `memory` to be already zeroed (e.g. fresh
+        // pages from calloc or an anonymous mmap), so it never touches it.
+        // This makes creating huge filters O(1) instead of O(size).
+        pub fn init_zeroed(memory: []align(Align) u8) !Self {
             return Self{
                 .homeless_fp = FREE_SLOT,
                 .homeless_bucket_idx = undefined,
@@ -100,9 +548,110 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
                 .fpcount = 0,
                 .broken = false,
                 .rand_fn = null,
+                .prng_state = DefaultPrngState,
+                .insertion = .RandomWalk,
+                .locality = .Table,
+                .alt_masks = []usize{ 0, 0 },
+                .stats = null,
+                .dirty = null,
+            };
+        }
+
+        // Changes where alternate buckets go, only valid on an empty filter
+        // (or one whose fingerprints were placed with the same locality).
+        // A single bucket has nowhere else to go, it keeps using the table.
+        pub fn set_locality(self: *Self, locality: Locality) void {
+            const s = shape_for(self.buckets.len, locality);
+            self.locality = s.locality;
+            self.alt_masks = s.alt_masks;
+        }
+
+        pub fn shape_for(bucket_count: usize, locality: Locality) Shape {
+            return Shape{
+                .bucket_count = bucket_count,
+                .locality = if (bucket_count < 2) Locality.Table else locality,
+                .alt_masks = switch (locality) {
+                    .Table => []usize{ 0, 0 },
+                    .Line => []usize{ block_mask(bucket_count, 64), block_mask(bucket_count, 4096) },
+                    .Page => []usize{ block_mask(bucket_count, 4096), block_mask(bucket_count, 4096) },
+                    .HugePage => []usize{ block_mask(bucket_count, 2 * 1024 * 1024), block_mask(bucket_count, 2 * 1024 * 1024) },
+                },
             };
         }
 
+        // Mask of the bucket index bits that change within a block of `bytes`.
+        fn block_mask(bucket_count: usize, bytes: usize) usize {
+            var n: usize = 2;
+            while (n * 2 * @sizeOf(Bucket) <= bytes) n *= 2;
+            return std.math.min(n, bucket_count) - 1;
+        }
+
+        pub fn shape(self: *const Self) Shape {
+            return Shape{
+                .bucket_count = self.buckets.len,
+                .locality = self.locality,
+                .alt_masks = self.alt_masks,
+            };
+        }
+
+        // Identifies what a lookup for (hash, fingerprint) could match: the
+        // fingerprint and the lower of its two buckets. A set of item keys
+        // answers lookups exactly like the filter they come from.
+        pub fn item_key(s: Shape, hash: u64, fingerprint: Tfp) u64 {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (s.bucket_count - 1);
+            return key_at(s, bucket_idx, fp);
+        }
+
+        inline fn key_at(s: Shape, bucket_idx: usize, fp: Tfp) u64 {
+            const alt_bucket_idx = alt_bucket_idx_for(s, bucket_idx, fp);
+            return (u64(std.math.min(bucket_idx, alt_bucket_idx)) << FPBits) | fp;
+        }
+
+        // Keys of all the fingerprints in the filter, homeless one
+        // included, in bucket order. Copies give the same key twice.
+        pub const ItemKeys = struct {
+            cf: *Self,
+            bucket_idx: usize,
+            slot: usize,
+            homeless_done: bool,
+
+            pub fn next(it: *ItemKeys) ?u64 {
+                const cf = it.cf;
+                while (it.bucket_idx < cf.buckets.len) {
+                    if (it.slot == 0 and cf.load_word(it.bucket_idx) == 0) {
+                        it.bucket_idx += 1;
+                        continue;
+                    }
+                    const bucket_idx = it.bucket_idx;
+                    const fp = cf.get_slot(bucket_idx, it.slot);
+                    it.slot += 1;
+                    if (it.slot == buckSize) {
+                        it.slot = 0;
+                        it.bucket_idx += 1;
+                    }
+                    if (fp != FREE_SLOT) return key_at(cf.shape(), bucket_idx, fp);
+                }
+                if (it.homeless_done) return null;
+                it.homeless_done = true;
+                if (cf.homeless_fp == FREE_SLOT) return null;
+                return key_at(cf.shape(), cf.homeless_bucket_idx, cf.homeless_fp);
+            }
+        };
+
+        pub fn item_keys(self: *Self) ItemKeys {
+            return ItemKeys{
+                .cf = self,
+                .bucket_idx = 0,
+                .slot = 0,
+                .homeless_done = false,
+            };
+        }
+
+        pub fn seed_prng(self: *Self, seed: u64) void {
+            self.prng_state = std.rand.Xoroshiro128.init(seed).s;
+        }
+
         pub fn count(self: *Self) !usize {
             return if (self.broken) error.Broken else self.fpcount;
         }
@@ -110,22 +659,159 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
         pub fn maybe_contains(self: *Self, hash: u64, fingerprint: Tfp) !bool {
             const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
             const bucket_idx = hash & (self.buckets.len - 1);
+            return self.maybe_contains_at(bucket_idx, self.compute_alt_bucket_idx(bucket_idx, fp), fp);
+        }
 
-            // Try primary bucket
-            if (fp == self.scan(bucket_idx, fp, .Search, FREE_SLOT)) return true;
+        pub fn remove(self: *Self, hash: u64, fingerprint: Tfp) !void {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (self.buckets.len - 1);
+            return self.remove_at(bucket_idx, self.compute_alt_bucket_idx(bucket_idx, fp), fp);
+        }
 
-            // Try alt bucket
-            const alt_bucket_idx = self.compute_alt_bucket_idx(bucket_idx, fp);
-            if (fp == self.scan(alt_bucket_idx, fp, .Search, FREE_SLOT)) return true;
+        pub fn add(self: *Self, hash: u64, fingerprint: Tfp) !void {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (self.buckets.len - 1);
+            return self.add_at(bucket_idx, self.compute_alt_bucket_idx(bucket_idx, fp), fp);
+        }
+
+        // Batch versions of `maybe_contains`, `add` and `remove`.
+        // Items are processed in windows of `BatchWindow`: the bucket indices of a whole
+        // window are computed and prefetched before any bucket gets scanned, so that on
+        // big filters the cache misses overlap instead of being paid one after the other.
+        // The outcome of each item is written in the corresponding slot of `results`.
+        pub fn maybe_contains_batch(self: *Self, hashes: []const u64, fingerprints: []const Tfp, results: []BatchResult) void {
+            self.run_batch(.Check, SliceSource(Tfp){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        pub fn add_batch(self: *Self, hashes: []const u64, fingerprints: []const Tfp, results: []BatchResult) void {
+            self.run_batch(.Add, SliceSource(Tfp){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        pub fn remove_batch(self: *Self, hashes: []const u64, fingerprints: []const Tfp, results: []BatchResult) void {
+            self.run_batch(.Remove, SliceSource(Tfp){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        // Same as the batch functions above, with items produced by `source`
+        // (see `SliceSource` for the interface). Useful when hashes have to be
+        // computed first: `source.get` is called for the items of the next window
+        // after the buckets of the current one have been prefetched and before
+        // they get scanned, so hashing overlaps with the loads.
+        pub fn maybe_contains_batch_from(self: *Self, source: var, results: []BatchResult) void {
+            self.run_batch(.Check, source, results);
+        }
+
+        pub fn add_batch_from(self: *Self, source: var, results: []BatchResult) void {
+            self.run_batch(.Add, source, results);
+        }
+
+        pub fn remove_batch_from(self: *Self, source: var, results: []BatchResult) void {
+            self.run_batch(.Remove, source, results);
+        }
+
+        const BatchOp = enum {
+            Check,
+            Add,
+            Remove,
+        };
+
+        // Windows are double-buffered: window `i + 1` is prepared
+        // (and its buckets prefetched) before window `i` is processed.
+        fn run_batch(self: *Self, comptime op: BatchOp, source: var, results: []BatchResult) void {
+            const n = source.len();
+            var windows: [2]Window = undefined;
+            if (n > 0) self.prepare_window(&windows[0], source, 0, std.math.min(BatchWindow, n));
+
+            var current: usize = 0;
+            var start: usize = 0;
+            while (start < n) : (start += BatchWindow) {
+                const next = start + BatchWindow;
+                if (next < n) self.prepare_window(&windows[current ^ 1], source, next, std.math.min(next + BatchWindow, n));
+
+                const window = &windows[current];
+                for (results[start..std.math.min(next, n)]) |*res, i| {
+                    const bucket_idx = window.bucket_idxs[i];
+                    const alt_bucket_idx = window.alt_bucket_idxs[i];
+                    const fp = window.fps[i];
+                    res.* = switch (op) {
+                        .Check => if (self.maybe_contains_at(bucket_idx, alt_bucket_idx, fp)) |found|
+                            (if (found) BatchResult.Ok else BatchResult.NotFound)
+                        else |err| switch (err) {
+                            error.Broken => BatchResult.Broken,
+                        },
+                        .Add => if (self.add_at(bucket_idx, alt_bucket_idx, fp)) BatchResult.Ok else |err| switch (err) {
+                            error.Broken => BatchResult.Broken,
+                            error.TooFull => BatchResult.TooFull,
+                        },
+                        .Remove => if (self.remove_at(bucket_idx, alt_bucket_idx, fp)) BatchResult.Ok else |err| switch (err) {
+                            error.Broken => BatchResult.Broken,
+                        },
+                    };
+                }
+                current ^= 1;
+            }
+        }
+
+        // Precomputed state for a window of batch items.
+        const Window = struct {
+            fps: [BatchWindow]Tfp,
+            bucket_idxs: [BatchWindow]usize,
+            alt_bucket_idxs: [BatchWindow]usize,
+        };
+
+        // Fetches items `start..end` of `source` and prefetches their buckets.
+        inline fn prepare_window(self: *Self, window: *Window, source: var, start: usize, end: usize) void {
+            var i = start;
+            while (i < end) : (i += 1) {
+                const item = source.get(i);
+                const fp = if (FREE_SLOT == item.fingerprint) 1 else item.fingerprint;
+                const bucket_idx = item.hash & (self.buckets.len - 1);
+                const alt_bucket_idx = self.compute_alt_bucket_idx(bucket_idx, fp);
+                prefetch(&self.buckets[bucket_idx]);
+                prefetch(&self.buckets[alt_bucket_idx]);
+                window.fps[i - start] = fp;
+                window.bucket_idxs[i - start] = bucket_idx;
+                window.alt_bucket_idxs[i - start] = alt_bucket_idx;
+            }
+        }
+
+        inline fn maybe_contains_at(self: *Self, bucket_idx: usize, alt_bucket_idx: usize, fp: Tfp) !bool {
+            if (UseSwar) {
+                // Search primary and alt bucket together, both loads are issued
+                // before any branch is taken.
+                const primary = Swar.match(self.load_word(bucket_idx), fp);
+                const alt = Swar.match(self.load_word(alt_bucket_idx), fp);
+                if ((primary | alt) != 0) {
+                    if (self.stats) |stats| {
+                        if (primary != 0) stats.primary_hits += 1 else stats.alt_hits += 1;
+                    }
+                    return true;
+                }
+            } else {
+                // Try primary bucket
+                if (fp == self.scan(bucket_idx, fp, .Search, FREE_SLOT)) {
+                    if (self.stats) |stats| stats.primary_hits += 1;
+                    return true;
+                }
+
+                // Try alt bucket
+                if (fp == self.scan(alt_bucket_idx, fp, .Search, FREE_SLOT)) {
+                    if (self.stats) |stats| stats.alt_hits += 1;
+                    return true;
+                }
+            }
 
             // Try homeless slot
-            return if (self.is_homeless_fp(bucket_idx, alt_bucket_idx, fp)) true else if (self.broken) error.Broken else false;
+            if (self.is_homeless_fp(bucket_idx, alt_bucket_idx, fp)) {
+                if (self.stats) |stats| stats.homeless_hits += 1;
+                return true;
+            }
+            if (self.broken) return error.Broken;
+            if (self.stats) |stats| stats.misses += 1;
+            return false;
         }
 
-        pub fn remove(self: *Self, hash: u64, fingerprint: Tfp) !void {
+        inline fn remove_at(self: *Self, bucket_idx: usize, alt_bucket_idx: usize, fp: Tfp) !void {
             if (self.broken) return error.Broken;
-            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
-            const bucket_idx = hash & (self.buckets.len - 1);
 
             // Try primary bucket
             if (fp == self.scan(bucket_idx, fp, .Delete, FREE_SLOT)) {
@@ -134,7 +820,6 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
             }
 
             // Try alt bucket
-            const alt_bucket_idx = self.compute_alt_bucket_idx(bucket_idx, fp);
             if (fp == self.scan(alt_bucket_idx, fp, .Delete, FREE_SLOT)) {
                 self.fpcount -= 1;
                 return;
@@ -152,27 +837,30 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
             return error.Broken;
         }
 
-        pub fn add(self: *Self, hash: u64, fingerprint: Tfp) !void {
+        inline fn add_at(self: *Self, bucket_idx: usize, alt_bucket_idx: usize, fp: Tfp) !void {
             if (self.broken) return error.Broken;
-            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
-            const bucket_idx = hash & (self.buckets.len - 1);
 
             // Try primary bucket
             if (FREE_SLOT == self.scan(bucket_idx, FREE_SLOT, .Set, fp)) {
                 self.fpcount += 1;
+                self.record_kicks(0);
                 return;
             }
 
             // If too tull already, try to add the fp to the secondary slot without forcing
-            const alt_bucket_idx = self.compute_alt_bucket_idx(bucket_idx, fp);
             if (FREE_SLOT != self.homeless_fp) {
                 if (FREE_SLOT == self.scan(alt_bucket_idx, FREE_SLOT, .Set, fp)) {
                     self.fpcount += 1;
+                    self.record_kicks(0);
                     return;
-                } else return error.TooFull;
+                } else {
+                    if (self.stats) |stats| stats.rejected += 1;
+                    return error.TooFull;
+                }
             }
 
             // We are now willing to force the insertion
+            if (self.insertion == .BFS) return self.add_bfs(bucket_idx, alt_bucket_idx, fp);
             self.homeless_bucket_idx = alt_bucket_idx;
             self.homeless_fp = fp;
             self.fpcount += 1;
@@ -180,9 +868,104 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
             while (i < 500) : (i += 1) {
                 self.homeless_bucket_idx = self.compute_alt_bucket_idx(self.homeless_bucket_idx, self.homeless_fp);
                 self.homeless_fp = self.scan(self.homeless_bucket_idx, FREE_SLOT, .Force, self.homeless_fp);
-                if (FREE_SLOT == self.homeless_fp) return;
+                if (FREE_SLOT == self.homeless_fp) {
+                    self.record_kicks(i + 1);
+                    return;
+                }
             }
             // If we went over the while loop, now the homeless slot is occupied.
+            self.record_kicks(i);
+            if (self.stats) |stats| stats.homeless += 1;
+        }
+
+        // A bucket reached by the BFS, and the fingerprint that would move into it
+        // from the bucket of node `parent` (for the two roots, the new fingerprint).
+        const BfsNode = struct {
+            bucket_idx: usize,
+            parent: u8,
+            depth: u8,
+            fp: Tfp,
+        };
+
+        // Both candidate buckets are full, and so is the homeless slot
+        // when no path can be found.
+        fn add_bfs(self: *Self, bucket_idx: usize, alt_bucket_idx: usize, fp: Tfp) void {
+            if (FREE_SLOT == self.scan(alt_bucket_idx, FREE_SLOT, .Set, fp)) {
+                self.fpcount += 1;
+                self.record_kicks(0);
+                return;
+            }
+
+            var queue: [BfsMaxNodes]BfsNode = undefined;
+            queue[0] = BfsNode{ .bucket_idx = bucket_idx, .parent = 0, .depth = 0, .fp = fp };
+            queue[1] = BfsNode{ .bucket_idx = alt_bucket_idx, .parent = 1, .depth = 0, .fp = fp };
+            var len: usize = 2;
+            var head: usize = 0;
+            while (head < len) : (head += 1) {
+                const node = queue[head];
+                // Nodes are queued in order of depth
+                if (node.depth == BfsMaxDepth) break;
+
+                var slot: usize = 0;
+                while (slot < buckSize) : (slot += 1) {
+                    const victim = self.get_slot(node.bucket_idx, slot);
+                    const next = self.compute_alt_bucket_idx(node.bucket_idx, victim);
+                    if (on_bfs_path(queue[0..], head, next)) continue;
+
+                    const child = BfsNode{ .bucket_idx = next, .parent = @intCast(u8, head), .depth = node.depth + 1, .fp = victim };
+                    if (self.find_slot(next, FREE_SLOT) != null) {
+                        self.apply_bfs_path(queue[0..], child);
+                        self.fpcount += 1;
+                        self.record_kicks(child.depth);
+                        return;
+                    }
+                    if (len < BfsMaxNodes) {
+                        queue[len] = child;
+                        len += 1;
+                    }
+                }
+            }
+
+            // Out of reach, same as a random walk running out of kicks.
+            self.homeless_fp = fp;
+            self.homeless_bucket_idx = bucket_idx;
+            self.fpcount += 1;
+            if (self.stats) |stats| {
+                stats.kicks[KickHistogramLen - 1] += 1;
+                stats.homeless += 1;
+            }
+        }
+
+        // A path never goes through the same bucket twice, so that every
+        // bucket on it changes only once when the path is applied.
+        fn on_bfs_path(queue: []const BfsNode, idx: usize, bucket_idx: usize) bool {
+            var node = queue[idx];
+            while (true) {
+                if (node.bucket_idx == bucket_idx) return true;
+                if (node.depth == 0) return false;
+                node = queue[node.parent];
+            }
+        }
+
+        // Moves the fingerprints along the path starting from its end, so that
+        // each one takes the place just freed by the next. Fingerprints are
+        // looked up by value: semi-sorted buckets reorder their slots.
+        fn apply_bfs_path(self: *Self, queue: []const BfsNode, last: BfsNode) void {
+            var node = last;
+            _ = self.scan(node.bucket_idx, FREE_SLOT, .Set, node.fp);
+            while (node.depth > 0) {
+                const parent = queue[node.parent];
+                _ = self.scan(parent.bucket_idx, node.fp, .Set, parent.fp);
+                node = parent;
+            }
+        }
+
+        inline fn record_kicks(self: *Self, kicks: usize) void {
+            if (self.stats) |stats| {
+                const idx = if (kicks == 0) 0 else std.math.min(KickHistogramLen - 1, usize(std.math.log2_int(usize, kicks)) + 1);
+                stats.kicks[idx] += 1;
+                stats.evictions += kicks;
+            }
         }
 
         pub fn is_broken(self: *Self) bool {
@@ -193,6 +976,114 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
             return FREE_SLOT != self.homeless_fp;
         }
 
+        // Forgets every fingerprint without touching bucket memory, which has
+        // to be zeroed (possibly a bit at a time) before the filter is used again.
+        pub fn forget(self: *Self) void {
+            self.homeless_fp = FREE_SLOT;
+            self.fpcount = 0;
+            self.broken = false;
+        }
+
+        // Filters of the same type, size and locality put a fingerprint in
+        // the same two buckets, so they can be merged without the original items.
+        pub fn can_merge(self: *const Self, other: *const Self) bool {
+            return self.buckets.len == other.buckets.len and self.locality == other.locality;
+        }
+
+        pub fn merge(self: *Self, other: *Self) !void {
+            return self.merge_range(other, 0, other.buckets.len);
+        }
+
+        // Adds every fingerprint that `other` stores in buckets [from, to),
+        // plus its homeless one when `to` is the end of the table.
+        // Big filters can be merged a range at a time, interleaved with other
+        // operations. On error.TooFull, what was added so far stays in `self`.
+        pub fn merge_range(self: *Self, other: *Self, from: usize, to: usize) !void {
+            if (!self.can_merge(other)) return error.Incompatible;
+            if (self.broken or other.broken) return error.Broken;
+
+            var bucket_idx = from;
+            while (bucket_idx < to) : (bucket_idx += 1) {
+                if (other.load_word(bucket_idx) == 0) continue;
+                var slot: usize = 0;
+                while (slot < buckSize) : (slot += 1) {
+                    const fp = other.get_slot(bucket_idx, slot);
+                    if (fp == FREE_SLOT) continue;
+                    try self.add_at(bucket_idx, self.compute_alt_bucket_idx(bucket_idx, fp), fp);
+                }
+            }
+
+            if (to == other.buckets.len and other.homeless_fp != FREE_SLOT) {
+                const idx = other.homeless_bucket_idx;
+                try self.add_at(idx, self.compute_alt_bucket_idx(idx, other.homeless_fp), other.homeless_fp);
+            }
+        }
+
+        pub fn image_header(self: *const Self) [ImageHeaderSize]u8 {
+            var header = []u8{0} ** ImageHeaderSize;
+            std.mem.copy(u8, header[0..4], ImageMagic);
+            header[4] = FPBits;
+            header[5] = @boolToInt(IsSemiSorted);
+            header[6] = @enumToInt(self.insertion);
+            header[7] = @enumToInt(self.locality);
+            std.mem.writeIntSliceLittle(u32, header[8..12], self.homeless_fp);
+            header[12] = @boolToInt(self.broken);
+            std.mem.writeIntSliceLittle(u64, header[16..24], if (self.homeless_fp == FREE_SLOT) 0 else self.homeless_bucket_idx);
+            std.mem.writeIntSliceLittle(u64, header[24..32], self.fpcount);
+            std.mem.writeIntSliceLittle(u64, header[32..40], @sliceToBytes(self.buckets).len);
+            std.mem.writeIntSliceLittle(u64, header[40..48], self.prng_state[0]);
+            std.mem.writeIntSliceLittle(u64, header[48..56], self.prng_state[1]);
+            return header;
+        }
+
+        // Adopts the buckets of an image, which have to stay around
+        // as long as the filter is used.
+        pub fn from_image(image: []align(Align) u8) !Self {
+            const header = try ImageHeader.parse(image);
+            if (image.len - ImageHeaderSize != header.bucket_bytes) return error.BadImage;
+            var self = try init_zeroed(@alignCast(Align, image[ImageHeaderSize..]));
+            try self.apply_image_header(header);
+            return self;
+        }
+
+        // Bucket memory changed after `epoch`, needs change tracking (`dirty`).
+        pub fn changes_since(self: *Self, epoch: u64) !ChangeIterator {
+            const dirty = self.dirty orelse return error.NotTracked;
+            if (epoch > dirty.epoch) return error.FutureEpoch;
+            return ChangeIterator{
+                .bytes = @sliceToBytes(self.buckets),
+                .range_epochs = dirty.range_epochs,
+                .epoch = epoch,
+                .range = 0,
+            };
+        }
+
+        // Copies a run of bucket memory from another filter, e.g. a chunk
+        // of its image or a run returned by its `changes_since`.
+        pub fn apply_delta(self: *Self, offset: usize, bytes: []const u8) !void {
+            const memory = @sliceToBytes(self.buckets);
+            if (offset > memory.len or bytes.len > memory.len - offset) return error.OutOfBounds;
+            if (bytes.len == 0) return;
+            std.mem.copy(u8, memory[offset..], bytes);
+            if (self.dirty) |dirty| dirty.mark(offset, bytes.len);
+        }
+
+        // Sets the state described by an image header on a filter that
+        // already holds (or will hold) the image's buckets.
+        pub fn apply_image_header(self: *Self, header: ImageHeader) !void {
+            if (header.fp_bits != FPBits or header.semi_sorted != IsSemiSorted) return error.BadImage;
+            if (header.bucket_bytes != @sliceToBytes(self.buckets).len) return error.BadImage;
+            if (header.homeless_fp > std.math.maxInt(Tfp)) return error.BadImage;
+            if (header.homeless_fp != FREE_SLOT and header.homeless_bucket_idx >= self.buckets.len) return error.BadImage;
+            self.homeless_fp = @intCast(Tfp, header.homeless_fp);
+            self.homeless_bucket_idx = @intCast(usize, header.homeless_bucket_idx);
+            self.fpcount = @intCast(usize, header.fpcount);
+            self.broken = header.broken;
+            self.prng_state = header.prng_state;
+            self.insertion = header.insertion;
+            self.set_locality(header.locality);
+        }
+
         pub fn fix_toofull(self: *Self) !void {
             if (FREE_SLOT == self.homeless_fp) return else {
                 const homeless_fp = self.homeless_fp;
@@ -210,12 +1101,18 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
         }
 
         inline fn compute_alt_bucket_idx(self: *Self, bucket_idx: usize, fp: Tfp) usize {
+            return alt_bucket_idx_for(self.shape(), bucket_idx, fp);
+        }
+
+        inline fn alt_bucket_idx_for(s: Shape, bucket_idx: usize, fp: Tfp) usize {
             const fpSize = @sizeOf(Tfp);
             const FNV_OFFSET = 14695981039346656037;
             const FNV_PRIME = 1099511628211;
 
             // Note: endianess
-            const bytes = @ptrCast(*const [fpSize]u8, &fp).*;
+            // Widen first, so that packed fingerprints never expose their padding bits.
+            const wide = @IntType(false, fpSize * 8)(fp);
+            const bytes = @ptrCast(*const [fpSize]u8, &wide).*;
             var res: usize = FNV_OFFSET;
 
             comptime var i = 0;
@@ -224,24 +1121,109 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
                 res *%= FNV_PRIME;
             }
 
-            return (bucket_idx ^ res) & (self.buckets.len - 1);
+            if (s.locality == .Table) return (bucket_idx ^ res) & (s.bucket_count - 1);
+
+            // The mask only depends on the fingerprint, so applying this twice
+            // gets back to `bucket_idx`. A zero offset would make both buckets
+            // the same one. Bit 12 picks the mask: it's outside of both masks
+            // and, unlike the high bits, well mixed even for 1 byte fingerprints.
+            const offset = res & s.alt_masks[(res >> 12) & 1];
+            return bucket_idx ^ (if (offset == 0) 1 else offset);
         }
 
-        inline fn scan(self: *Self, bucket_idx: u64, fp: Tfp, comptime mode: ScanMode, val: Tfp) Tfp {
+        inline fn load_word(self: *Self, bucket_idx: usize) Word {
+            if (Packed) {
+                const bucket = &self.buckets[bucket_idx];
+                var bits: BucketWord = 0;
+                comptime var i = 0;
+                inline while (i < @sizeOf(Bucket)) : (i += 1) {
+                    bits |= BucketWord(bucket[i]) << (i * 8);
+                }
+                return if (IsSemiSorted) SemiSort.decode(bits) else bits;
+            } else {
+                return @ptrCast(*align(Align) const Word, @alignCast(Align, &self.buckets[bucket_idx])).*;
+            }
+        }
+
+        inline fn store_word(self: *Self, bucket_idx: usize, word: Word) void {
+            const bits = if (IsSemiSorted) SemiSort.encode(word) else word;
+            const bucket = &self.buckets[bucket_idx];
             comptime var i = 0;
+            inline while (i < @sizeOf(Bucket)) : (i += 1) {
+                bucket[i] = @truncate(u8, bits >> (i * 8));
+            }
+        }
+
+        inline fn get_slot(self: *Self, bucket_idx: usize, slot: usize) Tfp {
+            if (Packed) {
+                return @truncate(Tfp, self.load_word(bucket_idx) >> @intCast(WordShift, slot * FPBits));
+            } else {
+                return self.buckets[bucket_idx][slot];
+            }
+        }
+
+        inline fn set_slot(self: *Self, bucket_idx: usize, slot: usize, fp: Tfp) void {
+            if (self.dirty) |dirty| dirty.mark(bucket_idx * @sizeOf(Bucket), @sizeOf(Bucket));
+            if (Packed) {
+                const shift = @intCast(WordShift, slot * FPBits);
+                const mask = Word(std.math.maxInt(Tfp)) << shift;
+                self.store_word(bucket_idx, (self.load_word(bucket_idx) & ~mask) | (Word(fp) << shift));
+            } else {
+                self.buckets[bucket_idx][slot] = fp;
+            }
+        }
+
+        // Returns the index of the first slot equal to `fp`, or null.
+        inline fn find_slot(self: *Self, bucket_idx: usize, fp: Tfp) ?usize {
+            if (UseSwar) {
+                const mask = Swar.match(self.load_word(bucket_idx), fp);
+                if (mask == 0) return null;
+
+                // Lanes are counted starting from the least significant bits,
+                // which is where the first slot lives only on little endian machines.
+                // Packed words are always assembled in little endian order.
+                const lane = Swar.first_lane(mask);
+                return if (Packed or builtin.endian == builtin.Endian.Little) lane else buckSize - 1 - lane;
+            } else if (Packed) {
+                // Decode the bucket only once
+                const word = self.load_word(bucket_idx);
+                comptime var i = 0;
+                inline while (i < buckSize) : (i += 1) {
+                    if (@truncate(Tfp, word >> (i * FPBits)) == fp) return i;
+                }
+                return null;
+            } else {
+                comptime var i = 0;
+                inline while (i < buckSize) : (i += 1) {
+                    if (self.buckets[bucket_idx][i] == fp) return i;
+                }
+                return null;
+            }
+        }
+
+        // Steps the PRNG exactly like std.rand.Xoroshiro128 (`int` takes the low
+        // bits of `next`), so states saved when the PRNG was a global shared by
+        // all filters keep producing the same evictions.
+        inline fn random_slot(self: *Self) BucketSizeType {
+            const s0 = self.prng_state[0];
+            var s1 = self.prng_state[1];
+            const r = s0 +% s1;
+            s1 ^= s0;
+            self.prng_state[0] = std.math.rotl(u64, s0, u8(55)) ^ s1 ^ (s1 << 14);
+            self.prng_state[1] = std.math.rotl(u64, s1, u8(36));
+            return @truncate(BucketSizeType, r);
+        }
 
+        inline fn scan(self: *Self, bucket_idx: u64, fp: Tfp, comptime mode: ScanMode, val: Tfp) Tfp {
             // Search the bucket
-            var bucket = &self.buckets[bucket_idx];
-            inline while (i < buckSize) : (i += 1) {
-                if (bucket[i] == fp) {
-                    switch (mode) {
-                        .Search => {},
-                        .Delete => bucket[i] = FREE_SLOT,
-                        .Set => bucket[i] = val,
-                        .Force => bucket[i] = val,
-                    }
-                    return fp;
+            if (self.find_slot(bucket_idx, fp)) |i| {
+                switch (mode) {
+                    .Search => {},
+                    .Delete => self.set_slot(bucket_idx, i, FREE_SLOT),
+                    .Set => self.set_slot(bucket_idx, i, val),
+                    .Force => self.set_slot(bucket_idx, i, val),
                 }
+                return fp;
             }
 
             switch (mode) {
@@ -250,9 +1232,9 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
                 .Set => return 1,
                 .Force => {
                     // We did not find any free slot, so we must now evict.
-                    const slot = if (self.rand_fn) |rfn| rfn() else XoroRandFnImpl(BucketSizeType).random();
-                    const evicted = bucket[slot];
-                    bucket[slot] = val;
+                    const slot = if (self.rand_fn) |rfn| rfn() else self.random_slot();
+                    const evicted = self.get_slot(bucket_idx, slot);
+                    self.set_slot(bucket_idx, slot, val);
                     return evicted;
                 },
             }
@@ -260,6 +1242,222 @@ fn CuckooFilter(comptime Tfp: type, comptime buckSize: usize) type {
     };
 }
 
+// Number of lock stripes of a concurrent filter,
+// bucket `i` is covered by stripe `i % ConcurrentStripes`.
+pub const ConcurrentStripes = 1024;
+
+// Wraps a filter so that many threads can use it at once, in the style of
+// libcuckoo: buckets are covered by lock stripes, each one a version counter
+// that writers keep odd while they hold it.
+//
+// Lookups never write to shared memory: they read the version of the two
+// stripes involved, scan the buckets and retry if either changed in the
+// meantime, so they scale with the number of cores.
+// Insertions that find a free slot in their primary bucket and removals
+// that find the fingerprint in one of its buckets only lock those two
+// stripes, and run in parallel with each other. Anything else (kicking
+// fingerprints around, the homeless slot, breaking the filter) takes the
+// whole filter for itself, lookups running meanwhile retry once it's done.
+//
+// Each filter carries its own PRNG state, so there is no global state to
+// share. Counters are not thread safe: the inner filter's `stats` must be
+// left null. Neither is change tracking, whose epoch goes up at every
+// bucket write: `dirty` must be left null too (asserted by the writers).
+// `inner` can be used directly (e.g. to persist the filter) when no other
+// thread is using it.
+pub fn Concurrent(comptime CF: type) type {
+    return struct {
+        inner: CF,
+        stripes: [ConcurrentStripes]usize,
+
+        // Number of writers on the fast path, plus `Exclusive` when
+        // a writer holds (or is waiting for) the whole filter.
+        writers: usize,
+
+        // Odd while a writer holds the whole filter.
+        epoch: usize,
+
+        pub const FPType = CF.FPType;
+        pub const Align = CF.Align;
+        const Tfp = CF.FPType;
+        const Exclusive = usize(1) << (@typeInfo(usize).Int.bits - 1);
+        const Self = @This();
+
+        pub fn init(memory: []align(Align) u8) !Self {
+            return wrap(try CF.init(memory));
+        }
+
+        pub fn init_zeroed(memory: []align(Align) u8) !Self {
+            return wrap(try CF.init_zeroed(memory));
+        }
+
+        // Takes over an existing filter, e.g. one that was just restored.
+        pub fn wrap(cf: CF) Self {
+            std.debug.assert(cf.dirty == null);
+            return Self{
+                .inner = cf,
+                .stripes = []usize{0} ** ConcurrentStripes,
+                .writers = 0,
+                .epoch = 0,
+            };
+        }
+
+        pub fn count(self: *Self) !usize {
+            self.lock_shared();
+            defer self.unlock_shared();
+            if (self.inner.broken) return error.Broken;
+            return @atomicLoad(usize, &self.inner.fpcount, builtin.AtomicOrder.SeqCst);
+        }
+
+        pub fn maybe_contains(self: *Self, hash: u64, fingerprint: Tfp) !bool {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (self.inner.buckets.len - 1);
+            const alt_bucket_idx = self.inner.compute_alt_bucket_idx(bucket_idx, fp);
+            const a = bucket_idx % ConcurrentStripes;
+            const b = alt_bucket_idx % ConcurrentStripes;
+            while (true) {
+                const epoch = read_version(&self.epoch);
+                const version_a = read_version(&self.stripes[a]);
+                const version_b = read_version(&self.stripes[b]);
+                const res = self.inner.maybe_contains_at(bucket_idx, alt_bucket_idx, fp);
+                @fence(builtin.AtomicOrder.Acquire);
+                if (@atomicLoad(usize, &self.stripes[a], builtin.AtomicOrder.SeqCst) == version_a and
+                    @atomicLoad(usize, &self.stripes[b], builtin.AtomicOrder.SeqCst) == version_b and
+                    @atomicLoad(usize, &self.epoch, builtin.AtomicOrder.SeqCst) == epoch) return res;
+            }
+        }
+
+        pub fn add(self: *Self, hash: u64, fingerprint: Tfp) !void {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (self.inner.buckets.len - 1);
+            const alt_bucket_idx = self.inner.compute_alt_bucket_idx(bucket_idx, fp);
+            std.debug.assert(self.inner.dirty == null);
+            {
+                self.lock_shared();
+                defer self.unlock_shared();
+                self.lock_stripes(bucket_idx, alt_bucket_idx);
+                defer self.unlock_stripes(bucket_idx, alt_bucket_idx);
+
+                if (self.inner.broken) return error.Broken;
+                if (FREE_SLOT == self.inner.scan(bucket_idx, FREE_SLOT, .Set, fp)) {
+                    _ = @atomicRmw(usize, &self.inner.fpcount, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+                    return;
+                }
+            }
+
+            // The primary bucket is full, kicks can reach any bucket.
+            self.lock_exclusive();
+            defer self.unlock_exclusive();
+            return self.inner.add_at(bucket_idx, alt_bucket_idx, fp);
+        }
+
+        pub fn remove(self: *Self, hash: u64, fingerprint: Tfp) !void {
+            const fp = if (FREE_SLOT == fingerprint) 1 else fingerprint;
+            const bucket_idx = hash & (self.inner.buckets.len - 1);
+            const alt_bucket_idx = self.inner.compute_alt_bucket_idx(bucket_idx, fp);
+            std.debug.assert(self.inner.dirty == null);
+            {
+                self.lock_shared();
+                defer self.unlock_shared();
+                self.lock_stripes(bucket_idx, alt_bucket_idx);
+                defer self.unlock_stripes(bucket_idx, alt_bucket_idx);
+
+                if (self.inner.broken) return error.Broken;
+                if (fp == self.inner.scan(bucket_idx, fp, .Delete, FREE_SLOT) or fp == self.inner.scan(alt_bucket_idx, fp, .Delete, FREE_SLOT)) {
+                    _ = @atomicRmw(usize, &self.inner.fpcount, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+                    return;
+                }
+            }
+
+            // Either the homeless fingerprint or a misuse that breaks the filter.
+            self.lock_exclusive();
+            defer self.unlock_exclusive();
+            return self.inner.remove_at(bucket_idx, alt_bucket_idx, fp);
+        }
+
+        pub fn is_broken(self: *Self) bool {
+            self.lock_shared();
+            defer self.unlock_shared();
+            return self.inner.is_broken();
+        }
+
+        pub fn is_toofull(self: *Self) bool {
+            self.lock_shared();
+            defer self.unlock_shared();
+            return self.inner.is_toofull();
+        }
+
+        pub fn fix_toofull(self: *Self) !void {
+            self.lock_exclusive();
+            defer self.unlock_exclusive();
+            return self.inner.fix_toofull();
+        }
+
+        // Waits for a version counter to be even (unlocked) and returns it.
+        fn read_version(version: *usize) usize {
+            while (true) {
+                const v = @atomicLoad(usize, version, builtin.AtomicOrder.SeqCst);
+                if (v & 1 == 0) return v;
+                spin_hint();
+            }
+        }
+
+        fn lock_stripe(self: *Self, stripe: usize) void {
+            while (true) {
+                const v = read_version(&self.stripes[stripe]);
+                if (@cmpxchgWeak(usize, &self.stripes[stripe], v, v + 1, builtin.AtomicOrder.SeqCst, builtin.AtomicOrder.SeqCst) == null) return;
+            }
+        }
+
+        fn unlock_stripe(self: *Self, stripe: usize) void {
+            _ = @atomicRmw(usize, &self.stripes[stripe], builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+        }
+
+        // Stripes are locked in increasing order, so that writers can't deadlock.
+        fn lock_stripes(self: *Self, bucket_idx: usize, alt_bucket_idx: usize) void {
+            const a = bucket_idx % ConcurrentStripes;
+            const b = alt_bucket_idx % ConcurrentStripes;
+            self.lock_stripe(std.math.min(a, b));
+            if (a != b) self.lock_stripe(std.math.max(a, b));
+        }
+
+        fn unlock_stripes(self: *Self, bucket_idx: usize, alt_bucket_idx: usize) void {
+            const a = bucket_idx % ConcurrentStripes;
+            const b = alt_bucket_idx % ConcurrentStripes;
+            self.unlock_stripe(a);
+            if (a != b) self.unlock_stripe(b);
+        }
+
+        fn lock_shared(self: *Self) void {
+            while (true) {
+                const w = @atomicLoad(usize, &self.writers, builtin.AtomicOrder.SeqCst);
+                if (w & Exclusive == 0 and @cmpxchgWeak(usize, &self.writers, w, w + 1, builtin.AtomicOrder.SeqCst, builtin.AtomicOrder.SeqCst) == null) return;
+                spin_hint();
+            }
+        }
+
+        fn unlock_shared(self: *Self) void {
+            _ = @atomicRmw(usize, &self.writers, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+        }
+
+        // Keeps new writers out, then waits for the ones on the fast path to be done.
+        fn lock_exclusive(self: *Self) void {
+            while (true) {
+                const w = @atomicLoad(usize, &self.writers, builtin.AtomicOrder.SeqCst);
+                if (w & Exclusive == 0 and @cmpxchgWeak(usize, &self.writers, w, w | Exclusive, builtin.AtomicOrder.SeqCst, builtin.AtomicOrder.SeqCst) == null) break;
+                spin_hint();
+            }
+            while (@atomicLoad(usize, &self.writers, builtin.AtomicOrder.SeqCst) != Exclusive) spin_hint();
+            _ = @atomicRmw(usize, &self.epoch, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+        }
+
+        fn unlock_exclusive(self: *Self) void {
+            _ = @atomicRmw(usize, &self.epoch, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+            _ = @atomicRmw(usize, &self.writers, builtin.AtomicRmwOp.Xchg, 0, builtin.AtomicOrder.SeqCst);
+        }
+    };
+}
+
 test "Hx == (Hy XOR hash(fp))" {
     var memory: [1 << 20]u8 align(Filter8.Align) = undefined;
     var cf = Filter8.init(memory[0..]) catch unreachable;
@@ -274,16 +1472,48 @@ test "Hx == (Hy XOR hash(fp))" {
     testing.expect((1 << 15) - 1 == cf.compute_alt_bucket_idx(cf.compute_alt_bucket_idx((1 << 15) - 1, 'x'), 'x'));
 }
 
+test "bucket scan picks the first matching slot" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
+
+        // Semi-sorted buckets don't keep slot positions.
+        if (v.cftype.IsSemiSorted) continue;
+
+        // Fill a bucket, each fp must land in the first free slot.
+        var i: usize = 0;
+        while (i < v.buckLen) : (i += 1) {
+            cf.add(0, @intCast(v.Tfp, i + 1)) catch unreachable;
+            testing.expect(cf.get_slot(0, i) == @intCast(v.Tfp, i + 1));
+        }
+
+        // Free a slot in the middle and make sure it's the one that gets reused.
+        cf.remove(0, 2) catch unreachable;
+        testing.expect(cf.get_slot(0, 1) == 0);
+        testing.expect(!(cf.maybe_contains(0, 2) catch unreachable));
+        cf.add(0, 42) catch unreachable;
+        testing.expect(cf.get_slot(0, 1) == 42);
+
+        // Every fp must still be found through the SWAR kernels.
+        i = 0;
+        while (i < v.buckLen) : (i += 1) {
+            if (i == 1) continue;
+            testing.expect(cf.maybe_contains(0, @intCast(v.Tfp, i + 1)) catch unreachable);
+        }
+        testing.expect(cf.maybe_contains(0, 42) catch unreachable);
+    }
+}
+
 fn test_not_broken(cf: var) void {
-    testing.expect(false == cf.maybe_contains(2, 'a') catch unreachable);
+    testing.expect(false == cf.maybe_contains(2, 41) catch unreachable);
     testing.expect(0 == cf.count() catch unreachable);
-    cf.add(2, 'a') catch unreachable;
-    testing.expect(cf.maybe_contains(2, 'a') catch unreachable);
-    testing.expect(false == cf.maybe_contains(0, 'a') catch unreachable);
-    testing.expect(false == cf.maybe_contains(1, 'a') catch unreachable);
+    cf.add(2, 41) catch unreachable;
+    testing.expect(cf.maybe_contains(2, 41) catch unreachable);
+    testing.expect(false == cf.maybe_contains(0, 41) catch unreachable);
+    testing.expect(false == cf.maybe_contains(1, 41) catch unreachable);
     testing.expect(1 == cf.count() catch unreachable);
-    cf.remove(2, 'a') catch unreachable;
-    testing.expect(false == cf.maybe_contains(2, 'a') catch unreachable);
+    cf.remove(2, 41) catch unreachable;
+    testing.expect(false == cf.maybe_contains(2, 41) catch unreachable);
     testing.expect(0 == cf.count() catch unreachable);
 }
 
@@ -293,6 +1523,383 @@ test "is not completely broken" {
     test_not_broken(&cf);
 }
 
+test "batch functions agree with single-item functions" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
+
+        // More items than a single window, so that the windowing logic gets exercised.
+        const n = BatchWindow * 2 + 3;
+        var hashes: [n]u64 = undefined;
+        var fps: [n]v.Tfp = undefined;
+        var results: [n]BatchResult = undefined;
+        for (hashes) |*h, i| {
+            h.* = i * 7919;
+            fps[i] = @truncate(v.Tfp, i + 1);
+        }
+
+        cf.maybe_contains_batch(hashes[0..], fps[0..], results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.NotFound);
+
+        cf.add_batch(hashes[0..], fps[0..], results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+        testing.expect(n == cf.count() catch unreachable);
+        for (hashes) |h, i| testing.expect(cf.maybe_contains(h, fps[i]) catch unreachable);
+
+        cf.maybe_contains_batch(hashes[0..], fps[0..], results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+
+        cf.remove_batch(hashes[0..], fps[0..], results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+        testing.expect(0 == cf.count() catch unreachable);
+
+        // Removing again breaks the filter, and every following item reports it.
+        cf.remove_batch(hashes[0..], fps[0..], results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Broken);
+    }
+}
+
+// Derives items from their index, counting how many times it gets asked for one.
+fn CountingSource(comptime Tfp: type) type {
+    return struct {
+        n: usize,
+        fetched: *usize,
+
+        pub fn len(self: @This()) usize {
+            return self.n;
+        }
+
+        pub fn get(self: @This(), i: usize) BatchItem(Tfp) {
+            self.fetched.* += 1;
+            return BatchItem(Tfp){ .hash = i * 7919, .fingerprint = @truncate(Tfp, i + 1) };
+        }
+    };
+}
+
+test "batch functions with a custom source" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
+
+        const n = BatchWindow * 3 + 5;
+        var fetched: usize = 0;
+        const source = CountingSource(v.Tfp){ .n = n, .fetched = &fetched };
+        var results: [n]BatchResult = undefined;
+
+        cf.add_batch_from(source, results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+        testing.expect(fetched == n);
+        var i: usize = 0;
+        while (i < n) : (i += 1) testing.expect(cf.maybe_contains(i * 7919, @truncate(v.Tfp, i + 1)) catch unreachable);
+
+        cf.maybe_contains_batch_from(source, results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+
+        cf.remove_batch_from(source, results[0..]);
+        for (results) |res| testing.expect(res == BatchResult.Ok);
+        testing.expect(0 == cf.count() catch unreachable);
+        testing.expect(fetched == 3 * n);
+    }
+}
+
+test "per-filter prng follows std.rand.Xoroshiro128" {
+    var memory: [1024]u8 align(Filter8.Align) = undefined;
+    var cf = Filter8.init(memory[0..]) catch unreachable;
+    var reference = std.rand.Xoroshiro128.init(42);
+    testing.expect(cf.prng_state[0] == reference.s[0] and cf.prng_state[1] == reference.s[1]);
+
+    var i: usize = 0;
+    while (i < 100) : (i += 1) testing.expect(cf.random_slot() == reference.random.int(u2));
+
+    // Filters don't share their state.
+    var other_memory: [1024]u8 align(Filter8.Align) = undefined;
+    var other = Filter8.init(other_memory[0..]) catch unreachable;
+    testing.expect(other.prng_state[0] == DefaultPrngState[0]);
+    other.seed_prng(1337);
+    testing.expect(other.prng_state[0] != DefaultPrngState[0]);
+    testing.expect(cf.prng_state[0] == reference.s[0]);
+}
+
+test "concurrent filter is not completely broken" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        var cf = Concurrent(v.cftype).init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
+        test_not_broken(&cf);
+
+        // Kicks and the homeless slot go through the exclusive path.
+        var i: usize = 0;
+        while (i < v.buckLen * 2 + 1) : (i += 1) cf.add(0, 1) catch unreachable;
+        testing.expect(cf.is_toofull());
+        testing.expectError(error.TooFull, cf.add(0, 1));
+        i = 0;
+        while (i < v.buckLen * 2 + 1) : (i += 1) cf.remove(0, 1) catch unreachable;
+        testing.expect(0 == cf.count() catch unreachable);
+        testing.expectError(error.Broken, cf.remove(0, 1));
+        testing.expect(cf.is_broken());
+    }
+}
+
+// Shared by the threads of the concurrent filter test.
+const ConcurrentTestCtx = struct {
+    cf: *Concurrent(Filter16),
+    first: u64,
+    n: u64,
+    failures: usize,
+};
+
+fn concurrent_test_hash(i: u64) u64 {
+    return i *% 0x9e3779b97f4a7c15;
+}
+
+fn concurrent_test_fp(i: u64) u16 {
+    return @truncate(u16, (i *% 0xbf58476d1ce4e5b9) >> 48);
+}
+
+fn concurrent_test_add(ctx: *ConcurrentTestCtx) void {
+    var i = ctx.first;
+    while (i < ctx.first + ctx.n) : (i += 1) {
+        ctx.cf.add(concurrent_test_hash(i), concurrent_test_fp(i)) catch {
+            ctx.failures += 1;
+        };
+    }
+}
+
+fn concurrent_test_check(ctx: *ConcurrentTestCtx) void {
+    var round: usize = 0;
+    while (round < 20) : (round += 1) {
+        var i = ctx.first;
+        while (i < ctx.first + ctx.n) : (i += 1) {
+            const found = ctx.cf.maybe_contains(concurrent_test_hash(i), concurrent_test_fp(i)) catch false;
+            if (!found) ctx.failures += 1;
+        }
+    }
+}
+
+test "concurrent filter never loses items while others get added" {
+    var memory: [1 << 16]u8 align(Filter16.Align) = undefined;
+    var cf = Concurrent(Filter16).init(memory[0..]) catch unreachable;
+
+    // Items checked by the readers are there from the start,
+    // writers push the filter to ~50% load, kicks included.
+    const preloaded = 4000;
+    var i: u64 = 0;
+    while (i < preloaded) : (i += 1) cf.add(concurrent_test_hash(i), concurrent_test_fp(i)) catch unreachable;
+
+    var ctxs = []ConcurrentTestCtx{
+        ConcurrentTestCtx{ .cf = &cf, .first = 0, .n = preloaded, .failures = 0 },
+        ConcurrentTestCtx{ .cf = &cf, .first = 0, .n = preloaded, .failures = 0 },
+        ConcurrentTestCtx{ .cf = &cf, .first = preloaded, .n = 6000, .failures = 0 },
+        ConcurrentTestCtx{ .cf = &cf, .first = preloaded + 6000, .n = 6000, .failures = 0 },
+    };
+    var threads: [4]*std.os.Thread = undefined;
+    for (ctxs) |*ctx, t| {
+        threads[t] = if (t < 2)
+            std.os.spawnThread(ctx, concurrent_test_check) catch unreachable
+        else
+            std.os.spawnThread(ctx, concurrent_test_add) catch unreachable;
+    }
+    for (threads) |thread| thread.wait();
+
+    for (ctxs) |ctx| testing.expect(ctx.failures == 0);
+    testing.expect(preloaded + 12000 == cf.count() catch unreachable);
+    i = 0;
+    while (i < preloaded + 12000) : (i += 1) testing.expect(cf.maybe_contains(concurrent_test_hash(i), concurrent_test_fp(i)) catch unreachable);
+}
+
+// Items derived from their index, for tests that need many distinct ones.
+fn test_item_hash(i: u64) u64 {
+    var z = i +% 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) *% 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) *% 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+fn test_item_fp(comptime Tfp: type, i: u64) Tfp {
+    return @truncate(Tfp, test_item_hash(i ^ 0x5555555555555555));
+}
+
+test "BFS insertion fills up to 95%" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1 << 14]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(memory.len);
+        var cf = v.cftype.init(memory[0..len]) catch unreachable;
+        cf.insertion = .BFS;
+        var stats = Stats.init();
+        cf.stats = &stats;
+
+        // Two-slot buckets top out much earlier.
+        const target = v.cftype.capacity(memory.len) * (if (v.buckLen == 4) usize(95) else usize(75)) / 100;
+        var i: u64 = 0;
+        while (i < target) : (i += 1) cf.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        testing.expect(!cf.is_toofull());
+        testing.expect(target == cf.count() catch unreachable);
+        i = 0;
+        while (i < target) : (i += 1) testing.expect(cf.maybe_contains(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable);
+
+        // No chain is longer than the search depth.
+        for (stats.kicks) |n, k| {
+            if (k > std.math.log2_int(usize, BfsMaxDepth) + 1) testing.expect(n == 0);
+        }
+        testing.expect(stats.homeless == 0);
+    }
+}
+
+test "BFS insertion is deterministic" {
+    var memory_a: [4096]u8 align(Filter8.Align) = undefined;
+    var memory_b: [4096]u8 align(Filter8.Align) = undefined;
+    var a = Filter8.init(memory_a[0..]) catch unreachable;
+    var b = Filter8.init(memory_b[0..]) catch unreachable;
+    a.insertion = .BFS;
+    b.insertion = .BFS;
+    var i: u64 = 0;
+    while (i < 3800) : (i += 1) {
+        a.add(test_item_hash(i), test_item_fp(u8, i)) catch unreachable;
+        b.add(test_item_hash(i), test_item_fp(u8, i)) catch unreachable;
+    }
+    testing.expect(std.mem.eql(u8, memory_a[0..], memory_b[0..]));
+    testing.expect(std.mem.eql(u64, a.prng_state[0..], DefaultPrngState[0..]));
+}
+
+test "restricted locality keeps alternate buckets in the block" {
+    var memory: [1 << 16]u8 align(Filter8.Align) = undefined;
+    var cf = Filter8.init(memory[0..]) catch unreachable;
+    const Case = struct {
+        locality: Locality,
+        spans: [2]usize,
+    };
+    const cases = []Case{
+        Case{ .locality = .Line, .spans = []usize{ 16, 1024 } },
+        Case{ .locality = .Page, .spans = []usize{ 1024, 1024 } },
+        // Blocks can't be bigger than the filter
+        Case{ .locality = .HugePage, .spans = []usize{ 16384, 16384 } },
+    };
+    for (cases) |c| {
+        cf.set_locality(c.locality);
+        testing.expect(cf.alt_masks[0] == c.spans[0] - 1 and cf.alt_masks[1] == c.spans[1] - 1);
+        var fp: usize = 1;
+        while (fp < 256) : (fp += 1) {
+            for ([]usize{ 0, 15, 1000, 16383 }) |bucket_idx| {
+                const alt = cf.compute_alt_bucket_idx(bucket_idx, @intCast(u8, fp));
+                testing.expect(alt != bucket_idx);
+                testing.expect(alt / c.spans[1] == bucket_idx / c.spans[1]);
+                testing.expect(bucket_idx == cf.compute_alt_bucket_idx(alt, @intCast(u8, fp)));
+            }
+        }
+    }
+}
+
+test "restricted locality fills up" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1 << 14]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(memory.len);
+        var cf = v.cftype.init(memory[0..len]) catch unreachable;
+        cf.set_locality(.Line);
+        cf.insertion = .BFS;
+
+        const target = v.cftype.capacity(memory.len) * (if (v.buckLen == 4) usize(85) else usize(60)) / 100;
+        var i: u64 = 0;
+        while (i < target) : (i += 1) cf.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        i = 0;
+        while (i < target) : (i += 1) testing.expect(cf.maybe_contains(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable);
+        i = 0;
+        while (i < target) : (i += 1) cf.remove(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        testing.expect(0 == cf.count() catch unreachable);
+    }
+}
+
+test "merge adds the fingerprints of another filter" {
+    inline for (SupportedVersions) |v| {
+        var memory_a: [4096]u8 align(v.cftype.Align) = undefined;
+        var memory_b: [4096]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(memory_a.len);
+        var a = v.cftype.init(memory_a[0..len]) catch unreachable;
+        var b = v.cftype.init(memory_b[0..len]) catch unreachable;
+
+        const half = v.cftype.capacity(memory_a.len) / 4;
+        var i: u64 = 0;
+        while (i < half) : (i += 1) a.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        while (i < half * 2) : (i += 1) b.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+
+        // In two ranges, like a merge interleaved with other commands would.
+        const mid = b.buckets.len / 2;
+        a.merge_range(&b, 0, mid) catch unreachable;
+        a.merge_range(&b, mid, b.buckets.len) catch unreachable;
+        testing.expect(half * 2 == a.count() catch unreachable);
+        i = 0;
+        while (i < half * 2) : (i += 1) testing.expect(a.maybe_contains(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable);
+
+        var memory_c: [8192]u8 align(v.cftype.Align) = undefined;
+        var c = v.cftype.init(memory_c[0..v.cftype.bytes_for(memory_c.len)]) catch unreachable;
+        testing.expectError(error.Incompatible, a.merge(&c));
+        b.set_locality(.Page);
+        testing.expectError(error.Incompatible, a.merge(&b));
+    }
+}
+
+test "filters survive a trip through an image" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(memory.len)]) catch unreachable;
+        cf.insertion = .BFS;
+        cf.seed_prng(7);
+        var i: u64 = 0;
+        while (i < 100) : (i += 1) cf.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+
+        var image: [ImageHeaderSize + 1024]u8 align(v.cftype.Align) = undefined;
+        const header = cf.image_header();
+        const bytes = @sliceToBytes(cf.buckets);
+        std.mem.copy(u8, image[0..ImageHeaderSize], header[0..]);
+        std.mem.copy(u8, image[ImageHeaderSize..], bytes);
+        var copy = v.cftype.from_image(image[0 .. ImageHeaderSize + bytes.len]) catch unreachable;
+        testing.expect(copy.insertion == .BFS);
+        testing.expect(std.mem.eql(u64, copy.prng_state[0..], cf.prng_state[0..]));
+        testing.expect(100 == copy.count() catch unreachable);
+        i = 0;
+        while (i < 100) : (i += 1) testing.expect(copy.maybe_contains(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable);
+
+        image[0] = 'X';
+        testing.expectError(error.BadImage, v.cftype.from_image(image[0 .. ImageHeaderSize + bytes.len]));
+    }
+}
+
+test "copies stay in sync by applying changes" {
+    inline for (SupportedVersions) |v| {
+        var memory: [16384]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(memory.len);
+        var cf = v.cftype.init(memory[0..len]) catch unreachable;
+        testing.expectError(error.NotTracked, cf.changes_since(0));
+        var epochs: [memory.len / DirtyRangeBytes]u64 = undefined;
+        var dirty = Dirty.init(epochs[0..Dirty.ranges_for(len)], 1, 100);
+        cf.dirty = &dirty;
+
+        // The copy starts from a snapshot of the empty filter.
+        var copy_memory: [memory.len]u8 align(v.cftype.Align) = undefined;
+        std.mem.copy(u8, copy_memory[0..len], memory[0..len]);
+        var copy = v.cftype.init_zeroed(copy_memory[0..len]) catch unreachable;
+        const epoch = dirty.epoch;
+        var changes = cf.changes_since(epoch) catch unreachable;
+        testing.expect(changes.next() == null);
+
+        var i: u64 = 0;
+        while (i < 200) : (i += 1) cf.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        i = 0;
+        while (i < 50) : (i += 1) cf.remove(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+        testing.expect(dirty.epoch > epoch);
+
+        changes = cf.changes_since(epoch) catch unreachable;
+        while (changes.next()) |run| copy.apply_delta(run.offset, run.bytes) catch unreachable;
+        const header = cf.image_header();
+        copy.apply_image_header(ImageHeader.parse(header[0..]) catch unreachable) catch unreachable;
+
+        testing.expect(std.mem.eql(u8, copy_memory[0..len], memory[0..len]));
+        testing.expect(150 == copy.count() catch unreachable);
+        changes = cf.changes_since(dirty.epoch) catch unreachable;
+        testing.expect(changes.next() == null);
+        testing.expectError(error.FutureEpoch, cf.changes_since(dirty.epoch + 1));
+        testing.expectError(error.OutOfBounds, copy.apply_delta(len, "x"));
+    }
+}
+
 const Version = struct {
     Tfp: type,
     buckLen: usize,
@@ -300,15 +1907,130 @@ const Version = struct {
 };
 
 const SupportedVersions = []Version{
+    Version{ .Tfp = u6, .buckLen = 4, .cftype = Filter6 },
     Version{ .Tfp = u8, .buckLen = 4, .cftype = Filter8 },
+    Version{ .Tfp = u12, .buckLen = 4, .cftype = Filter12 },
     Version{ .Tfp = u16, .buckLen = 4, .cftype = Filter16 },
     Version{ .Tfp = u32, .buckLen = 2, .cftype = Filter32 },
+    Version{ .Tfp = u9, .buckLen = 4, .cftype = SemiSortedFilter9 },
+    Version{ .Tfp = u13, .buckLen = 4, .cftype = SemiSortedFilter13 },
+    Version{ .Tfp = u17, .buckLen = 4, .cftype = SemiSortedFilter17 },
 };
 
+test "stats track kicks and hit locations" {
+    var memory: [8]u8 align(Filter8.Align) = undefined;
+    var cf = Filter8.init(memory[0..]) catch unreachable;
+    var stats = Stats.init();
+    cf.stats = &stats;
+
+    // Two buckets of 4 slots, fingerprint 2 has bucket 1 as alt of bucket 0:
+    // the first 4 copies go in the primary bucket, the next 4 need to kick
+    // fingerprints around to reach the alt one.
+    var i: usize = 0;
+    while (i < 8) : (i += 1) cf.add(0, 2) catch unreachable;
+    testing.expect(stats.kicks[0] == 4);
+    testing.expect(stats.evictions > 0);
+    testing.expect(stats.homeless == 0);
+
+    testing.expect(cf.maybe_contains(0, 2) catch unreachable);
+    testing.expect(stats.primary_hits == 1);
+    testing.expect(!(cf.maybe_contains(0, 3) catch unreachable));
+    testing.expect(stats.misses == 1);
+
+    // The homeless slot takes one more, after that inserts get rejected.
+    cf.add(0, 2) catch unreachable;
+    testing.expect(stats.homeless == 1);
+    testing.expectError(error.TooFull, cf.add(0, 2));
+    testing.expect(stats.rejected == 1);
+}
+
+test "semi-sorted buckets round trip" {
+    const K = SemiSortKernels(u9);
+    testing.expect(K.DecodeTable[0] == 0);
+    testing.expect(K.DecodeTable[3875] == 0xffff);
+
+    // Lanes come back sorted.
+    const word = K.Word(300) | (K.Word(5) << 9) | (K.Word(511) << 18) | (K.Word(0) << 27);
+    const sorted = K.Word(0) | (K.Word(5) << 9) | (K.Word(300) << 18) | (K.Word(511) << 27);
+    testing.expect(K.decode(K.encode(word)) == sorted);
+    testing.expect(K.decode(K.encode(sorted)) == sorted);
+
+    var memory: [1024]u8 align(SemiSortedFilter9.Align) = undefined;
+    testing.expect(SemiSortedFilter9.bytes_for(1024) == 1024);
+    var cf = SemiSortedFilter9.init(memory[0..]) catch unreachable;
+    for ([]u9{ 511, 256, 3, 256 }) |fp| cf.add(0, fp) catch unreachable;
+    for ([]u9{ 3, 256, 511 }) |fp| testing.expect(cf.maybe_contains(0, fp) catch unreachable);
+    testing.expect(!(cf.maybe_contains(0, 4) catch unreachable));
+    cf.remove(0, 256) catch unreachable;
+    testing.expect(cf.maybe_contains(0, 256) catch unreachable);
+    cf.remove(0, 256) catch unreachable;
+    testing.expect(!(cf.maybe_contains(0, 256) catch unreachable));
+}
+
+test "init_zeroed does not touch memory" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = []u8{0} ** 1024;
+        const len = v.cftype.bytes_for(1024);
+        memory[len - 1] = 0xff;
+        _ = v.cftype.init_zeroed(memory[0..len]) catch unreachable;
+        testing.expect(memory[len - 1] == 0xff);
+
+        memory[len - 1] = 0;
+        var cf = v.cftype.init_zeroed(memory[0..len]) catch unreachable;
+        test_not_broken(&cf);
+    }
+}
+
+test "a forgotten filter is empty once its memory is zeroed" {
+    inline for (SupportedVersions) |v| {
+        var memory: [1024]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(1024);
+        var cf = v.cftype.init(memory[0..len]) catch unreachable;
+        cf.add(2, 41) catch unreachable;
+        cf.add(3, 42) catch unreachable;
+
+        cf.forget();
+        testing.expect(0 == cf.count() catch unreachable);
+        std.mem.set(u8, memory[0..len], 0);
+        testing.expect(false == cf.maybe_contains(3, 42) catch unreachable);
+        test_not_broken(&cf);
+    }
+}
+
+test "item keys match exactly what lookups match" {
+    inline for (SupportedVersions) |v| {
+        var memory: [4096]u8 align(v.cftype.Align) = undefined;
+        const len = v.cftype.bytes_for(memory.len);
+        var cf = v.cftype.init(memory[0..len]) catch unreachable;
+        cf.set_locality(.Line);
+        const n = v.cftype.capacity(memory.len) / 2;
+        var i: u64 = 0;
+        while (i < n) : (i += 1) cf.add(test_item_hash(i), test_item_fp(v.Tfp, i)) catch unreachable;
+
+        var keys: [4096]u64 = undefined;
+        var count: usize = 0;
+        var it = cf.item_keys();
+        while (it.next()) |key| : (count += 1) keys[count] = key;
+        testing.expect(count == n);
+
+        // Probe stored and random items: a key is present iff the filter matches.
+        const s = cf.shape();
+        i = 0;
+        while (i < n * 4) : (i += 1) {
+            const hash = test_item_hash(i);
+            const fp = test_item_fp(v.Tfp, i *% 7);
+            const key = v.cftype.item_key(s, hash, fp);
+            var found = false;
+            for (keys[0..count]) |k| found = found or k == key;
+            testing.expect(found == cf.maybe_contains(hash, fp) catch unreachable);
+        }
+    }
+}
+
 test "generics are not completely broken" {
     inline for (SupportedVersions) |v| {
         var memory: [1024]u8 align(v.cftype.Align) = undefined;
-        var cf = v.cftype.init(memory[0..]) catch unreachable;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
         test_not_broken(&cf);
     }
 }
@@ -316,7 +2038,7 @@ test "generics are not completely broken" {
 test "too full when adding too many copies" {
     inline for (SupportedVersions) |v| {
         var memory: [1024]u8 align(v.cftype.Align) = undefined;
-        var cf = v.cftype.init(memory[0..]) catch unreachable;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
         var i: usize = 0;
         while (i < v.buckLen * 2) : (i += 1) {
             cf.add(0, 1) catch unreachable;
@@ -380,7 +2102,7 @@ test "too full when adding too many copies" {
 test "properly breaks when misused" {
     inline for (SupportedVersions) |v| {
         var memory: [1024]u8 align(v.cftype.Align) = undefined;
-        var cf = v.cftype.init(memory[0..]) catch unreachable;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(1024)]) catch unreachable;
         var fp = @intCast(v.Tfp, 1);
 
         testing.expectError(error.Broken, cf.remove(2, 1));
@@ -390,6 +2112,19 @@ test "properly breaks when misused" {
     }
 }
 
+// Counts non-empty slots by looking at the bucket memory directly.
+fn count_used_slots(cf: var) usize {
+    var count: usize = 0;
+    var bucket_idx: usize = 0;
+    while (bucket_idx < cf.buckets.len) : (bucket_idx += 1) {
+        var slot: usize = 0;
+        while (slot < @typeOf(cf.*).Word.bit_count / @typeOf(cf.*).FPBits) : (slot += 1) {
+            if (cf.get_slot(bucket_idx, slot) != FREE_SLOT) count += 1;
+        }
+    }
+    return count;
+}
+
 fn TestSet(comptime Tfp: type) type {
     const ItemSet = std.hash_map.AutoHashMap(u64, Tfp);
     return struct {
@@ -400,16 +2135,18 @@ fn TestSet(comptime Tfp: type) type {
         fn init(iterations: usize, false_positives: usize, allocator: *std.mem.Allocator) Self {
             var item_set = ItemSet.init(allocator);
             var false_set = ItemSet.init(allocator);
+            var prng = std.rand.DefaultPrng.init(42);
+            const random = &prng.random;
 
             return Self{
                 .items = blk: {
                     var i: usize = 0;
                     while (i < iterations) : (i += 1) {
-                        var hash = xoro.random.int(u64);
+                        var hash = random.int(u64);
                         while (item_set.contains(hash)) {
-                            hash = xoro.random.int(u64);
+                            hash = random.int(u64);
                         }
-                        _ = item_set.put(hash, xoro.random.int(Tfp)) catch unreachable;
+                        _ = item_set.put(hash, random.int(Tfp)) catch unreachable;
                     }
                     break :blk item_set;
                 },
@@ -417,11 +2154,11 @@ fn TestSet(comptime Tfp: type) type {
                 .false_positives = blk: {
                     var i: usize = 0;
                     while (i < false_positives) : (i += 1) {
-                        var hash = xoro.random.int(u64);
+                        var hash = random.int(u64);
                         while (item_set.contains(hash) or false_set.contains(hash)) {
-                            hash = xoro.random.int(u64);
+                            hash = random.int(u64);
                         }
-                        _ = false_set.put(hash, xoro.random.int(Tfp)) catch unreachable;
+                        _ = false_set.put(hash, random.int(Tfp)) catch unreachable;
                     }
                     break :blk false_set;
                 },
@@ -445,7 +2182,7 @@ test "small stress test" {
 
         // Build an appropriately-sized filter
         var memory: [v.cftype.size_for(iterations)]u8 align(v.cftype.Align) = undefined;
-        var cf = v.cftype.init(memory[0..]) catch unreachable;
+        var cf = v.cftype.init(memory[0..v.cftype.bytes_for(memory.len)]) catch unreachable;
 
         // Test all items for presence (should all be false)
         {
@@ -469,13 +2206,7 @@ test "small stress test" {
 
         // Test that memory contains the right number of elements
         {
-            var count: usize = 0;
-            for (@bytesToSlice(v.Tfp, memory)) |byte| {
-                if (byte != 0) {
-                    count += 1;
-                }
-            }
-            testing.expect(iterations == count);
+            testing.expect(iterations == count_used_slots(&cf));
             testing.expect(iterations == cf.count() catch unreachable);
         }
 
@@ -564,13 +2295,7 @@ test "small stress test" {
 
         // Test that memory contains 0 elements
         {
-            var count: usize = 0;
-            for (@bytesToSlice(v.Tfp, memory)) |fprint| {
-                if (fprint != 0) {
-                    count += 1;
-                }
-            }
-            testing.expect(0 == count);
+            testing.expect(0 == count_used_slots(&cf));
             testing.expect(0 == cf.count() catch unreachable);
         }
 
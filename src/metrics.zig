@@ -0,0 +1,146 @@
+const builtin = @import("builtin");
+const std = @import("std");
+const redis = @import("./redismodule.zig");
+
+// Module-wide metrics, reported in the `cuckoofilter` section of INFO.
+// Per-key counters live in the keys themselves, see `t_ccf.initStats`.
+//
+// Commands are timed on the main thread only. `filters` and
+// `bucket_memory` are also updated by the lazy free thread,
+// so they are always accessed atomically.
+
+pub const Command = enum {
+    Add,
+    Check,
+    Rem,
+    MAdd,
+    MCheck,
+    MRem,
+    AddItem,
+    CheckItem,
+    RemItem,
+    MAddItem,
+    MCheckItem,
+    MRemItem,
+};
+
+const CommandNames = [][*c]const u8{
+    c"cf_add",     c"cf_check",     c"cf_rem",     c"cf_madd",     c"cf_mcheck",     c"cf_mrem",
+    c"cf_additem", c"cf_checkitem", c"cf_remitem", c"cf_madditem", c"cf_mcheckitem", c"cf_mremitem",
+};
+
+// Latencies are counted in power of 2 buckets of microseconds:
+// bucket 0 is below 1us, bucket i below 2^i us, the last one takes the rest.
+pub const LatencyBuckets = 20;
+
+const LatencyNames = [][*c]const u8{
+    c"1",      c"2",      c"4",     c"8",     c"16",    c"32",    c"64",
+    c"128",    c"256",    c"512",   c"1024",  c"2048",  c"4096",  c"8192",
+    c"16384",  c"32768",  c"65536", c"131072", c"262144", c"inf",
+};
+
+const CommandStats = struct {
+    calls: u64,
+    usec: u64,
+    latency: [LatencyBuckets]u64,
+};
+
+var commands: [@memberCount(Command)]CommandStats = undefined;
+var timer: std.os.time.Timer = undefined;
+
+// Number of filter keys.
+pub var filters: usize = 0;
+
+// Memory used by the buckets of all filters, in bytes.
+pub var bucket_memory: usize = 0;
+
+pub fn init() !void {
+    timer = try std.os.time.Timer.start();
+    for (commands) |*cmd| {
+        cmd.calls = 0;
+        cmd.usec = 0;
+        for (cmd.latency) |*b| b.* = 0;
+    }
+}
+
+// Nanoseconds since the module was loaded.
+pub fn now() u64 {
+    return timer.read();
+}
+
+// Counts a call of `cmd` started at `start` (see `now`).
+pub fn record(cmd: Command, start: u64) void {
+    const usec = (timer.read() - start) / 1000;
+    const stats = &commands[@enumToInt(cmd)];
+    stats.calls += 1;
+    stats.usec += usec;
+    stats.latency[latencyBucket(usec)] += 1;
+}
+
+fn latencyBucket(usec: u64) usize {
+    if (usec == 0) return 0;
+    return std.math.min(LatencyBuckets - 1, usize(std.math.log2_int(u64, usec)) + 1);
+}
+
+// Upper bound, in microseconds, of the bucket holding the `p`/1000 quantile.
+// The last bucket has no bound, -1 is returned for it.
+fn percentile(stats: *const CommandStats, p: u64) i64 {
+    if (stats.calls == 0) return 0;
+    const rank = (stats.calls * p + 999) / 1000;
+    var seen: u64 = 0;
+    for (stats.latency) |n, i| {
+        seen += n;
+        if (seen >= rank) return if (i == LatencyBuckets - 1) -1 else i64(1) << @intCast(u6, i);
+    }
+    unreachable;
+}
+
+pub fn addBucketMemory(bytes: usize) void {
+    _ = @atomicRmw(usize, &bucket_memory, builtin.AtomicRmwOp.Add, bytes, builtin.AtomicOrder.SeqCst);
+}
+
+pub fn subBucketMemory(bytes: usize) void {
+    _ = @atomicRmw(usize, &bucket_memory, builtin.AtomicRmwOp.Sub, bytes, builtin.AtomicOrder.SeqCst);
+}
+
+// INFO callback, registered on servers that support module INFO sections.
+export fn CFInfoFunc(ctx: ?*redis.RedisModuleInfoCtx, for_crash_report: c_int) void {
+    // An empty name gives the section the name of the module
+    _ = redis.RedisModule_InfoAddSection.?(ctx, c"");
+    _ = redis.RedisModule_InfoAddFieldULongLong.?(ctx, c"filters", @atomicLoad(usize, &filters, builtin.AtomicOrder.SeqCst));
+    _ = redis.RedisModule_InfoAddFieldULongLong.?(ctx, c"bucket_memory", @atomicLoad(usize, &bucket_memory, builtin.AtomicOrder.SeqCst));
+
+    for (commands) |*stats, i| {
+        _ = redis.RedisModule_InfoBeginDictField.?(ctx, CommandNames[i]);
+        _ = redis.RedisModule_InfoAddFieldULongLong.?(ctx, c"calls", stats.calls);
+        _ = redis.RedisModule_InfoAddFieldULongLong.?(ctx, c"usec", stats.usec);
+        const per_call = if (stats.calls == 0) f64(0) else @intToFloat(f64, stats.usec) / @intToFloat(f64, stats.calls);
+        _ = redis.RedisModule_InfoAddFieldDouble.?(ctx, c"usec_per_call", per_call);
+        _ = redis.RedisModule_InfoAddFieldLongLong.?(ctx, c"p50", percentile(stats, 500));
+        _ = redis.RedisModule_InfoAddFieldLongLong.?(ctx, c"p99", percentile(stats, 990));
+        _ = redis.RedisModule_InfoAddFieldLongLong.?(ctx, c"p999", percentile(stats, 999));
+        _ = redis.RedisModule_InfoEndDictField.?(ctx);
+    }
+
+    // Full histograms, only in the `cuckoofilter_latency` section.
+    _ = redis.RedisModule_InfoAddSection.?(ctx, c"latency");
+    for (commands) |*stats, i| {
+        _ = redis.RedisModule_InfoBeginDictField.?(ctx, CommandNames[i]);
+        for (stats.latency) |n, b| _ = redis.RedisModule_InfoAddFieldULongLong.?(ctx, LatencyNames[b], n);
+        _ = redis.RedisModule_InfoEndDictField.?(ctx);
+    }
+}
+
+test "latency buckets" {
+    std.testing.expect(latencyBucket(0) == 0);
+    std.testing.expect(latencyBucket(1) == 1);
+    std.testing.expect(latencyBucket(3) == 2);
+    std.testing.expect(latencyBucket(1 << 40) == LatencyBuckets - 1);
+
+    var stats = CommandStats{ .calls = 100, .usec = 0, .latency = []u64{0} ** LatencyBuckets };
+    stats.latency[latencyBucket(5)] = 99;
+    stats.latency[LatencyBuckets - 1] = 1;
+    std.testing.expect(percentile(&stats, 500) == 8);
+    std.testing.expect(percentile(&stats, 990) == 8);
+    std.testing.expect(percentile(&stats, 999) == -1);
+}
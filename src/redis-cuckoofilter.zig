@@ -4,11 +4,9 @@ const mem = std.mem;
 const redis = @import("./redismodule.zig");
 const cuckoo = @import("./lib/zig-cuckoofilter.zig");
 const t_ccf = @import("./t_cuckoofilter.zig");
-
-// We save the initial state of Xoroshiro seeded at 42 at compile-time,
-// used to initialize the prng state for each new cuckoofilter key.
-// This way we are able to provide fully deterministic behavior.
-const XoroDefaultState: [2]u64 = comptime std.rand.Xoroshiro128.init(42).s;
+const workers = @import("./workers.zig");
+const metrics = @import("./metrics.zig");
+const hashing = @import("./hashing.zig");
 
 // Compares two strings ignoring case (ascii strings, not fancy unicode strings).
 // Used by commands to check if a given flag (e.g. NX, EXACT, ...) was given as an arugment.
@@ -102,9 +100,15 @@ inline fn parse_args(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleS
         return error.Error;
     }
 
+    try parse_hash_fp(ctx, argv[2], argv[3], hash, fp);
+}
+
+// Parses a single hash/fp pair.
+// Replies with an error to the client when one of the two values is malformed.
+fn parse_hash_fp(ctx: ?*redis.RedisModuleCtx, hash_arg: ?*redis.RedisModuleString, fp_arg: ?*redis.RedisModuleString, hash: *u64, fp: *u32) !void {
     // Parse hash as u64
     var hash_len: usize = undefined;
-    var hash_str = redis.RedisModule_StringPtrLen.?(argv[2], &hash_len);
+    var hash_str = redis.RedisModule_StringPtrLen.?(hash_arg, &hash_len);
     var hash_start: usize = 0;
     if (hash_len > 0 and hash_str[0] == '-') {
         // Shift forward by 1 to skip the negative sign
@@ -129,7 +133,7 @@ inline fn parse_args(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleS
 
     // Parse fp as u32
     var fp_len: usize = undefined;
-    var fp_str = redis.RedisModule_StringPtrLen.?(argv[3], &fp_len);
+    var fp_str = redis.RedisModule_StringPtrLen.?(fp_arg, &fp_len);
     var fp_start: usize = 0;
     if (fp_len > 0 and fp_str[0] == '-') {
         // Shift forward by 1 to skip the negative sign
@@ -153,24 +157,211 @@ inline fn parse_args(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleS
     }
 }
 
+// Arguments of a batch command, either a list of hash/fp pairs or
+// a single blob of binary records (see `parse_batch_args`).
+const Batch = union(enum) {
+    Items: BatchItems,
+    Packed: []const u8,
+};
+
+// Hash and fp values of a textual batch command.
+// Both slices live in the command's memory pool.
+const BatchItems = struct {
+    hashes: []u64,
+    fps: []u32,
+};
+
+// Size of a record in a binary batch: a little-endian u64 hash followed by a little-endian u32 fp.
+const PackedRecordSize = 12;
+
+// Number of binary records decoded at a time, on the stack.
+const PackedChunk = 64;
+
+// Parses the arguments of batch commands, which come in two forms:
+//   `hash fp [hash fp ...]`, where each value is parsed like in `parse_args`,
+//   `BIN blob`, where `blob` is a sequence of packed binary records.
+// The whole batch is validated before any item gets applied to the filter.
+// Binary records are not copied, they get decoded straight from the argument when
+// the batch is applied.
+fn parse_batch_args(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) !Batch {
+    if (argc < 4 or @rem(argc, 2) != 0) {
+        _ = redis.RedisModule_WrongArity.?(ctx);
+        return error.Error;
+    }
+
+    if (argc == 4) {
+        var flag_len: usize = undefined;
+        const flag = redis.RedisModule_StringPtrLen.?(argv[2], &flag_len)[0..flag_len];
+        if (insensitive_eql("BIN", flag)) {
+            var blob_len: usize = undefined;
+            const blob = redis.RedisModule_StringPtrLen.?(argv[3], &blob_len)[0..blob_len];
+            if (blob_len == 0 or blob_len % PackedRecordSize != 0) {
+                _ = redis.RedisModule_ReplyWithError.?(ctx, c"ERR binary batch length must be a non-zero multiple of 12");
+                return error.Error;
+            }
+            return Batch{ .Packed = blob };
+        }
+    }
+
+    const n = @intCast(usize, @divExact(argc - 2, 2));
+    const items = BatchItems{
+        .hashes = pool_alloc(u64, ctx, n),
+        .fps = pool_alloc(u32, ctx, n),
+    };
+
+    var i: usize = 0;
+    while (i < n) : (i += 1) {
+        try parse_hash_fp(ctx, argv[2 + 2 * i], argv[3 + 2 * i], &items.hashes[i], &items.fps[i]);
+    }
+    return Batch{ .Items = items };
+}
+
+const BatchOp = enum {
+    Add,
+    Check,
+    Rem,
+};
+
+// Applies a binary batch to a filter and replies with a packed bitmap
+// where bit `i % 8` of byte `i / 8` is set if item `i` was successfully
+// added, found or removed, depending on `op`. Every other result is a 0:
+// too full, not found and broken look the same, except for checks on a
+// broken filter, which reply with an error like CF.MCHECK does.
+fn run_packed_batch(comptime op: BatchOp, cf: var, ctx: ?*redis.RedisModuleCtx, blob: []const u8) c_int {
+    const Tfp = @typeOf(cf.*).FPType;
+    const n = blob.len / PackedRecordSize;
+    var bitmap = pool_alloc(u8, ctx, (n + 7) / 8);
+    mem.set(u8, bitmap, 0);
+
+    var hashes: [PackedChunk]u64 = undefined;
+    var fps: [PackedChunk]Tfp = undefined;
+    var results: [PackedChunk]cuckoo.BatchResult = undefined;
+    var start: usize = 0;
+    while (start < n) : (start += PackedChunk) {
+        const len = std.math.min(PackedChunk, n - start);
+        var i: usize = 0;
+        while (i < len) : (i += 1) {
+            const record = blob[(start + i) * PackedRecordSize ..][0..PackedRecordSize];
+            hashes[i] = mem.readIntSliceLittle(u64, record[0..8]);
+            fps[i] = @truncate(Tfp, mem.readIntSliceLittle(u32, record[8..12]));
+        }
+
+        switch (op) {
+            .Add => cf.add_batch(hashes[0..len], fps[0..len], results[0..len]),
+            .Check => cf.maybe_contains_batch(hashes[0..len], fps[0..len], results[0..len]),
+            .Rem => cf.remove_batch(hashes[0..len], fps[0..len], results[0..len]),
+        }
+
+        for (results[0..len]) |res, j| {
+            if (op == BatchOp.Check and res == cuckoo.BatchResult.Broken)
+                return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken");
+            if (res == cuckoo.BatchResult.Ok) bitmap[(start + j) / 8] |= u8(1) << @intCast(u3, (start + j) % 8);
+        }
+    }
+
+    return redis.RedisModule_ReplyWithStringBuffer.?(ctx, bitmap.ptr, bitmap.len);
+}
+
+// Allocates a slice from the command's memory pool.
+// Redis frees it automatically once the command returns.
+fn pool_alloc(comptime T: type, ctx: ?*redis.RedisModuleCtx, n: usize) []T {
+    return @ptrCast([*]T, @alignCast(@alignOf(T), redis.RedisModule_PoolAlloc.?(ctx, n * @sizeOf(T))))[0..n];
+}
+
+// Truncates parsed fp values to the fingerprint type of a filter.
+fn truncate_fps(comptime Tfp: type, ctx: ?*redis.RedisModuleCtx, fps: []const u32) []Tfp {
+    var res = pool_alloc(Tfp, ctx, fps.len);
+    for (fps) |fp, i| res[i] = @truncate(Tfp, fp);
+    return res;
+}
+
 // Registers the module and its commands.
 export fn RedisModule_OnLoad(ctx: *redis.RedisModuleCtx, argv: [*c]*redis.RedisModuleString, argc: c_int) c_int {
     if (redis.RedisModule_Init(ctx, c"cuckoofilter", 1, redis.REDISMODULE_APIVER_1) == redis.REDISMODULE_ERR) {
         return redis.REDISMODULE_ERR;
     }
 
+    // Module arguments
+    var worker_count: usize = DefaultWorkers;
+    var i: usize = 0;
+    while (i < @intCast(usize, argc)) : (i += 1) {
+        var arg_len: usize = undefined;
+        const arg = redis.RedisModule_StringPtrLen.?(argv[i], &arg_len)[0..arg_len];
+        if (insensitive_eql("HUGEPAGES", arg)) {
+            if (builtin.os == builtin.Os.linux) {
+                t_ccf.default_storage = .HugePages;
+            } else {
+                redis.RedisModule_Log.?(ctx, c"warning", c"huge pages are not supported on this platform, HUGEPAGES ignored");
+            }
+        } else if (insensitive_eql("WORKERS", arg) and i + 1 < @intCast(usize, argc)) {
+            i += 1;
+            const n = parse_longlong(argv[i]) catch -1;
+            if (n < 0 or n > 64) {
+                redis.RedisModule_Log.?(ctx, c"warning", c"WORKERS must be a number between 0 and 64");
+                return redis.REDISMODULE_ERR;
+            }
+            worker_count = @intCast(usize, n);
+        } else {
+            redis.RedisModule_Log.?(ctx, c"warning", c"unknown module argument: %s", arg.ptr);
+            return redis.REDISMODULE_ERR;
+        }
+    }
+
     // Register our custom types
     t_ccf.RegisterTypes(ctx) catch return redis.REDISMODULE_ERR;
 
+    // Module-wide metrics, shown by INFO on servers that support module sections
+    metrics.init() catch {
+        redis.RedisModule_Log.?(ctx, c"warning", c"could not start the metrics timer");
+        return redis.REDISMODULE_ERR;
+    };
+    if (redis.RedisModule_RegisterInfoFunc) |registerInfoFunc| {
+        if (registerInfoFunc(ctx, metrics.CFInfoFunc) == redis.REDISMODULE_ERR) return redis.REDISMODULE_ERR;
+    }
+
+    // Threads for big read-only batches, and the one for CF.FREEZE
+    workers.start(worker_count) catch {
+        redis.RedisModule_Log.?(ctx, c"warning", c"could not start worker threads");
+        return redis.REDISMODULE_ERR;
+    };
+
+    // Windows move on a timer, and follow their keys when renamed or moved
+    // (or loaded, in the database Redis tells when it's recent enough)
+    _ = redis.RedisModule_GetApi.?(c"RedisModule_GetDbIdFromIO", @ptrCast(*c_void, &t_ccf.getDbIdFromIO));
+    _ = redis.RedisModule_CreateTimer.?(ctx, WindowTimerPeriod, window_tick, null);
+    if (redis.RedisModule_SubscribeToKeyspaceEvents.?(ctx, redis.REDISMODULE_NOTIFY_GENERIC, window_key_event) == redis.REDISMODULE_ERR) return redis.REDISMODULE_ERR;
+
     // Register our commands
     registerCommand(ctx, c"cf.init", CF_INIT, c"write deny-oom", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.rem", CF_REM, c"write fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.add", CF_ADD, c"write fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.fixtoofull", CF_FIXTOOFULL, c"write fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.rotate", CF_ROTATE, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.check", CF_CHECK, c"readonly fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.madd", CF_MADD, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.mrem", CF_MREM, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.mcheck", CF_MCHECK, c"readonly", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.additem", CF_ADDITEM, c"write fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.remitem", CF_REMITEM, c"write fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.checkitem", CF_CHECKITEM, c"readonly fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.madditem", CF_MADDITEM, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.mremitem", CF_MREMITEM, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.mcheckitem", CF_MCHECKITEM, c"readonly", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.count", CF_COUNT, c"readonly fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.isbroken", CF_ISBROKEN, c"readonly fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.istoofull", CF_ISTOOFULL, c"readonly fast", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.info", CF_INFO, c"readonly", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadheader", CF_LOADHEADER, c"write deny-oom", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadstage", CF_LOADSTAGE, c"write deny-oom", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadchunk", CF_LOADCHUNK, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadwindow", CF_LOADWINDOW, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadimage", CF_LOADIMAGE, c"write deny-oom", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.merge", CF_MERGE, c"write deny-oom", 1, -1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.mergerange", CF_MERGERANGE, c"write deny-oom", 1, 2, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.snapshot", CF_SNAPSHOT, c"readonly", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.delta", CF_DELTA, c"readonly", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.freeze", CF_FREEZE, c"write", 1, 1, 1) catch return redis.REDISMODULE_ERR;
+    registerCommand(ctx, c"cf.loadfrozen", CF_LOADFROZEN, c"write deny-oom", 1, 1, 1) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.capacity", CF_CAPACITY, c"fast allow-loading allow-stale", 0, 0, 0) catch return redis.REDISMODULE_ERR;
     registerCommand(ctx, c"cf.sizefor", CF_SIZEFOR, c"fast allow-loading allow-stale", 0, 0, 0) catch return redis.REDISMODULE_ERR;
 
@@ -182,22 +373,189 @@ inline fn registerCommand(ctx: *redis.RedisModuleCtx, cmd: [*c]const u8, func: r
     if (err == redis.REDISMODULE_ERR) return error.Error;
 }
 
-// CF.INIT size [fpsize]
+// Parses the value of the GROWTH option: a power of 2 between 1 and 16.
+fn parse_growth(arg: ?*redis.RedisModuleString) !usize {
+    const growth = try parse_longlong(arg);
+    return switch (growth) {
+        1, 2, 4, 8, 16 => @intCast(usize, growth),
+        else => error.Error,
+    };
+}
+
+// Parses the generations of the WINDOW option: between 1 and 31.
+fn parse_generations(arg: ?*redis.RedisModuleString) !usize {
+    const generations = try parse_longlong(arg);
+    if (generations < 1 or generations > t_ccf.MAX_GENERATIONS) return error.Error;
+    return @intCast(usize, generations);
+}
+
+// Parses the interval of the WINDOW option, in seconds. Returns milliseconds.
+fn parse_interval(arg: ?*redis.RedisModuleString) !u64 {
+    const interval = try parse_longlong(arg);
+    if (interval < 1 or interval > 100 * 365 * 24 * 3600) return error.Error;
+    return @intCast(u64, interval) * 1000;
+}
+
+// Fingerprint sizes accepted by the fpsize argument.
+const FPSize = enum {
+    Bits6,
+    Bits8,
+    Bits12,
+    Bits16,
+    Bits32,
+};
+
+// Parses the fpsize argument: either a size in bytes (`1`, `2`, `4`)
+// or a size in bits followed by `b` (`6b`, `8b`, `12b`, `16b`, `32b`).
+// 6 and 12 bit fingerprints can only be expressed in bits.
+fn parse_fpsize(str: []const u8) !FPSize {
+    if (insensitive_eql("1", str) or insensitive_eql("8B", str)) return FPSize.Bits8;
+    if (insensitive_eql("2", str) or insensitive_eql("16B", str)) return FPSize.Bits16;
+    if (insensitive_eql("4", str) or insensitive_eql("32B", str)) return FPSize.Bits32;
+    if (insensitive_eql("6B", str)) return FPSize.Bits6;
+    if (insensitive_eql("12B", str)) return FPSize.Bits12;
+    return error.Error;
+}
+
+// Bucket layouts accepted by the ENCODING option.
+// Semi-sorted buckets use one more fingerprint bit in the same memory,
+// at the cost of decoding the bucket on every access.
+const Encoding = enum {
+    Plain,
+    SemiSorted,
+};
+
+fn parse_encoding(arg: ?*redis.RedisModuleString) !Encoding {
+    var arg_len: usize = undefined;
+    const str = redis.RedisModule_StringPtrLen.?(arg, &arg_len)[0..arg_len];
+    if (insensitive_eql("PLAIN", str)) return Encoding.Plain;
+    if (insensitive_eql("SEMISORTED", str)) return Encoding.SemiSorted;
+    return error.Error;
+}
+
+// Hash functions accepted by the HASH option.
+fn parse_hash(arg: ?*redis.RedisModuleString) !hashing.Hash {
+    var arg_len: usize = undefined;
+    const str = redis.RedisModule_StringPtrLen.?(arg, &arg_len)[0..arg_len];
+    if (insensitive_eql("XXH3", str)) return hashing.Hash.XXH3;
+    if (insensitive_eql("XXH64", str)) return hashing.Hash.XXH64;
+    return error.Error;
+}
+
+// Seeds can use all 64 bits, bigger ones are given as negative numbers.
+fn parse_seed(arg: ?*redis.RedisModuleString) !u64 {
+    return @bitCast(u64, try parse_longlong(arg));
+}
+
+// Strategies accepted by the INSERTION option.
+fn parse_insertion(arg: ?*redis.RedisModuleString) !cuckoo.Insertion {
+    var arg_len: usize = undefined;
+    const str = redis.RedisModule_StringPtrLen.?(arg, &arg_len)[0..arg_len];
+    if (insensitive_eql("RANDOMWALK", str)) return cuckoo.Insertion.RandomWalk;
+    if (insensitive_eql("BFS", str)) return cuckoo.Insertion.BFS;
+    return error.Error;
+}
+
+// Placements accepted by the LOCALITY option.
+fn parse_locality(arg: ?*redis.RedisModuleString) !cuckoo.Locality {
+    var arg_len: usize = undefined;
+    const str = redis.RedisModule_StringPtrLen.?(arg, &arg_len)[0..arg_len];
+    if (insensitive_eql("TABLE", str)) return cuckoo.Locality.Table;
+    if (insensitive_eql("LINE", str)) return cuckoo.Locality.Line;
+    if (insensitive_eql("PAGE", str)) return cuckoo.Locality.Page;
+    if (insensitive_eql("HUGEPAGE", str)) return cuckoo.Locality.HugePage;
+    return error.Error;
+}
+
+// Replies with the reason why a filter (or a stage) could not be created.
+fn reply_with_create_error(ctx: ?*redis.RedisModuleCtx, err: anyerror) c_int {
+    return switch (err) {
+        error.BadLength => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad size"),
+        error.BadHeader => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header"),
+        error.Unsupported => redis.RedisModule_ReplyWithError.?(ctx, c"ERR huge pages are not supported on this platform"),
+        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR could not create filter"),
+    };
+}
+
+// Frozen keys are filters too, they just can't do what was asked.
+fn reply_with_wrong_type(ctx: ?*redis.RedisModuleCtx, keyType: ?*redis.RedisModuleType) c_int {
+    inline for (t_ccf.FrozenFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is frozen");
+    }
+    return redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+}
+
+// CF.INIT key size [fpsize] [GROWTH n] [HUGEPAGES] [ENCODING plain|semisorted] [HASH xxh3|xxh64] [SEED n]
+//         [INSERTION randomwalk|bfs] [LOCALITY table|line|page|hugepage] [WINDOW generations interval]
 export fn CF_INIT(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 3 and argc != 4) return redis.RedisModule_WrongArity.?(ctx);
+    if (argc < 3 or argc > 20) return redis.RedisModule_WrongArity.?(ctx);
 
     // size argument
     var size_len: usize = undefined;
     const size_str = redis.RedisModule_StringPtrLen.?(argv[2], &size_len)[0..size_len];
     const size = str2size(size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad size");
 
-    // fpsize argument
-    var fp_size = "1"[0..];
-    if (argc == 4) {
-        var fp_size_len: usize = undefined;
-        fp_size = redis.RedisModule_StringPtrLen.?(argv[3], &fp_size_len)[0..fp_size_len];
+    // fpsize argument, GROWTH, HUGEPAGES, ENCODING, HASH, SEED, INSERTION, LOCALITY and WINDOW options
+    var fp_size_str = "1"[0..];
+    var growth: ?usize = null;
+    var window: ?WindowArgs = null;
+    var storage = t_ccf.default_storage;
+    var encoding: ?Encoding = null;
+    var hash: ?hashing.Hash = null;
+    var seed: ?u64 = null;
+    var insertion: ?cuckoo.Insertion = null;
+    var locality: ?cuckoo.Locality = null;
+    var i: usize = 3;
+    while (i < @intCast(usize, argc)) : (i += 1) {
+        var arg_len: usize = undefined;
+        const arg = redis.RedisModule_StringPtrLen.?(argv[i], &arg_len)[0..arg_len];
+        if (insensitive_eql("GROWTH", arg)) {
+            if (growth != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            growth = parse_growth(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad growth");
+        } else if (insensitive_eql("HUGEPAGES", arg)) {
+            if (builtin.os == builtin.Os.linux) {
+                storage = .HugePages;
+            } else {
+                redis.RedisModule_Log.?(ctx, c"warning", c"huge pages are not supported on this platform, HUGEPAGES ignored");
+            }
+        } else if (insensitive_eql("ENCODING", arg)) {
+            if (encoding != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            encoding = parse_encoding(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad encoding");
+        } else if (insensitive_eql("HASH", arg)) {
+            if (hash != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            hash = parse_hash(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad hash");
+        } else if (insensitive_eql("SEED", arg)) {
+            if (seed != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            seed = parse_seed(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad seed");
+        } else if (insensitive_eql("INSERTION", arg)) {
+            if (insertion != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            insertion = parse_insertion(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad insertion");
+        } else if (insensitive_eql("LOCALITY", arg)) {
+            if (locality != null or i + 1 == @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            i += 1;
+            locality = parse_locality(argv[i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad locality");
+        } else if (insensitive_eql("WINDOW", arg)) {
+            if (window != null or i + 2 >= @intCast(usize, argc)) return redis.RedisModule_WrongArity.?(ctx);
+            window = WindowArgs{
+                .generations = parse_generations(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad window"),
+                .interval = parse_interval(argv[i + 2]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad window"),
+            };
+            i += 2;
+        } else if (i == 3) {
+            fp_size_str = arg;
+        } else {
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR syntax error");
+        }
     }
 
+    // Windowed filters never grow
+    if (window != null and growth != null) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR WINDOW and GROWTH can't be used together");
+
     // Obtain the key from Redis.
     var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
     defer redis.RedisModule_CloseKey.?(key);
@@ -206,36 +564,149 @@ export fn CF_INIT(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleStri
     if (keyType != redis.REDISMODULE_KEYTYPE_EMPTY) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key already exists");
 
     // New Cuckoo Filter!
-    if (fp_size.len != 1) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
-    return switch (fp_size[0]) {
-        '1' => do_init(t_ccf.Filter8, ctx, key, size),
-        '2' => do_init(t_ccf.Filter16, ctx, key, size),
-        '4' => do_init(t_ccf.Filter32, ctx, key, size),
-        else => return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize"),
+    const fp_size = parse_fpsize(fp_size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
+    const hasher = hashing.Hasher{
+        .kind = hash orelse hashing.Hasher.Default.kind,
+        .seed = seed orelse hashing.Hasher.Default.seed,
+    };
+    const options = t_ccf.Options{
+        .insertion = insertion orelse t_ccf.Options.Default.insertion,
+        .locality = locality orelse t_ccf.Options.Default.locality,
+    };
+    if (encoding == Encoding.SemiSorted) {
+        if (window) |w| return switch (fp_size) {
+            .Bits8 => do_init_windowed(t_ccf.ScalableSemiSortedFilter9, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+            .Bits12 => do_init_windowed(t_ccf.ScalableSemiSortedFilter13, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+            .Bits16 => do_init_windowed(t_ccf.ScalableSemiSortedFilter17, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+            else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+        };
+        if (growth) |g| return switch (fp_size) {
+            .Bits8 => do_init_scalable(t_ccf.ScalableSemiSortedFilter9, ctx, argv, argc, key, size, g, storage, hasher, options),
+            .Bits12 => do_init_scalable(t_ccf.ScalableSemiSortedFilter13, ctx, argv, argc, key, size, g, storage, hasher, options),
+            .Bits16 => do_init_scalable(t_ccf.ScalableSemiSortedFilter17, ctx, argv, argc, key, size, g, storage, hasher, options),
+            else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+        };
+        return switch (fp_size) {
+            .Bits8 => do_init(t_ccf.SemiSortedFilter9, ctx, argv, argc, key, size, storage, hasher, options),
+            .Bits12 => do_init(t_ccf.SemiSortedFilter13, ctx, argv, argc, key, size, storage, hasher, options),
+            .Bits16 => do_init(t_ccf.SemiSortedFilter17, ctx, argv, argc, key, size, storage, hasher, options),
+            else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+        };
+    }
+    if (window) |w| return switch (fp_size) {
+        .Bits6 => do_init_windowed(t_ccf.ScalableFilter6, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+        .Bits8 => do_init_windowed(t_ccf.ScalableFilter8, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+        .Bits12 => do_init_windowed(t_ccf.ScalableFilter12, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+        .Bits16 => do_init_windowed(t_ccf.ScalableFilter16, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
+        .Bits32 => do_init_windowed(t_ccf.ScalableFilter32, ctx, argv, argc, key, argv[1], size, w, storage, hasher, options),
     };
+    if (growth) |g| return switch (fp_size) {
+        .Bits6 => do_init_scalable(t_ccf.ScalableFilter6, ctx, argv, argc, key, size, g, storage, hasher, options),
+        .Bits8 => do_init_scalable(t_ccf.ScalableFilter8, ctx, argv, argc, key, size, g, storage, hasher, options),
+        .Bits12 => do_init_scalable(t_ccf.ScalableFilter12, ctx, argv, argc, key, size, g, storage, hasher, options),
+        .Bits16 => do_init_scalable(t_ccf.ScalableFilter16, ctx, argv, argc, key, size, g, storage, hasher, options),
+        .Bits32 => do_init_scalable(t_ccf.ScalableFilter32, ctx, argv, argc, key, size, g, storage, hasher, options),
+    };
+    return switch (fp_size) {
+        .Bits6 => do_init(t_ccf.Filter6, ctx, argv, argc, key, size, storage, hasher, options),
+        .Bits8 => do_init(t_ccf.Filter8, ctx, argv, argc, key, size, storage, hasher, options),
+        .Bits12 => do_init(t_ccf.Filter12, ctx, argv, argc, key, size, storage, hasher, options),
+        .Bits16 => do_init(t_ccf.Filter16, ctx, argv, argc, key, size, storage, hasher, options),
+        .Bits32 => do_init(t_ccf.Filter32, ctx, argv, argc, key, size, storage, hasher, options),
+    };
+}
+
+const SemiSortedFPSizeError = c"ERR semisorted encoding requires fpsize 1, 12b or 2";
+
+// Arguments of the WINDOW option.
+const WindowArgs = struct {
+    generations: usize,
+    interval: u64,
+};
+
+// HUGEPAGES is a placement hint for the local instance: replicas (and the
+// AOF) get the command without it and use their own module arguments, so
+// that a replica without huge pages doesn't fail to create the filter.
+fn replicate_init(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) void {
+    var args: [20]?*redis.RedisModuleString = undefined;
+    var n: usize = 0;
+    var i: usize = 2;
+    while (i < @intCast(usize, argc)) : (i += 1) {
+        var arg_len: usize = undefined;
+        const arg = redis.RedisModule_StringPtrLen.?(argv[i], &arg_len)[0..arg_len];
+        if (i >= 3 and insensitive_eql("HUGEPAGES", arg)) continue;
+        args[n] = argv[i];
+        n += 1;
+    }
+    if (n + 2 == @intCast(usize, argc)) {
+        _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+        return;
+    }
+    _ = redis.RedisModule_Replicate.?(ctx, c"cf.init", c"sv", argv[1], args[0..].ptr, n);
 }
 
-inline fn do_init(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, size: usize) c_int {
+inline fn do_init(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int, key: ?*redis.RedisModuleKey, size: usize, storage: t_ccf.Storage, hasher: hashing.Hasher, options: t_ccf.Options) c_int {
     var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
-    var buckets = @ptrCast([*]u8, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(size)));
-    const realCFType = @typeOf(cf.cf);
 
-    cf.s = XoroDefaultState;
-    cf.cf = realCFType.init(buckets[0..size]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR could not create filter");
+    cf.hasher = hasher;
+    cf.readers = 0;
+    cf.storage = storage;
+    cf.cf = t_ccf.allocFilter(@typeOf(cf.cf), size, storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    t_ccf.applyOptions(cf, options);
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    replicate_init(ctx, argv, argc);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
 
-    switch (CFType) {
-        t_ccf.Filter8 => _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.Type8, cf),
-        t_ccf.Filter16 => _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.Type16, cf),
-        t_ccf.Filter32 => _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.Type32, cf),
-        else => unreachable,
-    }
+inline fn do_init_scalable(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int, key: ?*redis.RedisModuleKey, size: usize, growth: usize, storage: t_ccf.Storage, hasher: hashing.Hasher, options: t_ccf.Options) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const scalableCFType = @typeOf(cf.cf);
 
-    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    cf.hasher = hasher;
+    cf.readers = 0;
+    cf.cf = scalableCFType.init(size, growth, storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    t_ccf.applyOptions(cf, options);
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    replicate_init(ctx, argv, argc);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// Windowed filters take `generations + 1` times `size` bytes (see `t_ccf.Window`).
+inline fn do_init_windowed(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString, size: usize, window: WindowArgs, storage: t_ccf.Storage, hasher: hashing.Hasher, options: t_ccf.Options) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const scalableCFType = @typeOf(cf.cf);
+
+    cf.hasher = hasher;
+    cf.readers = 0;
+    const now = @intCast(u64, redis.RedisModule_Milliseconds.?());
+    cf.cf = scalableCFType.init_windowed(size, window.generations, window.interval, storage, now) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    t_ccf.applyOptions(cf, options);
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+    t_ccf.addWindowKey(redis.RedisModule_GetSelectedDb.?(ctx), name);
+
+    replicate_init(ctx, argv, argc);
     return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
 }
 
 // CF.ADD key hash fp
 export fn CF_ADD(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.Add, start);
+
     var hash: u64 = undefined;
     var fp: u32 = undefined;
     parse_args(ctx, argv, argc, &hash, &fp) catch return redis.REDISMODULE_OK;
@@ -247,16 +718,17 @@ export fn CF_ADD(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleStrin
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_add(t_ccf.Filter8, ctx, key, hash, fp) else if (keyType == t_ccf.Type16) do_add(t_ccf.Filter16, ctx, key, hash, fp) else if (keyType == t_ccf.Type32) do_add(t_ccf.Filter32, ctx, key, hash, fp) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_add(CFType, ctx, key, hash, fp, CF_ADD);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_add(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, hash: u64, fp: u32) c_int {
+inline fn do_add(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, hash: u64, fp: u32, rerun: redis.RedisModuleCmdFunc) c_int {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, rerun)) return redis.REDISMODULE_OK;
     const realCFType = @typeOf(cf.cf);
-    cuckoo.set_default_prng_state(cf.s);
-    defer {
-        cf.s = cuckoo.get_default_prng_state();
-    }
 
     _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
     return if (cf.cf.add(hash, @truncate(realCFType.FPType, fp)))
@@ -269,6 +741,9 @@ inline fn do_add(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redi
 
 // CF.CHECK key hash fp
 export fn CF_CHECK(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.Check, start);
+
     var hash: u64 = undefined;
     var fp: u32 = undefined;
     parse_args(ctx, argv, argc, &hash, &fp) catch return redis.REDISMODULE_OK;
@@ -280,7 +755,10 @@ export fn CF_CHECK(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleStr
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_check(t_ccf.Filter8, ctx, key, hash, fp) else if (keyType == t_ccf.Type16) do_check(t_ccf.Filter16, ctx, key, hash, fp) else if (keyType == t_ccf.Type32) do_check(t_ccf.Filter32, ctx, key, hash, fp) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_check(CFType, ctx, key, hash, fp);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
 inline fn do_check(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, hash: u64, fp: u32) c_int {
@@ -295,6 +773,9 @@ inline fn do_check(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*re
 
 // CF.REM key hash fp
 export fn CF_REM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.Rem, start);
+
     var hash: u64 = undefined;
     var fp: u32 = undefined;
     parse_args(ctx, argv, argc, &hash, &fp) catch return redis.REDISMODULE_OK;
@@ -306,24 +787,37 @@ export fn CF_REM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleStrin
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_rem(t_ccf.Filter8, ctx, key, hash, fp) else if (keyType == t_ccf.Type16) do_rem(t_ccf.Filter16, ctx, key, hash, fp) else if (keyType == t_ccf.Type32) do_rem(t_ccf.Filter32, ctx, key, hash, fp) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_rem(CFType, ctx, key, hash, fp, CF_REM);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_rem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, hash: u64, fp: u32) c_int {
+inline fn do_rem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, hash: u64, fp: u32, rerun: redis.RedisModuleCmdFunc) c_int {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, rerun)) return redis.REDISMODULE_OK;
     const realCFType = @typeOf(cf.cf);
 
     _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
-    return if (cf.cf.remove(hash, @truncate(realCFType.FPType, fp)))
-        redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK")
-    else |err| switch (err) {
-        error.Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
+    cf.cf.remove(hash, @truncate(realCFType.FPType, fp)) catch |err| return reply_with_remove_error(ctx, err);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// Only windowed filters return NotFound: the item may have expired.
+fn reply_with_remove_error(ctx: ?*redis.RedisModuleCtx, err: anyerror) c_int {
+    return switch (err) {
+        error.NotFound => redis.RedisModule_ReplyWithLongLong.?(ctx, 0),
+        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
     };
 }
 
-// CF.FIXTOOFULL key
-export fn CF_FIXTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+// CF.MADD key hash fp [hash fp ...]
+export fn CF_MADD(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.MAdd, start);
+
+    const batch = parse_batch_args(ctx, argv, argc) catch return redis.REDISMODULE_OK;
 
     var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
     defer redis.RedisModule_CloseKey.?(key);
@@ -332,52 +826,262 @@ export fn CF_FIXTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModu
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_fixtoofull(t_ccf.Filter8, ctx, key) else if (keyType == t_ccf.Type16) do_fixtoofull(t_ccf.Filter16, ctx, key) else if (keyType == t_ccf.Type32) do_fixtoofull(t_ccf.Filter32, ctx, key) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_madd(CFType, ctx, key, batch);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_fixtoofull(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+inline fn do_madd(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, batch: Batch) c_int {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_MADD)) return redis.REDISMODULE_OK;
     const realCFType = @typeOf(cf.cf);
-    cuckoo.set_default_prng_state(cf.s);
-    defer {
-        cf.s = cuckoo.get_default_prng_state();
-    }
 
+    // A single replication entry for the whole batch
     _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
-    return if (cf.cf.fix_toofull())
-        redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK")
-    else |err| switch (err) {
-        error.Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
-        error.TooFull => redis.RedisModule_ReplyWithError.?(ctx, c"ERR too full"),
-    };
+    switch (batch) {
+        Batch.Items => |items| {
+            const results = pool_alloc(cuckoo.BatchResult, ctx, items.hashes.len);
+            cf.cf.add_batch(items.hashes, truncate_fps(realCFType.FPType, ctx, items.fps), results);
+            return reply_with_batch_results(ctx, results);
+        },
+        Batch.Packed => |blob| return run_packed_batch(.Add, &cf.cf, ctx, blob),
+    }
 }
 
-// CF.COUNT key
-export fn CF_COUNT(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+// CF.MCHECK key hash fp [hash fp ...]
+export fn CF_MCHECK(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    // Recorded by `do_mcheck`: threaded batches are timed until the reply.
+    const start = metrics.now();
+    const batch = parse_batch_args(ctx, argv, argc) catch return redis.REDISMODULE_OK;
 
-    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ));
     defer redis.RedisModule_CloseKey.?(key);
 
     if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_count(t_ccf.Filter8, ctx, key) else if (keyType == t_ccf.Type16) do_count(t_ccf.Filter16, ctx, key) else if (keyType == t_ccf.Type32) do_count(t_ccf.Filter32, ctx, key) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_mcheck(CFType, ctx, key, batch, start);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_count(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+inline fn do_mcheck(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, batch: Batch, start: u64) c_int {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
-    return if (cf.cf.count()) |count|
-        redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, count))
-    else |err| switch (err) {
-        error.Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
+    const realCFType = @typeOf(cf.cf);
+
+    if (batch_len(batch) >= ThreadedBatchMin and can_block(ctx) and !t_ccf.hasWaiters(cf)) return run_threaded_check(CFType, ctx, cf, batch, start, .MCheck);
+    defer metrics.record(.MCheck, start);
+
+    const items = switch (batch) {
+        Batch.Items => |parsed| parsed,
+        Batch.Packed => |blob| return run_packed_batch(.Check, &cf.cf, ctx, blob),
     };
+
+    const results = pool_alloc(cuckoo.BatchResult, ctx, items.hashes.len);
+    cf.cf.maybe_contains_batch(items.hashes, truncate_fps(realCFType.FPType, ctx, items.fps), results);
+    return reply_with_check_results(ctx, results, false);
 }
 
-// CF.ISTOOFULL key
-export fn CF_ISTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+// Replies to CF.MCHECK with an array of 1/0 or,
+// for binary batches, with a bitmap (see `run_packed_batch`).
+fn reply_with_check_results(ctx: ?*redis.RedisModuleCtx, results: []const cuckoo.BatchResult, packed: bool) c_int {
+    // Same as CF.CHECK: a broken filter can't answer negatively
+    for (results) |res| {
+        if (res == cuckoo.BatchResult.Broken) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken");
+    }
+
+    if (packed) {
+        var bitmap = pool_alloc(u8, ctx, (results.len + 7) / 8);
+        mem.set(u8, bitmap, 0);
+        for (results) |res, i| {
+            if (res == cuckoo.BatchResult.Ok) bitmap[i / 8] |= u8(1) << @intCast(u3, i % 8);
+        }
+        return redis.RedisModule_ReplyWithStringBuffer.?(ctx, bitmap.ptr, bitmap.len);
+    }
+
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, @intCast(c_long, results.len));
+    for (results) |res| {
+        _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, if (res == cuckoo.BatchResult.Ok) c"1" else c"0");
+    }
+    return redis.REDISMODULE_OK;
+}
+
+// CF.MCHECK batches with at least this many items get split over
+// the worker threads, while the client waits blocked.
+const ThreadedBatchMin = 10 * 1000;
+
+// Minimum number of items given to a single worker.
+const ThreadedPartMin = 4 * 1000;
+
+// Default number of worker threads, use the WORKERS module argument to change it.
+const DefaultWorkers = 4;
+
+fn batch_len(batch: Batch) usize {
+    return switch (batch) {
+        Batch.Items => |items| items.hashes.len,
+        Batch.Packed => |blob| blob.len / PackedRecordSize,
+    };
+}
+
+// Clients can't be blocked inside MULTI or Lua scripts.
+fn can_block(ctx: ?*redis.RedisModuleCtx) bool {
+    const flags = redis.RedisModule_GetContextFlags.?(ctx);
+    return workers.count() > 0 and (flags & (redis.REDISMODULE_CTX_FLAGS_MULTI | redis.REDISMODULE_CTX_FLAGS_LUA)) == 0;
+}
+
+// Writers don't wait on the main thread for worker threads reading
+// the filter (see `run_threaded_check`): the client is blocked instead,
+// and `rerun` (the command itself) runs again once they are done.
+// Clients that can't be blocked (MULTI, Lua, the master link) wait.
+// Returns true if the command was deferred.
+fn defer_write(ctx: ?*redis.RedisModuleCtx, cf: var, rerun: redis.RedisModuleCmdFunc) bool {
+    const flags = redis.RedisModule_GetContextFlags.?(ctx);
+    const no_block = redis.REDISMODULE_CTX_FLAGS_MULTI | redis.REDISMODULE_CTX_FLAGS_LUA | redis.REDISMODULE_CTX_FLAGS_REPLICATED | redis.REDISMODULE_CTX_FLAGS_LOADING;
+    if ((flags & no_block) == 0 and redis.RedisModule_IsBlockedReplyRequest.?(ctx) == 0) {
+        if (t_ccf.blockOnReaders(ctx, cf, rerun)) return true;
+    }
+    t_ccf.waitReaders(cf);
+    return false;
+}
+
+// Allocates a slice outside of the command's memory pool,
+// for data that has to outlive the command.
+fn heap_alloc(comptime T: type, n: usize) []align(@alignOf(usize)) T {
+    return @ptrCast([*]align(@alignOf(usize)) T, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(n * @sizeOf(T))))[0..n];
+}
+
+// A CF.MCHECK (or CF.MCHECKITEM) batch running on worker threads.
+// Owned by the blocked client, freed by `free_threaded_check`.
+const ThreadedCheck = struct {
+    bc: ?*redis.RedisModuleBlockedClient,
+    cmd: metrics.Command,
+    start: u64,
+    packed: bool,
+    pending: usize,
+    hashes: []align(@alignOf(usize)) u64,
+    fps: []align(@alignOf(usize)) u8,
+    results: []align(@alignOf(usize)) cuckoo.BatchResult,
+    parts: []align(@alignOf(usize)) u8,
+};
+
+// A slice of a threaded batch, run by a single worker.
+fn CheckPart(comptime CFType: type) type {
+    return struct {
+        task: workers.Task,
+        job: *ThreadedCheck,
+        cf: *CFType,
+        start: usize,
+        end: usize,
+
+        const Self = @This();
+
+        fn run(task: *workers.Task) void {
+            const self = @fieldParentPtr(Self, "task", task);
+            const job = self.job;
+            const fps = @bytesToSlice(@typeOf(self.cf.cf).FPType, job.fps);
+
+            // The main thread keeps updating the key's counters, count on our own.
+            var stats = cuckoo.Stats.init();
+            var stages: t_ccf.ViewStages(CFType) = undefined;
+            var cf = t_ccf.statsView(CFType, self.cf, &stats, &stages);
+            cf.maybe_contains_batch(job.hashes[self.start..self.end], fps[self.start..self.end], job.results[self.start..self.end]);
+            t_ccf.addThreadedStats(self.cf, stats);
+
+            // The last part to finish releases the filter and wakes up the client.
+            // `self` can be freed as soon as another part finishes, don't touch it after this.
+            if (@atomicRmw(usize, &job.pending, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst) == 1) {
+                t_ccf.releaseReader(self.cf);
+                _ = redis.RedisModule_UnblockClient.?(job.bc, job);
+            }
+        }
+    };
+}
+
+// Blocks the client and splits the batch over the worker threads.
+// Worker threads never write to the filter: writers wait for them to be
+// done (see `defer_write`), and `free` leaves the filter to the last of them.
+// Batches on a filter that writers are waiting for run on the main thread,
+// so that a stream of batches can't keep them waiting.
+fn run_threaded_check(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, cf: *CFType, batch: Batch, start: u64, cmd: metrics.Command) c_int {
+    const Part = CheckPart(CFType);
+    const Tfp = @typeOf(cf.cf).FPType;
+    const n = batch_len(batch);
+    const parts_count = std.math.min(workers.count(), (n + ThreadedPartMin - 1) / ThreadedPartMin);
+
+    const job = &heap_alloc(ThreadedCheck, 1)[0];
+    job.* = ThreadedCheck{
+        .bc = null,
+        .cmd = cmd,
+        .start = start,
+        .packed = false,
+        .pending = parts_count,
+        .hashes = heap_alloc(u64, n),
+        .fps = @sliceToBytes(heap_alloc(Tfp, n)),
+        .results = heap_alloc(cuckoo.BatchResult, n),
+        .parts = @sliceToBytes(heap_alloc(Part, parts_count)),
+    };
+
+    // The arguments (and the pool) go away when the command returns, copy the batch.
+    const fps = @bytesToSlice(Tfp, job.fps);
+    switch (batch) {
+        Batch.Items => |items| {
+            mem.copy(u64, job.hashes, items.hashes);
+            for (items.fps) |fp, i| fps[i] = @truncate(Tfp, fp);
+        },
+        Batch.Packed => |blob| {
+            job.packed = true;
+            var i: usize = 0;
+            while (i < n) : (i += 1) {
+                const record = blob[i * PackedRecordSize ..][0..PackedRecordSize];
+                job.hashes[i] = mem.readIntSliceLittle(u64, record[0..8]);
+                fps[i] = @truncate(Tfp, mem.readIntSliceLittle(u32, record[8..12]));
+            }
+        },
+    }
+
+    _ = @atomicRmw(usize, &cf.readers, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+    job.bc = redis.RedisModule_BlockClient.?(ctx, CF_MCHECK_reply, null, free_threaded_check, 0);
+
+    const parts = @bytesToSlice(Part, job.parts);
+    for (parts) |*part, i| {
+        part.* = Part{
+            .task = workers.Task{ .next = null, .run = Part.run },
+            .job = job,
+            .cf = cf,
+            .start = n * i / parts_count,
+            .end = n * (i + 1) / parts_count,
+        };
+    }
+    for (parts) |*part| workers.submit(&part.task);
+
+    return redis.REDISMODULE_OK;
+}
+
+export fn CF_MCHECK_reply(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const job = @ptrCast(*ThreadedCheck, @alignCast(@alignOf(ThreadedCheck), redis.RedisModule_GetBlockedClientPrivateData.?(ctx)));
+    defer metrics.record(job.cmd, job.start);
+    return reply_with_check_results(ctx, job.results, job.packed);
+}
+
+export fn free_threaded_check(ctx: ?*redis.RedisModuleCtx, privdata: ?*c_void) void {
+    const job = @ptrCast(*ThreadedCheck, @alignCast(@alignOf(ThreadedCheck), privdata));
+    redis.RedisModule_Free.?(job.hashes.ptr);
+    redis.RedisModule_Free.?(job.fps.ptr);
+    redis.RedisModule_Free.?(job.results.ptr);
+    redis.RedisModule_Free.?(job.parts.ptr);
+    redis.RedisModule_Free.?(job);
+}
+
+// CF.MREM key hash fp [hash fp ...]
+export fn CF_MREM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.MRem, start);
+
+    const batch = parse_batch_args(ctx, argv, argc) catch return redis.REDISMODULE_OK;
 
     var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
     defer redis.RedisModule_CloseKey.?(key);
@@ -386,17 +1090,54 @@ export fn CF_ISTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModul
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_istoofull(t_ccf.Filter8, ctx, key) else if (keyType == t_ccf.Type16) do_istoofull(t_ccf.Filter16, ctx, key) else if (keyType == t_ccf.Type32) do_istoofull(t_ccf.Filter32, ctx, key) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_mrem(CFType, ctx, key, batch);
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_istoofull(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+inline fn do_mrem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, batch: Batch) c_int {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
-    return redis.RedisModule_ReplyWithSimpleString.?(ctx, if (cf.cf.is_toofull()) c"1" else c"0");
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_MREM)) return redis.REDISMODULE_OK;
+    const realCFType = @typeOf(cf.cf);
+
+    // A single replication entry for the whole batch
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    switch (batch) {
+        Batch.Items => |items| {
+            const results = pool_alloc(cuckoo.BatchResult, ctx, items.hashes.len);
+            cf.cf.remove_batch(items.hashes, truncate_fps(realCFType.FPType, ctx, items.fps), results);
+            return reply_with_batch_results(ctx, results);
+        },
+        Batch.Packed => |blob| return run_packed_batch(.Rem, &cf.cf, ctx, blob),
+    }
 }
 
-// CF.ISBROKEN key
-export fn CF_ISBROKEN(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+// Replies with an array containing the outcome of each item of a write batch.
+// Each element is what the equivalent single-item command would have replied.
+fn reply_with_batch_results(ctx: ?*redis.RedisModuleCtx, results: []const cuckoo.BatchResult) c_int {
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, @intCast(c_long, results.len));
+    for (results) |res| {
+        _ = switch (res) {
+            .Ok => redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK"),
+            // Removals from windowed filters (see `reply_with_remove_error`).
+            .NotFound => redis.RedisModule_ReplyWithLongLong.?(ctx, 0),
+            .TooFull => redis.RedisModule_ReplyWithError.?(ctx, c"ERR too full"),
+            .Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
+        };
+    }
+    return redis.REDISMODULE_OK;
+}
+
+// CF.ADDITEM key item
+// The item commands hash raw items with the hash function and seed chosen
+// at CF.INIT time, the fingerprint comes from the same hash (see `hashing`).
+export fn CF_ADDITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.AddItem, start);
+
+    if (argc != 3) return redis.RedisModule_WrongArity.?(ctx);
 
     var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
     defer redis.RedisModule_CloseKey.?(key);
@@ -405,59 +1146,1759 @@ export fn CF_ISBROKEN(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModule
         return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
 
     const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
-    return if (keyType == t_ccf.Type8) do_isbroken(t_ccf.Filter8, ctx, key) else if (keyType == t_ccf.Type16) do_isbroken(t_ccf.Filter16, ctx, key) else if (keyType == t_ccf.Type32) do_isbroken(t_ccf.Filter32, ctx, key) else redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            const hash = hash_item(key_hasher(CFType, key), argv[2]);
+            return do_add(CFType, ctx, key, hash, hashing.fingerprint(hash), CF_ADDITEM);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-inline fn do_isbroken(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
-    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
-    return redis.RedisModule_ReplyWithSimpleString.?(ctx, if (cf.cf.is_broken()) c"1" else c"0");
+// CF.CHECKITEM key item
+export fn CF_CHECKITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.CheckItem, start);
+
+    if (argc != 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            const hash = hash_item(key_hasher(CFType, key), argv[2]);
+            return do_check(CFType, ctx, key, hash, hashing.fingerprint(hash));
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
 }
 
-// CF.CAPACITY size [fpsize]
-export fn CF_CAPACITY(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2 and argc != 3) return redis.RedisModule_WrongArity.?(ctx);
+// CF.REMITEM key item
+export fn CF_REMITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.RemItem, start);
 
-    // SIZE argument
-    var size_len: usize = undefined;
-    const size_str = redis.RedisModule_StringPtrLen.?(argv[1], &size_len)[0..size_len];
+    if (argc != 3) return redis.RedisModule_WrongArity.?(ctx);
 
-    // FPSIZE argument
-    var fp_size = "1"[0..];
-    if (argc == 3) {
-        var fpsize_len: usize = undefined;
-        fp_size = redis.RedisModule_StringPtrLen.?(argv[2], &fpsize_len)[0..fpsize_len];
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            const hash = hash_item(key_hasher(CFType, key), argv[2]);
+            return do_rem(CFType, ctx, key, hash, hashing.fingerprint(hash), CF_REMITEM);
+        }
     }
+    return reply_with_wrong_type(ctx, keyType);
+}
 
-    const size = str2size(size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad size");
+fn key_hasher(comptime CFType: type, key: ?*redis.RedisModuleKey) hashing.Hasher {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    return cf.hasher;
+}
 
-    if (fp_size.len != 1) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
-    return switch (fp_size[0]) {
-        '1' => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter8.capacity(size))),
-        '2' => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter16.capacity(size))),
-        '4' => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter32.capacity(size))),
-        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize"),
-    };
+fn hash_item(hasher: hashing.Hasher, arg: ?*redis.RedisModuleString) u64 {
+    var item_len: usize = undefined;
+    const item = redis.RedisModule_StringPtrLen.?(arg, &item_len)[0..item_len];
+    return hasher.digest(item);
 }
 
-// CF.SIZEFOR universe [fpsize] [EXACT]
-export fn CF_SIZEFOR(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
-    if (argc != 2 and argc != 3 and argc != 4) return redis.RedisModule_WrongArity.?(ctx);
+// Source of an item batch for the `*_batch_from` functions.
+// Items get hashed as the filter asks for them, that is while
+// the prefetches of the previous window are in flight.
+fn ItemSource(comptime Tfp: type) type {
+    return struct {
+        items: []?*redis.RedisModuleString,
+        hasher: hashing.Hasher,
 
-    // Parse universe
-    var uni_len: usize = undefined;
-    var uni_str = redis.RedisModule_StringPtrLen.?(argv[1], &uni_len);
-    const universe = std.fmt.parseInt(usize, uni_str[0..uni_len], 10) catch |err| return switch (err) {
-        error.Overflow => redis.RedisModule_ReplyWithError.?(ctx, c"ERR universe overflows usize"),
-        error.InvalidCharacter => redis.RedisModule_ReplyWithError.?(ctx, c"ERR universe contains bad character"),
+        pub fn len(self: @This()) usize {
+            return self.items.len;
+        }
+
+        pub fn get(self: @This(), i: usize) cuckoo.BatchItem(Tfp) {
+            const hash = hash_item(self.hasher, self.items[i]);
+            return cuckoo.BatchItem(Tfp){ .hash = hash, .fingerprint = @truncate(Tfp, hashing.fingerprint(hash)) };
+        }
+    };
+}
+
+fn item_source(comptime CFType: type, cf: *CFType, argv: [*c]?*redis.RedisModuleString, argc: c_int) ItemSource(@typeOf(cf.cf).FPType) {
+    return ItemSource(@typeOf(cf.cf).FPType){ .items = argv[2..@intCast(usize, argc)], .hasher = cf.hasher };
+}
+
+// CF.MADDITEM key item [item ...]
+export fn CF_MADDITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.MAddItem, start);
+
+    if (argc < 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_madditem(CFType, ctx, key, argv, argc);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_madditem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_MADDITEM)) return redis.REDISMODULE_OK;
+
+    // A single replication entry for the whole batch
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    const source = item_source(CFType, cf, argv, argc);
+    const results = pool_alloc(cuckoo.BatchResult, ctx, source.len());
+    cf.cf.add_batch_from(source, results);
+    return reply_with_batch_results(ctx, results);
+}
+
+// CF.MCHECKITEM key item [item ...]
+export fn CF_MCHECKITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    // Recorded by `do_mcheckitem`, same as CF.MCHECK.
+    const start = metrics.now();
+    if (argc < 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_mcheckitem(CFType, ctx, key, argv, argc, start);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_mcheckitem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, argv: [*c]?*redis.RedisModuleString, argc: c_int, start: u64) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    const source = item_source(CFType, cf, argv, argc);
+
+    // Big batches get hashed here, the lookups run on the worker threads.
+    if (source.len() >= ThreadedBatchMin and can_block(ctx) and !t_ccf.hasWaiters(cf)) {
+        const items = BatchItems{
+            .hashes = pool_alloc(u64, ctx, source.len()),
+            .fps = pool_alloc(u32, ctx, source.len()),
+        };
+        for (items.hashes) |*hash, i| {
+            hash.* = hash_item(cf.hasher, source.items[i]);
+            items.fps[i] = hashing.fingerprint(hash.*);
+        }
+        return run_threaded_check(CFType, ctx, cf, Batch{ .Items = items }, start, .MCheckItem);
+    }
+    defer metrics.record(.MCheckItem, start);
+
+    const results = pool_alloc(cuckoo.BatchResult, ctx, source.len());
+    cf.cf.maybe_contains_batch_from(source, results);
+    return reply_with_check_results(ctx, results, false);
+}
+
+// CF.MREMITEM key item [item ...]
+export fn CF_MREMITEM(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const start = metrics.now();
+    defer metrics.record(.MRemItem, start);
+
+    if (argc < 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_mremitem(CFType, ctx, key, argv, argc);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_mremitem(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_MREMITEM)) return redis.REDISMODULE_OK;
+
+    // A single replication entry for the whole batch
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    const source = item_source(CFType, cf, argv, argc);
+    const results = pool_alloc(cuckoo.BatchResult, ctx, source.len());
+    cf.cf.remove_batch_from(source, results);
+    return reply_with_batch_results(ctx, results);
+}
+
+// CF.FIXTOOFULL key
+export fn CF_FIXTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_fixtoofull(CFType, ctx, key);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_fixtoofull(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_FIXTOOFULL)) return redis.REDISMODULE_OK;
+    const realCFType = @typeOf(cf.cf);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return if (cf.cf.fix_toofull())
+        redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK")
+    else |err| switch (err) {
+        error.Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
+        error.TooFull => redis.RedisModule_ReplyWithError.?(ctx, c"ERR too full"),
+    };
+}
+
+// CF.ROTATE key [EXPIRE n at | SWAP]
+// Expires the oldest live generation of a windowed filter right away, and
+// starts a new interval. The spare generation becomes the current one as
+// soon as it's zeroed, which the window timer does within half an interval
+// from the previous swap. It never gets zeroed here.
+// The other two forms are how the window timer reaches replicas and the
+// AOF: EXPIRE expires `n` generations and moves the start of the interval
+// to `at`, SWAP makes the spare the current generation.
+export fn CF_ROTATE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2 and argc != 3 and argc != 5) return redis.RedisModule_WrongArity.?(ctx);
+
+    var rotation = Rotation.Now;
+    var n: u64 = 1;
+    var at: u64 = 0;
+    if (argc > 2) {
+        var arg_len: usize = undefined;
+        const arg = redis.RedisModule_StringPtrLen.?(argv[2], &arg_len)[0..arg_len];
+        if (argc == 5 and insensitive_eql("EXPIRE", arg)) {
+            const expire_n = parse_longlong(argv[3]) catch -1;
+            const expire_at = parse_longlong(argv[4]) catch -1;
+            if (expire_n < 0 or expire_at < 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad rotation");
+            rotation = Rotation.Expire;
+            n = @intCast(u64, expire_n);
+            at = @intCast(u64, expire_at);
+        } else if (argc == 3 and insensitive_eql("SWAP", arg)) {
+            rotation = Rotation.Swap;
+        } else {
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR syntax error");
+        }
+    }
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            if (comptime !t_ccf.isScalable(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, NotWindowedError);
+            return do_rotate(CFType, ctx, key, argv[1], rotation, n, at);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+const NotWindowedError = c"ERR not a windowed filter";
+
+// The forms of CF.ROTATE.
+const Rotation = enum {
+    Now,
+    Expire,
+    Swap,
+};
+
+inline fn do_rotate(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString, rotation: Rotation, n: u64, at: u64) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (cf.cf.window == null) return redis.RedisModule_ReplyWithError.?(ctx, NotWindowedError);
+    if (defer_write(ctx, cf, CF_ROTATE)) return redis.REDISMODULE_OK;
+    const window = &cf.cf.window.?;
+    switch (rotation) {
+        .Now => {
+            window.expire(1, cf.cf.stages.len);
+            window.rotated_at = @intCast(u64, redis.RedisModule_Milliseconds.?());
+            replicate_expire(ctx, name, 1, window.rotated_at);
+            if (cf.cf.can_swap()) {
+                cf.cf.swap();
+                replicate_swap(ctx, name);
+            }
+        },
+        .Expire => {
+            window.expire(n, cf.cf.stages.len);
+            window.rotated_at = at;
+            _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+        },
+        .Swap => {
+            if (window.expired == 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR no expired generation");
+
+            // Replicas and the AOF have to follow the master, even if
+            // their own timer didn't zero the whole spare yet.
+            if (!cf.cf.can_swap()) {
+                const flags = redis.RedisModule_GetContextFlags.?(ctx);
+                if ((flags & (redis.REDISMODULE_CTX_FLAGS_REPLICATED | redis.REDISMODULE_CTX_FLAGS_LOADING)) == 0)
+                    return redis.RedisModule_ReplyWithError.?(ctx, c"ERR spare generation not zeroed yet");
+                cf.cf.clear(std.math.maxInt(usize));
+            }
+            cf.cf.swap();
+            _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+        },
+    }
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+fn replicate_expire(ctx: ?*redis.RedisModuleCtx, name: ?*redis.RedisModuleString, n: u64, at: u64) void {
+    _ = redis.RedisModule_Replicate.?(ctx, c"cf.rotate", c"scll", name, c"EXPIRE", @intCast(c_longlong, n), @intCast(c_longlong, at));
+}
+
+fn replicate_swap(ctx: ?*redis.RedisModuleCtx, name: ?*redis.RedisModuleString) void {
+    _ = redis.RedisModule_Replicate.?(ctx, c"cf.rotate", c"sc", name, c"SWAP");
+}
+
+// Milliseconds between two runs of the window timer.
+const WindowTimerPeriod = 100;
+
+// Moves the windows of all the windowed filters (see `t_ccf.Window`):
+// zeroes a slice of the spare generations, expires the generations whose
+// interval has passed and swaps in the spare once it's ready. Only masters
+// expire and swap, replicating what they did as CF.ROTATE, so replicas and
+// the AOF never move a window on their own clock. Nothing moves while
+// loading. Filters are found through `t_ccf.window_keys`.
+export fn window_tick(ctx: ?*redis.RedisModuleCtx, data: ?*c_void) void {
+    defer _ = redis.RedisModule_CreateTimer.?(ctx, WindowTimerPeriod, window_tick, null);
+
+    const flags = redis.RedisModule_GetContextFlags.?(ctx);
+    if ((flags & redis.REDISMODULE_CTX_FLAGS_LOADING) != 0) return;
+    const master = (flags & redis.REDISMODULE_CTX_FLAGS_SLAVE) == 0;
+    const now = @intCast(u64, redis.RedisModule_Milliseconds.?());
+
+    // Keys loaded from RDB, moved, or gone: look for them in every
+    // database. New locations go at the front of the list.
+    var search = t_ccf.window_keys;
+    while (search) |wk| : (search = wk.next) {
+        if (wk.db == t_ccf.UnknownDb) find_window_key(ctx, wk);
+    }
+
+    var it = &t_ccf.window_keys;
+    while (it.*) |wk| {
+        if (wk.db == t_ccf.UnknownDb) {
+            it.* = wk.next;
+            if (t_ccf.window_clear_next == wk) t_ccf.window_clear_next = wk.next;
+            t_ccf.freeWindowKey(wk);
+            continue;
+        }
+        it = &wk.next;
+    }
+
+    // All the filters share the zeroing budget, going round
+    // from the first one that ran short last time.
+    var budget: usize = t_ccf.WINDOW_CLEAR_MAX;
+    const first = t_ccf.window_clear_next orelse t_ccf.window_keys orelse return;
+    t_ccf.window_clear_next = null;
+    var wk = first;
+    while (true) {
+        _ = redis.RedisModule_SelectDb.?(ctx, wk.db);
+        var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, wk.name, redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+        switch (tick_window(ctx, key, wk.name, master, now, &budget)) {
+            .Gone => wk.db = t_ccf.UnknownDb,
+            .Done => {},
+            .Short => {
+                if (t_ccf.window_clear_next == null) t_ccf.window_clear_next = wk;
+            },
+        }
+        redis.RedisModule_CloseKey.?(key);
+        wk = wk.next orelse t_ccf.window_keys.?;
+        if (wk == first) break;
+    }
+}
+
+// Points `wk` to the first database where its name holds a windowed
+// filter that isn't tracked yet, adding locations for the others, if any.
+fn find_window_key(ctx: ?*redis.RedisModuleCtx, wk: *t_ccf.WindowKey) void {
+    var db: c_int = 0;
+    while (redis.RedisModule_SelectDb.?(ctx, db) == redis.REDISMODULE_OK) : (db += 1) {
+        if (t_ccf.hasWindowKey(db, wk.name)) continue;
+        var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, wk.name, redis.REDISMODULE_READ));
+        defer redis.RedisModule_CloseKey.?(key);
+        if (!is_windowed(key)) continue;
+        if (wk.db == t_ccf.UnknownDb) wk.db = db else t_ccf.addWindowKey(db, wk.name);
+    }
+}
+
+fn is_windowed(key: ?*redis.RedisModuleKey) bool {
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime t_ccf.isScalable(CFType)) {
+            if (keyType == t_ccf.moduleType(CFType)) {
+                const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+                return cf.cf.window != null;
+            }
+        }
+    }
+    return false;
+}
+
+// What a run of the window timer did with a key.
+const WindowTick = enum {
+    // The key doesn't hold a windowed filter (anymore).
+    Gone,
+    Done,
+    // The spare got less zeroing than it needed, `budget` ran out.
+    Short,
+};
+
+// Zeroes the spare out of `budget`, then expires and swaps (on masters).
+fn tick_window(ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString, master: bool, now: u64, budget: *usize) WindowTick {
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime t_ccf.isScalable(CFType)) {
+            if (keyType == t_ccf.moduleType(CFType)) {
+                const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+                if (cf.cf.window == null) return .Gone;
+                const window = &cf.cf.window.?;
+                const stage_bytes = cf.cf.stage_bytes();
+                const need = std.math.min(window.clear_budget(stage_bytes, WindowTimerPeriod), stage_bytes - window.cleared);
+                const given = std.math.min(need, budget.*);
+                cf.cf.clear(given);
+                budget.* -= given;
+                const result = if (given < need) WindowTick.Short else WindowTick.Done;
+
+                // Expiring and swapping change what readers probe: when worker
+                // threads are reading the filter, they wait for the next run.
+                if (!master or @atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) != 0) return result;
+
+                const due = window.expire_due(now, cf.cf.stages.len);
+                if (due > 0) replicate_expire(ctx, name, due, window.rotated_at);
+                if (cf.cf.can_swap()) {
+                    cf.cf.swap();
+                    replicate_swap(ctx, name);
+                }
+                return result;
+            }
+        }
+    }
+    return .Gone;
+}
+
+// Keys that get a windowed filter from another key, or from a dump. The
+// event is notified in the database the key ended up in. The keys left
+// behind, and the ones SWAPDB moves (it doesn't notify keyspace events),
+// are found by the window timer once they are gone from their database.
+const WindowKeyEvents = [_][*]const u8{ c"rename_to", c"move_to", c"copy_to", c"restore" };
+
+// Keeps track of windowed filters changing key or database.
+export fn window_key_event(ctx: ?*redis.RedisModuleCtx, event_type: c_int, event: [*c]const u8, name: ?*redis.RedisModuleString) c_int {
+    for (WindowKeyEvents) |e| {
+        if (std.cstr.cmp(event, e) == 0) break;
+    } else return redis.REDISMODULE_OK;
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, name, redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(key);
+    if (is_windowed(key)) t_ccf.addWindowKey(redis.RedisModule_GetSelectedDb.?(ctx), name);
+    return redis.REDISMODULE_OK;
+}
+
+// CF.COUNT key
+export fn CF_COUNT(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_count(CFType, ctx, key);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_count(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    return if (cf.cf.count()) |count|
+        redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, count))
+    else |err| switch (err) {
+        error.Broken => redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken"),
+    };
+}
+
+// CF.ISTOOFULL key
+export fn CF_ISTOOFULL(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_istoofull(CFType, ctx, key);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_istoofull(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, if (cf.cf.is_toofull()) c"1" else c"0");
+}
+
+// CF.ISBROKEN key
+export fn CF_ISBROKEN(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_isbroken(CFType, ctx, key);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_isbroken(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, if (cf.cf.is_broken()) c"1" else c"0");
+}
+
+// CF.INFO key
+export fn CF_INFO(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2) return redis.RedisModule_WrongArity.?(ctx);
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_info(CFType, ctx, key, argv[1]);
+    }
+    inline for (t_ccf.FrozenFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_info_frozen(CFType, ctx, key);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+// Replies with a flat array of field names and values. Sizes are summed
+// over all the stages of scalable filters, `count` is the raw number of
+// fingerprints and is reported even when the filter is broken.
+// `merge_progress` is the fraction of source buckets already merged by
+// a running CF.MERGE into this key, `freezing` is set while CF.FREEZE
+// builds its frozen version.
+inline fn do_info(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    const stages = if (comptime t_ccf.isScalable(CFType)) cf.cf.stages else @ptrCast(*[1]@typeOf(cf.cf), &cf.cf)[0..];
+    const stageCFType = @typeOf(stages[0]);
+
+    var size: usize = 0;
+    var memory: usize = 0;
+    var capacity: usize = 0;
+    var count: usize = 0;
+    for (stages) |*stage| {
+        size += stage.nominal_size();
+        memory += @sliceToBytes(stage.buckets).len;
+        capacity += stageCFType.capacity(stage.nominal_size());
+        count += stage.fpcount;
+    }
+    const stats = t_ccf.totalStats(cf);
+    const hits = stats.primary_hits + stats.alt_hits + stats.homeless_hits;
+    const merge = find_merge(redis.RedisModule_GetSelectedDb.?(ctx), name);
+
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, 54);
+    reply_info_string(ctx, c"type", if (comptime !t_ccf.isScalable(CFType)) c"plain" else if (cf.cf.window != null) c"windowed" else c"scalable");
+    reply_info_string(ctx, c"encoding", if (stageCFType.IsSemiSorted) c"semisorted" else c"plain");
+    reply_info_string(ctx, c"hash", t_ccf.hashArg(cf.hasher.kind));
+    // Same as the SEED option: seeds past the i64 range come out negative
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, c"seed");
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @bitCast(c_longlong, cf.hasher.seed));
+    reply_info_string(ctx, c"insertion", t_ccf.insertionArg(t_ccf.filterOptions(cf).insertion));
+    reply_info_string(ctx, c"locality", t_ccf.localityArg(t_ccf.filterOptions(cf).locality));
+    reply_info_int(ctx, c"fpbits", stageCFType.FPType.bit_count);
+    reply_info_int(ctx, c"size", size);
+    reply_info_int(ctx, c"memory", memory);
+    reply_info_int(ctx, c"capacity", capacity);
+    reply_info_int(ctx, c"count", count);
+    reply_info_double(ctx, c"load_factor", @intToFloat(f64, count) / @intToFloat(f64, capacity));
+    reply_info_int(ctx, c"stages", stages.len);
+    reply_info_int(ctx, c"toofull", @boolToInt(cf.cf.is_toofull()));
+    reply_info_int(ctx, c"broken", @boolToInt(cf.cf.is_broken()));
+
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, c"kicks");
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, cuckoo.KickHistogramLen);
+    for (stats.kicks) |n| _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, n));
+
+    reply_info_int(ctx, c"evictions", stats.evictions);
+    reply_info_int(ctx, c"homeless", stats.homeless);
+    reply_info_int(ctx, c"rejected", stats.rejected);
+    reply_info_int(ctx, c"primary_hits", stats.primary_hits);
+    reply_info_int(ctx, c"alt_hits", stats.alt_hits);
+    reply_info_int(ctx, c"homeless_hits", stats.homeless_hits);
+    reply_info_int(ctx, c"misses", stats.misses);
+    reply_info_double(ctx, c"primary_hit_ratio", if (hits == 0) f64(0) else @intToFloat(f64, stats.primary_hits) / @intToFloat(f64, hits));
+    reply_info_int(ctx, c"merging", @boolToInt(merge != null));
+    reply_info_double(ctx, c"merge_progress", if (merge) |job| @intToFloat(f64, job.done) / @intToFloat(f64, job.total) else f64(0));
+    reply_info_int(ctx, c"freezing", @boolToInt(t_ccf.isFreezing(cf)));
+    return redis.REDISMODULE_OK;
+}
+
+// Frozen filters have no counters and nothing left to fill: only their
+// encoding, the fingerprint sizes and how much memory they take.
+inline fn do_info_frozen(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    const frozenCFType = @typeOf(cf.cf);
+    const memory = cf.cf.xor.fingerprints.len;
+    const count = cf.cf.fpcount;
+
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, 20);
+    reply_info_string(ctx, c"type", c"frozen");
+    reply_info_string(ctx, c"encoding", if (frozenCFType.IsSemiSorted) c"semisorted" else c"plain");
+    reply_info_string(ctx, c"hash", t_ccf.hashArg(cf.hasher.kind));
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, c"seed");
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @bitCast(c_longlong, cf.hasher.seed));
+    reply_info_string(ctx, c"locality", t_ccf.localityArg(cf.cf.shape.locality));
+    reply_info_int(ctx, c"fpbits", frozenCFType.FPType.bit_count);
+    reply_info_int(ctx, c"xorbits", frozenCFType.XorBits);
+    reply_info_int(ctx, c"memory", memory);
+    reply_info_int(ctx, c"count", count);
+    reply_info_double(ctx, c"bits_per_item", if (count == 0) f64(0) else @intToFloat(f64, memory * 8) / @intToFloat(f64, count));
+    return redis.REDISMODULE_OK;
+}
+
+fn reply_info_int(ctx: ?*redis.RedisModuleCtx, name: [*c]const u8, value: u64) void {
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, name);
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, value));
+}
+
+fn reply_info_double(ctx: ?*redis.RedisModuleCtx, name: [*c]const u8, value: f64) void {
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, name);
+    _ = redis.RedisModule_ReplyWithDouble.?(ctx, value);
+}
+
+fn reply_info_string(ctx: ?*redis.RedisModuleCtx, name: [*c]const u8, value: [*c]const u8) void {
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, name);
+    _ = redis.RedisModule_ReplyWithSimpleString.?(ctx, value);
+}
+
+// Filter state carried by CF.LOADHEADER.
+const FilterHeader = struct {
+    size: usize,
+    s: [2]u64,
+    homeless_fp: u64,
+    homeless_bucket_idx: usize,
+    fpcount: usize,
+    broken: bool,
+};
+
+// Parses an integer argument.
+fn parse_longlong(arg: ?*redis.RedisModuleString) !c_longlong {
+    var val: c_longlong = undefined;
+    if (redis.RedisModule_StringToLongLong.?(arg, &val) == redis.REDISMODULE_ERR) return error.Error;
+    return val;
+}
+
+// Parses a broken flag of CF.LOADHEADER and CF.LOADSTAGE, 0 or 1.
+fn parse_broken(arg: ?*redis.RedisModuleString) !bool {
+    const broken = try parse_longlong(arg);
+    if (broken != 0 and broken != 1) return error.Error;
+    return broken == 1;
+}
+
+// Parses the numeric arguments shared by CF.LOADHEADER and CF.LOADSTAGE:
+// size homeless_fp homeless_bucket_idx fpcount.
+fn parse_stage_header(args: [4]?*redis.RedisModuleString, header: *FilterHeader) !void {
+    var nums: [4]c_longlong = undefined;
+    for (nums) |*num, i| {
+        num.* = try parse_longlong(args[i]);
+        if (num.* < 0) return error.Error;
+    }
+
+    header.size = @intCast(usize, nums[0]);
+    header.homeless_fp = @intCast(u64, nums[1]);
+    header.homeless_bucket_idx = @intCast(usize, nums[2]);
+    header.fpcount = @intCast(usize, nums[3]);
+
+    // Same limit as CF.INIT
+    if (header.size > t_ccf.MAX_SIZE) return error.Error;
+}
+
+// CF.LOADHEADER key fpsize size s0 s1 homeless_fp homeless_bucket_idx fpcount broken [GROWTH n] [ENCODING e] [HASH h] [SEED n]
+//                [INSERTION i] [LOCALITY l] [BROKEN b]
+// Creates a filter from its raw state, with empty buckets.
+// Bucket memory is then filled in by CF.LOADCHUNK.
+// With GROWTH, creates a scalable filter whose first stage has the given state,
+// BROKEN 1 then marks the scalable filter itself as broken.
+// Used by AOF rewrites, and to move filters between instances.
+export fn CF_LOADHEADER(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc < 10 or argc > 24 or @rem(argc, 2) != 0) return redis.RedisModule_WrongArity.?(ctx);
+
+    // fpsize argument
+    var fp_size_len: usize = undefined;
+    const fp_size_str = redis.RedisModule_StringPtrLen.?(argv[2], &fp_size_len)[0..fp_size_len];
+    const fp_size = parse_fpsize(fp_size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
+
+    var header: FilterHeader = undefined;
+    parse_stage_header([4]?*redis.RedisModuleString{ argv[3], argv[6], argv[7], argv[8] }, &header) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    // Hashes and PRNG state can use all 64 bits
+    const s0 = parse_longlong(argv[4]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    const s1 = parse_longlong(argv[5]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    header.s = [2]u64{ @bitCast(u64, s0), @bitCast(u64, s1) };
+    header.broken = parse_broken(argv[9]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+
+    var growth: ?usize = null;
+    var scalable_broken = false;
+    var encoding = Encoding.Plain;
+    var hasher = hashing.Hasher.Default;
+    var options = t_ccf.Options.Default;
+    var i: usize = 10;
+    while (i < @intCast(usize, argc)) : (i += 2) {
+        var opt_len: usize = undefined;
+        const opt = redis.RedisModule_StringPtrLen.?(argv[i], &opt_len)[0..opt_len];
+        if (insensitive_eql("GROWTH", opt)) {
+            growth = parse_growth(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad growth");
+        } else if (insensitive_eql("ENCODING", opt)) {
+            encoding = parse_encoding(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad encoding");
+        } else if (insensitive_eql("HASH", opt)) {
+            hasher.kind = parse_hash(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad hash");
+        } else if (insensitive_eql("SEED", opt)) {
+            hasher.seed = parse_seed(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad seed");
+        } else if (insensitive_eql("INSERTION", opt)) {
+            options.insertion = parse_insertion(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad insertion");
+        } else if (insensitive_eql("LOCALITY", opt)) {
+            options.locality = parse_locality(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad locality");
+        } else if (insensitive_eql("BROKEN", opt)) {
+            scalable_broken = parse_broken(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+        } else {
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR syntax error");
+        }
+    }
+    if (scalable_broken and growth == null) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR BROKEN needs GROWTH");
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    var keyType = redis.RedisModule_KeyType.?(key);
+    if (keyType != redis.REDISMODULE_KEYTYPE_EMPTY) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key already exists");
+
+    if (encoding == Encoding.SemiSorted) {
+        if (growth) |g| return switch (fp_size) {
+            .Bits8 => do_loadheader_scalable(t_ccf.ScalableSemiSortedFilter9, ctx, key, header, g, scalable_broken, hasher, options),
+            .Bits12 => do_loadheader_scalable(t_ccf.ScalableSemiSortedFilter13, ctx, key, header, g, scalable_broken, hasher, options),
+            .Bits16 => do_loadheader_scalable(t_ccf.ScalableSemiSortedFilter17, ctx, key, header, g, scalable_broken, hasher, options),
+            else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+        };
+        return switch (fp_size) {
+            .Bits8 => do_loadheader(t_ccf.SemiSortedFilter9, ctx, key, header, hasher, options),
+            .Bits12 => do_loadheader(t_ccf.SemiSortedFilter13, ctx, key, header, hasher, options),
+            .Bits16 => do_loadheader(t_ccf.SemiSortedFilter17, ctx, key, header, hasher, options),
+            else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+        };
+    }
+    if (growth) |g| return switch (fp_size) {
+        .Bits6 => do_loadheader_scalable(t_ccf.ScalableFilter6, ctx, key, header, g, scalable_broken, hasher, options),
+        .Bits8 => do_loadheader_scalable(t_ccf.ScalableFilter8, ctx, key, header, g, scalable_broken, hasher, options),
+        .Bits12 => do_loadheader_scalable(t_ccf.ScalableFilter12, ctx, key, header, g, scalable_broken, hasher, options),
+        .Bits16 => do_loadheader_scalable(t_ccf.ScalableFilter16, ctx, key, header, g, scalable_broken, hasher, options),
+        .Bits32 => do_loadheader_scalable(t_ccf.ScalableFilter32, ctx, key, header, g, scalable_broken, hasher, options),
+    };
+    return switch (fp_size) {
+        .Bits6 => do_loadheader(t_ccf.Filter6, ctx, key, header, hasher, options),
+        .Bits8 => do_loadheader(t_ccf.Filter8, ctx, key, header, hasher, options),
+        .Bits12 => do_loadheader(t_ccf.Filter12, ctx, key, header, hasher, options),
+        .Bits16 => do_loadheader(t_ccf.Filter16, ctx, key, header, hasher, options),
+        .Bits32 => do_loadheader(t_ccf.Filter32, ctx, key, header, hasher, options),
+    };
+}
+
+// Creates a filter with empty buckets and applies the header to it.
+fn filter_from_header(comptime realCFType: type, header: FilterHeader, storage: t_ccf.Storage) !realCFType {
+    var cf = try t_ccf.allocFilter(realCFType, header.size, storage);
+
+    const homeless_fp_ok = header.homeless_fp <= std.math.maxInt(realCFType.FPType);
+    const homeless_idx_ok = header.homeless_fp == 0 or header.homeless_bucket_idx < cf.buckets.len;
+    if (!homeless_fp_ok or !homeless_idx_ok) {
+        t_ccf.freeBuckets(@sliceToBytes(cf.buckets), storage);
+        return error.BadHeader;
+    }
+
+    cf.homeless_fp = @intCast(realCFType.FPType, header.homeless_fp);
+    cf.homeless_bucket_idx = header.homeless_bucket_idx;
+    cf.fpcount = header.fpcount;
+    cf.broken = header.broken;
+    cf.prng_state = header.s;
+    return cf;
+}
+
+inline fn do_loadheader(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, header: FilterHeader, hasher: hashing.Hasher, options: t_ccf.Options) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+
+    cf.hasher = hasher;
+    cf.readers = 0;
+    cf.storage = t_ccf.default_storage;
+    cf.cf = filter_from_header(@typeOf(cf.cf), header, cf.storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    t_ccf.applyOptions(cf, options);
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+inline fn do_loadheader_scalable(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, header: FilterHeader, growth: usize, broken: bool, hasher: hashing.Hasher, options: t_ccf.Options) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const scalableCFType = @typeOf(cf.cf);
+    const stageCFType = @typeOf(cf.cf.stages[0]);
+
+    const first = filter_from_header(stageCFType, header, t_ccf.default_storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+
+    cf.hasher = hasher;
+    cf.readers = 0;
+    cf.cf = scalableCFType{
+        .stages = @ptrCast([*]stageCFType, @alignCast(@alignOf(stageCFType), redis.RedisModule_Alloc.?(@sizeOf(stageCFType))))[0..1],
+        .growth = growth,
+        .broken = broken,
+        .storage = t_ccf.default_storage,
+        .stats = null,
+        .window = null,
+    };
+    cf.cf.stages[0] = first;
+    t_ccf.applyOptions(cf, options);
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// CF.LOADSTAGE key size homeless_fp homeless_bucket_idx fpcount [broken]
+// Pushes a new stage, with empty buckets, on top of a scalable filter.
+// Bucket memory is then filled in by CF.LOADCHUNK.
+export fn CF_LOADSTAGE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 6 and argc != 7) return redis.RedisModule_WrongArity.?(ctx);
+
+    var header: FilterHeader = undefined;
+    parse_stage_header([4]?*redis.RedisModuleString{ argv[2], argv[3], argv[4], argv[5] }, &header) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    header.broken = false;
+    if (argc == 7) header.broken = parse_broken(argv[6]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime t_ccf.isScalable(CFType)) {
+            if (keyType == t_ccf.moduleType(CFType)) return do_loadstage(CFType, ctx, key, header);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_loadstage(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, header: FilterHeader) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (cf.cf.window != null) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR windowed filters can't grow");
+    if (defer_write(ctx, cf, CF_LOADSTAGE)) return redis.REDISMODULE_OK;
+    const stage = filter_from_header(@typeOf(cf.cf.stages[0]), header, cf.cf.storage) catch |err| return reply_with_create_error(ctx, err);
+    cf.cf.push_stage(stage) catch {
+        t_ccf.freeBuckets(@sliceToBytes(stage.buckets), cf.cf.storage);
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR too many stages");
+    };
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// CF.LOADCHUNK key offset bytes
+// Copies `bytes` in the bucket memory of a filter, starting at `offset`.
+// Scalable filters receive the chunk in their newest stage, frozen
+// filters in their fingerprint memory.
+export fn CF_LOADCHUNK(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 4) return redis.RedisModule_WrongArity.?(ctx);
+
+    const offset = parse_longlong(argv[2]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad offset");
+    if (offset < 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad offset");
+
+    var chunk_len: usize = undefined;
+    const chunk = redis.RedisModule_StringPtrLen.?(argv[3], &chunk_len)[0..chunk_len];
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.AllFilters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) return do_loadchunk(CFType, ctx, key, @intCast(usize, offset), chunk);
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_loadchunk(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, offset: usize, chunk: []const u8) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    if (defer_write(ctx, cf, CF_LOADCHUNK)) return redis.REDISMODULE_OK;
+    const target = if (comptime t_ccf.isScalable(CFType)) cf.cf.newest() else &cf.cf;
+    target.apply_delta(offset, chunk) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR chunk out of bounds");
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// CF.LOADWINDOW key interval current rotated_at cleared [expired]
+// Turns a scalable filter loaded by CF.LOADHEADER and CF.LOADSTAGE into
+// a windowed one (see `t_ccf.Window`). The interval is in milliseconds.
+export fn CF_LOADWINDOW(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 6 and argc != 7) return redis.RedisModule_WrongArity.?(ctx);
+
+    var args = []u64{0} ** 5;
+    for (args[0..@intCast(usize, argc) - 2]) |*arg, i| {
+        const n = parse_longlong(argv[i + 2]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad window");
+        if (n < 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad window");
+        arg.* = @intCast(u64, n);
+    }
+    const window = t_ccf.Window{
+        .interval = args[0],
+        .current = @intCast(usize, args[1]),
+        .rotated_at = args[2],
+        .cleared = @intCast(usize, args[3]),
+        .expired = @intCast(usize, args[4]),
+    };
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime t_ccf.isScalable(CFType)) {
+            if (keyType == t_ccf.moduleType(CFType)) return do_loadwindow(CFType, ctx, key, argv[1], window);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_loadwindow(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString, window: t_ccf.Window) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    cf.cf.check_window(window) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad window");
+    if (defer_write(ctx, cf, CF_LOADWINDOW)) return redis.REDISMODULE_OK;
+    cf.cf.window = window;
+    t_ccf.addWindowKey(redis.RedisModule_GetSelectedDb.?(ctx), name);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// CF.LOADIMAGE key image [HASH h] [SEED n]
+// Creates a filter from an image built by the Zig library (see
+// `cuckoo.ImageHeader`): a header with the filter's state followed
+// by its bucket memory, adopted as is.
+// A whole image has to fit in a single argument (proto-max-bulk-len,
+// 512MB by default), bigger filters can be loaded with CF.LOADHEADER
+// and CF.LOADCHUNK instead.
+export fn CF_LOADIMAGE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc < 3 or argc > 7 or @rem(argc, 2) != 1) return redis.RedisModule_WrongArity.?(ctx);
+
+    var image_len: usize = undefined;
+    const image = redis.RedisModule_StringPtrLen.?(argv[2], &image_len)[0..image_len];
+    const header = cuckoo.ImageHeader.parse(image) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad image");
+    if (image.len - cuckoo.ImageHeaderSize != header.bucket_bytes) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad image");
+
+    var hasher = hashing.Hasher.Default;
+    var i: usize = 3;
+    while (i < @intCast(usize, argc)) : (i += 2) {
+        var opt_len: usize = undefined;
+        const opt = redis.RedisModule_StringPtrLen.?(argv[i], &opt_len)[0..opt_len];
+        if (insensitive_eql("HASH", opt)) {
+            hasher.kind = parse_hash(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad hash");
+        } else if (insensitive_eql("SEED", opt)) {
+            hasher.seed = parse_seed(argv[i + 1]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad seed");
+        } else {
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR syntax error");
+        }
+    }
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    var keyType = redis.RedisModule_KeyType.?(key);
+    if (keyType != redis.REDISMODULE_KEYTYPE_EMPTY) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key already exists");
+
+    const buckets = image[cuckoo.ImageHeaderSize..];
+    if (header.semi_sorted) return switch (header.fp_bits) {
+        9 => do_loadimage(t_ccf.SemiSortedFilter9, ctx, key, header, buckets, hasher),
+        13 => do_loadimage(t_ccf.SemiSortedFilter13, ctx, key, header, buckets, hasher),
+        17 => do_loadimage(t_ccf.SemiSortedFilter17, ctx, key, header, buckets, hasher),
+        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad image"),
+    };
+    return switch (header.fp_bits) {
+        6 => do_loadimage(t_ccf.Filter6, ctx, key, header, buckets, hasher),
+        8 => do_loadimage(t_ccf.Filter8, ctx, key, header, buckets, hasher),
+        12 => do_loadimage(t_ccf.Filter12, ctx, key, header, buckets, hasher),
+        16 => do_loadimage(t_ccf.Filter16, ctx, key, header, buckets, hasher),
+        32 => do_loadimage(t_ccf.Filter32, ctx, key, header, buckets, hasher),
+        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad image"),
+    };
+}
+
+inline fn do_loadimage(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, header: cuckoo.ImageHeader, buckets: []const u8, hasher: hashing.Hasher) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const realCFType = @typeOf(cf.cf);
+
+    cf.hasher = hasher;
+    cf.readers = 0;
+    cf.storage = t_ccf.default_storage;
+
+    // Arguments carry no alignment guarantees, the buckets get copied.
+    const memory = t_ccf.allocBuckets(buckets.len, cf.storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    mem.copy(u8, memory, buckets);
+    cf.cf = realCFType.init_zeroed(memory) catch |err| {
+        t_ccf.freeBuckets(memory, cf.storage);
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    cf.cf.apply_image_header(header) catch {
+        t_ccf.freeBuckets(memory, cf.storage);
+        redis.RedisModule_Free.?(cf);
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad image");
+    };
+    t_ccf.initStats(cf);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// Merges bigger than this many buckets (in total over all sources) run in
+// slices of this many buckets, with the client blocked until they are done.
+const MergeSliceBuckets = 64 * 1024;
+
+// Milliseconds between two slices of a merge.
+const MergeSlicePeriod = 1;
+
+// A big CF.MERGE, merged one slice per timer tick on the main thread.
+// The keys are looked up again at every tick, so the merge never holds
+// pointers to a filter while other commands run.
+// Owned by the blocked client, freed by `free_merge`.
+const MergeJob = struct {
+    next: ?*MergeJob,
+    bc: ?*redis.RedisModuleBlockedClient,
+    db: c_int,
+    keyType: ?*redis.RedisModuleType,
+    // Destination first, then the sources.
+    keys: []align(@alignOf(usize)) ?*redis.RedisModuleString,
+    src: usize,
+    bucket: usize,
+    done: usize,
+    total: usize,
+    err: [*c]const u8,
+};
+
+// Merges in progress, for CF.INFO.
+var merges: ?*MergeJob = null;
+
+fn find_merge(db: c_int, name: ?*redis.RedisModuleString) ?*MergeJob {
+    var it = merges;
+    while (it) |job| : (it = job.next) {
+        if (job.db == db and redis.RedisModule_StringCompare.?(job.keys[0], name) == 0) return job;
+    }
+    return null;
+}
+
+fn merge_error(err: anyerror) [*c]const u8 {
+    return switch (err) {
+        error.TooFull => c"ERR too full",
+        error.Broken => c"ERR filter is broken",
+        error.Changed => c"ERR filters changed during the merge",
+        error.Freezing => FreezingError,
+        else => c"ERR filters are not compatible",
+    };
+}
+
+// CF.MERGE dest src [src ...]
+// Adds every fingerprint of the source filters to the destination.
+// Filters must have the same type, size, hash function and locality:
+// then a fingerprint belongs to the same two buckets in all of them,
+// and it can be copied without knowing the item it came from.
+// Scalable filters can't be merged, their stages don't line up.
+// The merge stops at the first error (e.g. when dest becomes too full),
+// leaving in dest what was merged until then.
+export fn CF_MERGE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc < 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var dest = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(dest);
+
+    if (redis.RedisModule_KeyType.?(dest) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(dest);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            if (comptime t_ccf.isScalable(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR scalable filters can't be merged");
+            return do_merge(CFType, ctx, argv, argc, dest);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_merge(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int, dest: ?*redis.RedisModuleKey) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(dest)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    const srcs = argv[2..@intCast(usize, argc)];
+
+    // Check all the sources before touching dest.
+    var total: usize = 0;
+    for (srcs) |name| {
+        if (redis.RedisModule_StringCompare.?(name, argv[1]) == 0)
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR can't merge a filter into itself");
+        var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, name, redis.REDISMODULE_READ));
+        defer redis.RedisModule_CloseKey.?(key);
+        const src = merge_source(CFType, key) catch |err| return switch (err) {
+            error.NoKey => redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist"),
+            error.WrongType => redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE),
+        };
+        if (!cf.cf.can_merge(&src.cf)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filters are not compatible");
+        if (src.hasher.kind != cf.hasher.kind or src.hasher.seed != cf.hasher.seed)
+            return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filters use different hash functions");
+        total += src.cf.buckets.len;
+    }
+
+    const flags = redis.RedisModule_GetContextFlags.?(ctx);
+    const can_wait = (flags & (redis.REDISMODULE_CTX_FLAGS_MULTI | redis.REDISMODULE_CTX_FLAGS_LUA)) == 0 and redis.RedisModule_IsBlockedReplyRequest.?(ctx) == 0;
+    if (total > MergeSliceBuckets and can_wait) return start_merge(ctx, argv, argc, t_ccf.moduleType(CFType), total);
+
+    if (defer_write(ctx, cf, CF_MERGE)) return redis.REDISMODULE_OK;
+    for (srcs) |name| {
+        var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, name, redis.REDISMODULE_READ));
+        defer redis.RedisModule_CloseKey.?(key);
+        const src = merge_source(CFType, key) catch unreachable;
+        replicate_merge_range(ctx, argv[1], name, 0, src.cf.buckets.len);
+        cf.cf.merge(&src.cf) catch |err| return redis.RedisModule_ReplyWithError.?(ctx, merge_error(err));
+    }
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+fn merge_source(comptime CFType: type, key: ?*redis.RedisModuleKey) !*CFType {
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY) return error.NoKey;
+    if (redis.RedisModule_ModuleTypeGetType.?(key) != t_ccf.moduleType(CFType)) return error.WrongType;
+    return @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+}
+
+// Merges are never replicated as CF.MERGE: replicas and the AOF get the
+// buckets each slice covered, in the order they were merged, so they end
+// up with the same buckets even when dest gets other writes in between.
+fn replicate_merge_range(ctx: ?*redis.RedisModuleCtx, dest: ?*redis.RedisModuleString, src: ?*redis.RedisModuleString, from: usize, to: usize) void {
+    _ = redis.RedisModule_Replicate.?(ctx, c"cf.mergerange", c"ssll", dest, src, @intCast(c_longlong, from), @intCast(c_longlong, to));
+}
+
+fn start_merge(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int, keyType: ?*redis.RedisModuleType, total: usize) c_int {
+    const job = &heap_alloc(MergeJob, 1)[0];
+    job.* = MergeJob{
+        .next = merges,
+        .bc = null,
+        .db = redis.RedisModule_GetSelectedDb.?(ctx),
+        .keyType = keyType,
+        .keys = heap_alloc(?*redis.RedisModuleString, @intCast(usize, argc) - 1),
+        .src = 1,
+        .bucket = 0,
+        .done = 0,
+        .total = total,
+        .err = null,
+    };
+    // Arguments go away when the command returns, keep our own copies.
+    for (job.keys) |*name, i| name.* = redis.RedisModule_CreateStringFromString.?(null, argv[i + 1]);
+    merges = job;
+
+    job.bc = redis.RedisModule_BlockClient.?(ctx, CF_MERGE_reply, null, free_merge, 0);
+    _ = redis.RedisModule_CreateTimer.?(ctx, MergeSlicePeriod, merge_tick, job);
+    return redis.REDISMODULE_OK;
+}
+
+export fn merge_tick(ctx: ?*redis.RedisModuleCtx, data: ?*c_void) void {
+    const job = @ptrCast(*MergeJob, @alignCast(@alignOf(MergeJob), data));
+    _ = redis.RedisModule_SelectDb.?(ctx, job.db);
+    merge_slice(ctx, job) catch |err| job.err = merge_error(err);
+
+    if (job.err == null and job.src < job.keys.len) {
+        _ = redis.RedisModule_CreateTimer.?(ctx, MergeSlicePeriod, merge_tick, job);
+        return;
+    }
+
+    // Done, stop showing up in CF.INFO.
+    var it = &merges;
+    while (it.*) |other| : (it = &other.next) {
+        if (other == job) {
+            it.* = job.next;
+            break;
+        }
+    }
+    _ = redis.RedisModule_UnblockClient.?(job.bc, job);
+}
+
+// Merges the next slice of the current source. Keys can be deleted or
+// replaced between two slices, in that case the merge fails.
+fn merge_slice(ctx: ?*redis.RedisModuleCtx, job: *MergeJob) !void {
+    var dest = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, job.keys[0], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(dest);
+    var src = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, job.keys[job.src], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(src);
+
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime !t_ccf.isScalable(CFType)) {
+            if (job.keyType == t_ccf.moduleType(CFType)) {
+                const dest_cf = merge_source(CFType, dest) catch return error.Changed;
+                const src_cf = merge_source(CFType, src) catch return error.Changed;
+                if (!dest_cf.cf.can_merge(&src_cf.cf)) return error.Changed;
+                if (src_cf.hasher.kind != dest_cf.hasher.kind or src_cf.hasher.seed != dest_cf.hasher.seed) return error.Changed;
+                if (t_ccf.isFreezing(dest_cf)) return error.Freezing;
+                // Worker threads are reading dest, try again on the next run.
+                if (@atomicLoad(usize, &dest_cf.readers, builtin.AtomicOrder.SeqCst) != 0) return;
+
+                const len = src_cf.cf.buckets.len;
+                const from = job.bucket;
+                const to = std.math.min(len, from + MergeSliceBuckets);
+                // Replicated even if it fails: dest keeps what was merged.
+                replicate_merge_range(ctx, job.keys[0], job.keys[job.src], from, to);
+                try dest_cf.cf.merge_range(&src_cf.cf, from, to);
+
+                job.done += to - from;
+                job.bucket = to;
+                if (to == len) {
+                    job.src += 1;
+                    job.bucket = 0;
+                }
+                return;
+            }
+        }
+    }
+    unreachable;
+}
+
+export fn CF_MERGE_reply(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const job = @ptrCast(*MergeJob, @alignCast(@alignOf(MergeJob), redis.RedisModule_GetBlockedClientPrivateData.?(ctx)));
+    if (job.err != null) return redis.RedisModule_ReplyWithError.?(ctx, job.err);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+export fn free_merge(ctx: ?*redis.RedisModuleCtx, privdata: ?*c_void) void {
+    const job = @ptrCast(*MergeJob, @alignCast(@alignOf(MergeJob), privdata));
+    for (job.keys) |name| redis.RedisModule_FreeString.?(null, name);
+    redis.RedisModule_Free.?(job.keys.ptr);
+    redis.RedisModule_Free.?(job);
+}
+
+// CF.MERGERANGE dest src from to
+// Merges the buckets [from, to) of src into dest, plus src's homeless
+// fingerprint when `to` is the end of the table. This is how CF.MERGE
+// reaches replicas and the AOF, one slice at a time.
+export fn CF_MERGERANGE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 5) return redis.RedisModule_WrongArity.?(ctx);
+
+    const from = parse_longlong(argv[3]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad range");
+    const to = parse_longlong(argv[4]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad range");
+    if (from < 0 or to < from) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad range");
+
+    var dest = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(dest);
+    var src = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[2], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(src);
+
+    if (redis.RedisModule_KeyType.?(dest) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(dest);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime !t_ccf.isScalable(CFType)) {
+            if (keyType == t_ccf.moduleType(CFType)) return do_mergerange(CFType, ctx, dest, src, @intCast(usize, from), @intCast(usize, to));
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_mergerange(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, dest: ?*redis.RedisModuleKey, src: ?*redis.RedisModuleKey, from: usize, to: usize) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(dest)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    const src_cf = merge_source(CFType, src) catch |err| return switch (err) {
+        error.NoKey => redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist"),
+        error.WrongType => redis.RedisModule_ReplyWithError.?(ctx, redis.REDISMODULE_ERRORMSG_WRONGTYPE),
+    };
+    if (to > src_cf.cf.buckets.len) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad range");
+    if (src_cf == cf) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR can't merge a filter into itself");
+    if (src_cf.hasher.kind != cf.hasher.kind or src_cf.hasher.seed != cf.hasher.seed)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filters use different hash functions");
+
+    if (defer_write(ctx, cf, CF_MERGERANGE)) return redis.REDISMODULE_OK;
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return if (cf.cf.merge_range(&src_cf.cf, from, to))
+        redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK")
+    else |err|
+        redis.RedisModule_ReplyWithError.?(ctx, merge_error(err));
+}
+
+// Size of the chunks of bucket memory sent by CF.SNAPSHOT.
+const SnapshotChunkSize = t_ccf.AOF_CHUNK_SIZE;
+
+// CF.SNAPSHOT key [offset]
+// Replies with the tracking id, the current epoch, the filter's image
+// header, `offset` and up to 4MB of bucket memory starting at `offset`.
+// A client gets a full copy of the filter calling it until it has all the
+// bytes (`bucket bytes` in the header), then keeps it up to date with
+// CF.DELTA, starting from the id and epoch it got from the first chunk.
+export fn CF_SNAPSHOT(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2 and argc != 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var offset: c_longlong = 0;
+    if (argc == 3) {
+        offset = parse_longlong(argv[2]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad offset");
+        if (offset < 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad offset");
+    }
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            if (comptime t_ccf.isScalable(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR scalable filters can't be synced");
+            return do_snapshot(CFType, ctx, key, @intCast(usize, offset));
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_snapshot(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, offset: usize) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    const bytes = @sliceToBytes(cf.cf.buckets);
+    if (offset > bytes.len) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad offset");
+    const dirty = t_ccf.trackChanges(cf);
+    const header = cf.cf.image_header();
+    const chunk = bytes[offset..std.math.min(bytes.len, offset + SnapshotChunkSize)];
+
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, 5);
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, dirty.id));
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, dirty.epoch));
+    _ = redis.RedisModule_ReplyWithStringBuffer.?(ctx, header[0..].ptr, header.len);
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, offset));
+    _ = redis.RedisModule_ReplyWithStringBuffer.?(ctx, chunk.ptr, chunk.len);
+    return redis.REDISMODULE_OK;
+}
+
+// CF.DELTA key id since_epoch
+// Replies with the tracking id, the current epoch, the filter's image
+// header and then the offset and bytes of each run of bucket memory
+// changed after `since_epoch`, which the client copies over its own
+// buckets (see `apply_delta` in zig-cuckoofilter) before applying the header.
+// Runs are multiples of 4KB, copied from the buckets straight to the reply.
+// If `id` isn't the current tracking id the epoch means nothing here:
+// the reply is a full resync, with runs covering the whole filter.
+export fn CF_DELTA(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 4) return redis.RedisModule_WrongArity.?(ctx);
+
+    const id = parse_longlong(argv[2]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad id");
+    const since = parse_longlong(argv[3]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad epoch");
+    if (since < 0) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad epoch");
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            if (comptime t_ccf.isScalable(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR scalable filters can't be synced");
+            return do_delta(CFType, ctx, key, @bitCast(u64, id), @intCast(u64, since));
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_delta(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, id: u64, client_since: u64) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    const dirty = t_ccf.trackChanges(cf);
+    const since = if (id == dirty.id) client_since else 0;
+    var changes = cf.cf.changes_since(since) catch |err| switch (err) {
+        // Epochs of the same tracking only go up: the client is confused.
+        error.FutureEpoch => return redis.RedisModule_ReplyWithError.?(ctx, c"ERR epoch is from the future, take a new snapshot"),
+        error.NotTracked => unreachable,
+    };
+    const header = cf.cf.image_header();
+
+    var runs: usize = 0;
+    while (changes.next()) |_| runs += 1;
+    changes = cf.cf.changes_since(since) catch unreachable;
+
+    _ = redis.RedisModule_ReplyWithArray.?(ctx, @intCast(c_long, 3 + 2 * runs));
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, dirty.id));
+    _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, dirty.epoch));
+    _ = redis.RedisModule_ReplyWithStringBuffer.?(ctx, header[0..].ptr, header.len);
+    while (changes.next()) |run| {
+        _ = redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, run.offset));
+        _ = redis.RedisModule_ReplyWithStringBuffer.?(ctx, run.bytes.ptr, run.bytes.len);
+    }
+    return redis.REDISMODULE_OK;
+}
+
+const FreezingError = c"ERR filter is being frozen";
+
+// Milliseconds between two checks for a frozen filter built on the background thread.
+const FreezePollPeriod = 1;
+
+// A CF.FREEZE running on the background thread (see `workers`), so that
+// it doesn't hold up CF.MCHECK batches. The job is a reader of the source
+// filter and only builds the frozen one: the main thread polls for it
+// with a timer and swaps it in, if the key still holds the source.
+// Owned by the blocked client, freed by `free_freeze`.
+const FreezeJob = struct {
+    freezing: t_ccf.Freezing,
+    task: workers.Task,
+    bc: ?*redis.RedisModuleBlockedClient,
+    db: c_int,
+    name: ?*redis.RedisModuleString,
+    keyType: ?*redis.RedisModuleType,
+    result: ?*c_void,
+    err: [*c]const u8,
+    done: usize,
+};
+
+fn freeze_error(err: anyerror) [*c]const u8 {
+    return switch (err) {
+        error.Changed, error.Cancelled => c"ERR filter changed during the freeze",
+        else => c"ERR could not freeze filter",
+    };
+}
+
+// CF.FREEZE key [SYNC]
+// Replaces a plain filter with a frozen one (see `t_ccf.Frozen`): same
+// answers to lookups, less memory, no more writes. The frozen filter is
+// built on the background thread while the client is blocked, unless SYNC is
+// given or the command can't block (MULTI, scripts, no workers).
+// Meanwhile the key keeps answering lookups and rejects writes.
+// Replicated as the frozen filter (see `t_ccf.replicateFrozen`).
+export fn CF_FREEZE(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2 and argc != 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    var sync = false;
+    if (argc == 3) {
+        var opt_len: usize = undefined;
+        const opt = redis.RedisModule_StringPtrLen.?(argv[2], &opt_len)[0..opt_len];
+        if (!insensitive_eql("SYNC", opt)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR syntax error");
+        sync = true;
+    }
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key does not exist");
+
+    const keyType = redis.RedisModule_ModuleTypeGetType.?(key);
+    inline for (t_ccf.Filters) |CFType| {
+        if (keyType == t_ccf.moduleType(CFType)) {
+            if (comptime t_ccf.isScalable(CFType)) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR scalable filters can't be frozen");
+            return do_freeze(CFType, ctx, key, argv[1], sync);
+        }
+    }
+    return reply_with_wrong_type(ctx, keyType);
+}
+
+inline fn do_freeze(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, name: ?*redis.RedisModuleString, sync: bool) c_int {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_ModuleTypeGetValue.?(key)));
+    if (t_ccf.isFreezing(cf)) return redis.RedisModule_ReplyWithError.?(ctx, FreezingError);
+    // Lost fingerprints would turn into false negatives.
+    if (cf.cf.is_broken()) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter is broken");
+    if (t_ccf.freezeScratch(cf) > t_ccf.FREEZE_SCRATCH_MAX) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR filter too big to freeze");
+    if (!sync and can_block(ctx)) return start_freeze(CFType, ctx, cf, name);
+
+    const never: usize = 0;
+    const frozen = t_ccf.freeze(CFType, cf, &never) catch |err| return redis.RedisModule_ReplyWithError.?(ctx, freeze_error(err));
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(t_ccf.FrozenOf(CFType)), frozen);
+    t_ccf.replicateFrozen(ctx, name, frozen);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+fn start_freeze(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, cf: *CFType, name: ?*redis.RedisModuleString) c_int {
+    const job = &heap_alloc(FreezeJob, 1)[0];
+    job.* = FreezeJob{
+        .freezing = t_ccf.Freezing{ .next = null, .source = @ptrCast(*c_void, cf), .cancelled = 0, .built = false },
+        .task = workers.Task{ .next = null, .run = FreezeTask(CFType).run },
+        .bc = null,
+        .db = redis.RedisModule_GetSelectedDb.?(ctx),
+        // Arguments go away when the command returns, keep our own copy.
+        .name = redis.RedisModule_CreateStringFromString.?(null, name),
+        .keyType = t_ccf.moduleType(CFType),
+        .result = null,
+        .err = null,
+        .done = 0,
+    };
+
+    _ = @atomicRmw(usize, &cf.readers, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+    t_ccf.startFreezing(&job.freezing);
+    job.bc = redis.RedisModule_BlockClient.?(ctx, CF_FREEZE_reply, null, free_freeze, 0);
+    workers.submitBackground(&job.task);
+    _ = redis.RedisModule_CreateTimer.?(ctx, FreezePollPeriod, freeze_tick, job);
+    return redis.REDISMODULE_OK;
+}
+
+fn FreezeTask(comptime CFType: type) type {
+    return struct {
+        fn run(task: *workers.Task) void {
+            const job = @fieldParentPtr(FreezeJob, "task", task);
+            const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), job.freezing.source));
+            if (t_ccf.freeze(CFType, cf, &job.freezing.cancelled)) |frozen| {
+                job.result = frozen;
+            } else |err| {
+                job.err = freeze_error(err);
+            }
+
+            // Done with the filter, writers and `free` can go on. If the
+            // key was freed meanwhile, the filter is left to us.
+            const orphan = t_ccf.doneFreezing(&job.freezing);
+            t_ccf.releaseReader(cf);
+            if (orphan) t_ccf.freeUnread(CFType, cf);
+            _ = @atomicRmw(usize, &job.done, builtin.AtomicRmwOp.Xchg, 1, builtin.AtomicOrder.SeqCst);
+        }
+    };
+}
+
+export fn freeze_tick(ctx: ?*redis.RedisModuleCtx, data: ?*c_void) void {
+    const job = @ptrCast(*FreezeJob, @alignCast(@alignOf(FreezeJob), data));
+    if (@atomicLoad(usize, &job.done, builtin.AtomicOrder.SeqCst) == 0) {
+        _ = redis.RedisModule_CreateTimer.?(ctx, FreezePollPeriod, freeze_tick, job);
+        return;
+    }
+
+    _ = redis.RedisModule_SelectDb.?(ctx, job.db);
+    finish_freeze(ctx, job) catch |err| {
+        // Keep the error of the build, if that's what failed.
+        if (job.err == null) job.err = freeze_error(err);
+    };
+    _ = redis.RedisModule_UnblockClient.?(job.bc, job);
+}
+
+// The key can be deleted, overwritten or renamed while the job runs:
+// then the frozen filter is thrown away and the key left as it is.
+fn finish_freeze(ctx: ?*redis.RedisModuleCtx, job: *FreezeJob) !void {
+    const live = t_ccf.stopFreezing(&job.freezing);
+    inline for (t_ccf.Filters) |CFType| {
+        if (comptime !t_ccf.isScalable(CFType)) {
+            if (job.keyType == t_ccf.moduleType(CFType)) {
+                const FrozenType = t_ccf.FrozenOf(CFType);
+                const frozen = @ptrCast(*FrozenType, @alignCast(@alignOf(usize), job.result orelse return error.Failed));
+                errdefer t_ccf.freeFrozen(frozen);
+                if (!live) return error.Changed;
+
+                var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, job.name, redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+                defer redis.RedisModule_CloseKey.?(key);
+                if (redis.RedisModule_KeyType.?(key) == redis.REDISMODULE_KEYTYPE_EMPTY) return error.Changed;
+                if (redis.RedisModule_ModuleTypeGetType.?(key) != job.keyType) return error.Changed;
+                const value = redis.RedisModule_ModuleTypeGetValue.?(key) orelse return error.Changed;
+                if (value != job.freezing.source) return error.Changed;
+
+                _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(FrozenType), frozen);
+                t_ccf.replicateFrozen(ctx, job.name, frozen);
+                return;
+            }
+        }
+    }
+    unreachable;
+}
+
+export fn CF_FREEZE_reply(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    const job = @ptrCast(*FreezeJob, @alignCast(@alignOf(FreezeJob), redis.RedisModule_GetBlockedClientPrivateData.?(ctx)));
+    if (job.err != null) return redis.RedisModule_ReplyWithError.?(ctx, job.err);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+export fn free_freeze(ctx: ?*redis.RedisModuleCtx, privdata: ?*c_void) void {
+    const job = @ptrCast(*FreezeJob, @alignCast(@alignOf(FreezeJob), privdata));
+    redis.RedisModule_FreeString.?(null, job.name);
+    redis.RedisModule_Free.?(job);
+}
+
+// Frozen filter state carried by CF.LOADFROZEN.
+const FrozenHeader = struct {
+    bucket_count: usize,
+    locality: cuckoo.Locality,
+    fpcount: usize,
+    seed: u64,
+    block_length: usize,
+};
+
+// CF.LOADFROZEN key fpsize encoding hash seed locality buckets fpcount xorseed blocks
+// Creates a frozen filter with zeroed fingerprints, which are then filled
+// in by CF.LOADCHUNK. `buckets` and `locality` are those of the filter it
+// was frozen from, `xorseed` and `blocks` those of its xor filter.
+// Used by AOF rewrites, and to move frozen filters between instances.
+export fn CF_LOADFROZEN(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 11) return redis.RedisModule_WrongArity.?(ctx);
+
+    var fp_size_len: usize = undefined;
+    const fp_size_str = redis.RedisModule_StringPtrLen.?(argv[2], &fp_size_len)[0..fp_size_len];
+    const fp_size = parse_fpsize(fp_size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
+    const encoding = parse_encoding(argv[3]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad encoding");
+    var hasher = hashing.Hasher.Default;
+    hasher.kind = parse_hash(argv[4]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad hash");
+    hasher.seed = parse_seed(argv[5]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad seed");
+    const locality = parse_locality(argv[6]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad locality");
+
+    var nums: [4]c_longlong = undefined;
+    for (nums) |*num, i| num.* = parse_longlong(argv[7 + i]) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    // The xor seed can use all 64 bits
+    if (nums[0] < 0 or nums[1] < 0 or nums[3] <= 0 or nums[3] > t_ccf.MAX_SIZE)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    const header = FrozenHeader{
+        .bucket_count = @intCast(usize, nums[0]),
+        .locality = locality,
+        .fpcount = @intCast(usize, nums[1]),
+        .seed = @bitCast(u64, nums[2]),
+        .block_length = @intCast(usize, nums[3]),
+    };
+
+    var key = @ptrCast(?*redis.RedisModuleKey, redis.RedisModule_OpenKey.?(ctx, argv[1], redis.REDISMODULE_READ | redis.REDISMODULE_WRITE));
+    defer redis.RedisModule_CloseKey.?(key);
+
+    if (redis.RedisModule_KeyType.?(key) != redis.REDISMODULE_KEYTYPE_EMPTY)
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR key already exists");
+
+    if (encoding == Encoding.SemiSorted) return switch (fp_size) {
+        .Bits8 => do_loadfrozen(t_ccf.FrozenSemiSortedFilter9, ctx, key, header, hasher),
+        .Bits12 => do_loadfrozen(t_ccf.FrozenSemiSortedFilter13, ctx, key, header, hasher),
+        .Bits16 => do_loadfrozen(t_ccf.FrozenSemiSortedFilter17, ctx, key, header, hasher),
+        else => redis.RedisModule_ReplyWithError.?(ctx, SemiSortedFPSizeError),
+    };
+    return switch (fp_size) {
+        .Bits6 => do_loadfrozen(t_ccf.FrozenFilter6, ctx, key, header, hasher),
+        .Bits8 => do_loadfrozen(t_ccf.FrozenFilter8, ctx, key, header, hasher),
+        .Bits12 => do_loadfrozen(t_ccf.FrozenFilter12, ctx, key, header, hasher),
+        .Bits16 => do_loadfrozen(t_ccf.FrozenFilter16, ctx, key, header, hasher),
+        .Bits32 => do_loadfrozen(t_ccf.FrozenFilter32, ctx, key, header, hasher),
+    };
+}
+
+inline fn do_loadfrozen(comptime CFType: type, ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleKey, header: FrozenHeader, hasher: hashing.Hasher) c_int {
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const frozenCFType = @typeOf(cf.cf);
+
+    // Same limit as CF.INIT
+    const size = frozenCFType.XorFilter.bytes_for_slots(3 * header.block_length);
+    if (size > t_ccf.MAX_SIZE) {
+        redis.RedisModule_Free.?(cf);
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    }
+
+    cf.readers = 0;
+    cf.storage = t_ccf.default_storage;
+    cf.hasher = hasher;
+    const memory = t_ccf.allocBuckets(size, cf.storage) catch |err| {
+        redis.RedisModule_Free.?(cf);
+        return reply_with_create_error(ctx, err);
+    };
+    cf.cf = frozenCFType.load(header.bucket_count, header.locality, header.fpcount, header.seed, header.block_length, memory) catch {
+        t_ccf.freeBuckets(memory, cf.storage);
+        redis.RedisModule_Free.?(cf);
+        return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad header");
+    };
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+    _ = redis.RedisModule_ModuleTypeSetValue.?(key, t_ccf.moduleType(CFType), cf);
+
+    _ = redis.RedisModule_ReplicateVerbatim.?(ctx);
+    return redis.RedisModule_ReplyWithSimpleString.?(ctx, c"OK");
+}
+
+// CF.CAPACITY size [fpsize]
+export fn CF_CAPACITY(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2 and argc != 3) return redis.RedisModule_WrongArity.?(ctx);
+
+    // SIZE argument
+    var size_len: usize = undefined;
+    const size_str = redis.RedisModule_StringPtrLen.?(argv[1], &size_len)[0..size_len];
+
+    // FPSIZE argument
+    var fp_size_str = "1"[0..];
+    if (argc == 3) {
+        var fpsize_len: usize = undefined;
+        fp_size_str = redis.RedisModule_StringPtrLen.?(argv[2], &fpsize_len)[0..fpsize_len];
+    }
+
+    const size = str2size(size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad size");
+
+    const fp_size = parse_fpsize(fp_size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
+    return switch (fp_size) {
+        .Bits6 => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter6.capacity(size))),
+        .Bits8 => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter8.capacity(size))),
+        .Bits12 => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter12.capacity(size))),
+        .Bits16 => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter16.capacity(size))),
+        .Bits32 => redis.RedisModule_ReplyWithLongLong.?(ctx, @intCast(c_longlong, cuckoo.Filter32.capacity(size))),
+    };
+}
+
+// CF.SIZEFOR universe [fpsize] [EXACT]
+export fn CF_SIZEFOR(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleString, argc: c_int) c_int {
+    if (argc != 2 and argc != 3 and argc != 4) return redis.RedisModule_WrongArity.?(ctx);
+
+    // Parse universe
+    var uni_len: usize = undefined;
+    var uni_str = redis.RedisModule_StringPtrLen.?(argv[1], &uni_len);
+    const universe = std.fmt.parseInt(usize, uni_str[0..uni_len], 10) catch |err| return switch (err) {
+        error.Overflow => redis.RedisModule_ReplyWithError.?(ctx, c"ERR universe overflows usize"),
+        error.InvalidCharacter => redis.RedisModule_ReplyWithError.?(ctx, c"ERR universe contains bad character"),
     };
 
     // Parse fpsize and EXACT
-    var fp_size = "1"[0..];
+    var fp_size_str = "1"[0..];
     var exact = false;
     if (argc > 2) {
         var arg2len: usize = undefined;
         const arg2 = redis.RedisModule_StringPtrLen.?(argv[2], &arg2len)[0..arg2len];
-        if (insensitive_eql("EXACT", arg2)) exact = true else fp_size = arg2;
+        if (insensitive_eql("EXACT", arg2)) exact = true else fp_size_str = arg2;
     }
 
     if (argc == 4) {
@@ -467,12 +2908,13 @@ export fn CF_SIZEFOR(ctx: ?*redis.RedisModuleCtx, argv: [*c]?*redis.RedisModuleS
         if (insensitive_eql("EXACT", arg3)) exact = true else return redis.RedisModule_WrongArity.?(ctx);
     }
 
-    if (fp_size.len != 1) return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
-    return switch (fp_size[0]) {
-        '1' => do_sizefor(cuckoo.Filter8, ctx, universe, exact),
-        '2' => do_sizefor(cuckoo.Filter16, ctx, universe, exact),
-        '4' => do_sizefor(cuckoo.Filter32, ctx, universe, exact),
-        else => redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize"),
+    const fp_size = parse_fpsize(fp_size_str) catch return redis.RedisModule_ReplyWithError.?(ctx, c"ERR bad fpsize");
+    return switch (fp_size) {
+        .Bits6 => do_sizefor(cuckoo.Filter6, ctx, universe, exact),
+        .Bits8 => do_sizefor(cuckoo.Filter8, ctx, universe, exact),
+        .Bits12 => do_sizefor(cuckoo.Filter12, ctx, universe, exact),
+        .Bits16 => do_sizefor(cuckoo.Filter16, ctx, universe, exact),
+        .Bits32 => do_sizefor(cuckoo.Filter32, ctx, universe, exact),
     };
 }
 
@@ -504,6 +2946,21 @@ test "insensitive_eql" {
     std.testing.expect(!insensitive_eql("EXACT", "EXACZ"));
 }
 
+test "parse_fpsize" {
+    std.testing.expect(FPSize.Bits8 == parse_fpsize("1") catch unreachable);
+    std.testing.expect(FPSize.Bits16 == parse_fpsize("2") catch unreachable);
+    std.testing.expect(FPSize.Bits32 == parse_fpsize("4") catch unreachable);
+    std.testing.expect(FPSize.Bits6 == parse_fpsize("6b") catch unreachable);
+    std.testing.expect(FPSize.Bits8 == parse_fpsize("8B") catch unreachable);
+    std.testing.expect(FPSize.Bits12 == parse_fpsize("12b") catch unreachable);
+    std.testing.expect(FPSize.Bits16 == parse_fpsize("16b") catch unreachable);
+    std.testing.expect(FPSize.Bits32 == parse_fpsize("32b") catch unreachable);
+    std.testing.expectError(error.Error, parse_fpsize(""));
+    std.testing.expectError(error.Error, parse_fpsize("3"));
+    std.testing.expectError(error.Error, parse_fpsize("6"));
+    std.testing.expectError(error.Error, parse_fpsize("12"));
+}
+
 test "size2str" {
     var buf: [5]u8 = undefined;
     std.testing.expect(mem.eql(u8, "1K\x00", size2str(1024 * 1, &buf) catch unreachable));
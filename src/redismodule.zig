@@ -1,3 +1,5 @@
 pub usingnamespace @cImport({
+    // Blocked clients are still flagged as experimental
+    @cDefine("REDISMODULE_EXPERIMENTAL_API", "1");
     @cInclude("./lib/redismodule.h");
 });
@@ -1,163 +1,2714 @@
+const builtin = @import("builtin");
+const std = @import("std");
 const cuckoo = @import("./lib/zig-cuckoofilter.zig");
 const redis = @import("./redismodule.zig");
+const hugepages = @import("./hugepages.zig");
+const workers = @import("./workers.zig");
+const metrics = @import("./metrics.zig");
+const hashing = @import("./hashing.zig");
+const xorfilter = @import("./xorfilter.zig");
 
-pub const CUCKOO_FILTER_ENCODING_VERSION = 2;
+// Version 6 added the window of scalable filters (see `Window`).
+// Version 5 saves bucket memory in chunks, skipping empty ones (see `saveBuckets`).
+// Version 4 added the filter options (see `Options`).
+// Version 3 added the hash function and seed of each key.
+// Version 2 keys are loaded with `hashing.Hasher.Default`.
+pub const CUCKOO_FILTER_ENCODING_VERSION = 6;
+
+// Bucket bytes per chunk in RDB files. Chunks with only empty buckets are
+// not written, so this is also the granularity at which empty memory is skipped.
+pub const RDB_CHUNK_SIZE = 64 * 1024;
+
+// Max number of bucket bytes carried by a single CF.LOADCHUNK command
+// emitted by AOF rewrites. Keeps each command well below `proto-max-bulk-len`
+// no matter how big the filter is.
+pub const AOF_CHUNK_SIZE = 4 * 1024 * 1024;
+
+// Biggest filter (or scalable filter stage) we are willing to allocate.
+pub const MAX_SIZE = 8 * 1024 * 1024 * 1024;
+
+// Redis frees values in a background thread (when lazy freeing is enabled)
+// if their free effort is above 64. We count one unit every 64KB of bucket
+// memory, so only small filters get freed in the main thread.
+pub const FREE_EFFORT_UNIT = 64 * 1024;
+
+// Where bucket memory lives. Not persisted: filters loaded
+// from RDB use `default_storage`, set by module arguments.
+pub const Storage = enum {
+    Heap,
+    HugePages,
+};
+pub var default_storage = Storage.Heap;
+
+pub var Type6: ?*redis.RedisModuleType = null;
 pub var Type8: ?*redis.RedisModuleType = null;
+pub var Type12: ?*redis.RedisModuleType = null;
 pub var Type16: ?*redis.RedisModuleType = null;
 pub var Type32: ?*redis.RedisModuleType = null;
+pub var ScalableType6: ?*redis.RedisModuleType = null;
+pub var ScalableType8: ?*redis.RedisModuleType = null;
+pub var ScalableType12: ?*redis.RedisModuleType = null;
+pub var ScalableType16: ?*redis.RedisModuleType = null;
+pub var ScalableType32: ?*redis.RedisModuleType = null;
+pub var SemiSortedType9: ?*redis.RedisModuleType = null;
+pub var SemiSortedType13: ?*redis.RedisModuleType = null;
+pub var SemiSortedType17: ?*redis.RedisModuleType = null;
+pub var ScalableSemiSortedType9: ?*redis.RedisModuleType = null;
+pub var ScalableSemiSortedType13: ?*redis.RedisModuleType = null;
+pub var ScalableSemiSortedType17: ?*redis.RedisModuleType = null;
+pub var FrozenType6: ?*redis.RedisModuleType = null;
+pub var FrozenType8: ?*redis.RedisModuleType = null;
+pub var FrozenType12: ?*redis.RedisModuleType = null;
+pub var FrozenType16: ?*redis.RedisModuleType = null;
+pub var FrozenType32: ?*redis.RedisModuleType = null;
+pub var FrozenSemiSortedType9: ?*redis.RedisModuleType = null;
+pub var FrozenSemiSortedType13: ?*redis.RedisModuleType = null;
+pub var FrozenSemiSortedType17: ?*redis.RedisModuleType = null;
+
+// The prng state lives in the filter itself (see `prngState`),
+// it's persisted for each key in order to provide fully
+// deterministic behavior for insertions.
+// `hasher` is the hash function (and seed) the item commands
+// use to turn items into hash/fp pairs, persisted as well.
+// `readers` counts batches reading the filter from worker
+// threads. Anything that writes to the filter has to wait for it
+// to go back to 0 (see `blockOnReaders`), freeing it is left
+// to the last reader (see `freeUnread`).
+// `stats` is updated by the filter itself on the main thread,
+// worker threads count on their own and add their totals to
+// `threaded_stats` (atomically) when they are done, see `statsView`.
+// Neither is persisted.
+pub const Filter6 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: cuckoo.Filter6,
+};
 
-// `s` is the prng state. It's persisted for each key
-// in order to provide fully deterministic behavior for
-// insertions.
 pub const Filter8 = struct {
-    s: [2]u64,
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
     cf: cuckoo.Filter8,
 };
 
+pub const Filter12 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: cuckoo.Filter12,
+};
+
 pub const Filter16 = struct {
-    s: [2]u64,
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
     cf: cuckoo.Filter16,
 };
 
 pub const Filter32 = struct {
-    s: [2]u64,
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
     cf: cuckoo.Filter32,
 };
 
+pub const ScalableFilter6 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.Filter6),
+};
+
+pub const ScalableFilter8 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.Filter8),
+};
+
+pub const ScalableFilter12 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.Filter12),
+};
+
+pub const ScalableFilter16 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.Filter16),
+};
+
+pub const ScalableFilter32 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.Filter32),
+};
+
+pub const SemiSortedFilter9 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: cuckoo.SemiSortedFilter9,
+};
+
+pub const SemiSortedFilter13 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: cuckoo.SemiSortedFilter13,
+};
+
+pub const SemiSortedFilter17 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: cuckoo.SemiSortedFilter17,
+};
+
+pub const ScalableSemiSortedFilter9 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.SemiSortedFilter9),
+};
+
+pub const ScalableSemiSortedFilter13 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.SemiSortedFilter13),
+};
+
+pub const ScalableSemiSortedFilter17 = struct {
+    readers: usize,
+    hasher: hashing.Hasher,
+    stats: cuckoo.Stats,
+    threaded_stats: cuckoo.Stats,
+    cf: Scalable(cuckoo.SemiSortedFilter17),
+};
+
+// Keys turned into static filters by CF.FREEZE (see `Frozen`), one type per
+// plain filter type. They only answer lookups, so they have no counters.
+pub const FrozenFilter6 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.Filter6),
+};
+
+pub const FrozenFilter8 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.Filter8),
+};
+
+pub const FrozenFilter12 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.Filter12),
+};
+
+pub const FrozenFilter16 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.Filter16),
+};
+
+pub const FrozenFilter32 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.Filter32),
+};
+
+pub const FrozenSemiSortedFilter9 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.SemiSortedFilter9),
+};
+
+pub const FrozenSemiSortedFilter13 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.SemiSortedFilter13),
+};
+
+pub const FrozenSemiSortedFilter17 = struct {
+    readers: usize,
+    storage: Storage,
+    hasher: hashing.Hasher,
+    cf: Frozen(cuckoo.SemiSortedFilter17),
+};
+
+// All key types, used by commands to dispatch on the type of a key.
+pub const Filters = []type{
+    Filter6,
+    Filter8,
+    Filter12,
+    Filter16,
+    Filter32,
+    ScalableFilter6,
+    ScalableFilter8,
+    ScalableFilter12,
+    ScalableFilter16,
+    ScalableFilter32,
+    SemiSortedFilter9,
+    SemiSortedFilter13,
+    SemiSortedFilter17,
+    ScalableSemiSortedFilter9,
+    ScalableSemiSortedFilter13,
+    ScalableSemiSortedFilter17,
+};
+
+// Frozen keys are kept apart: only commands that don't write dispatch on them.
+pub const FrozenFilters = []type{
+    FrozenFilter6,
+    FrozenFilter8,
+    FrozenFilter12,
+    FrozenFilter16,
+    FrozenFilter32,
+    FrozenSemiSortedFilter9,
+    FrozenSemiSortedFilter13,
+    FrozenSemiSortedFilter17,
+};
+
+// Every key type, for read-only commands.
+pub const AllFilters = Filters ++ FrozenFilters;
+
+// Returns the Redis module type registered for a filter type.
+pub fn moduleType(comptime CFType: type) ?*redis.RedisModuleType {
+    return switch (CFType) {
+        Filter6 => Type6,
+        Filter8 => Type8,
+        Filter12 => Type12,
+        Filter16 => Type16,
+        Filter32 => Type32,
+        ScalableFilter6 => ScalableType6,
+        ScalableFilter8 => ScalableType8,
+        ScalableFilter12 => ScalableType12,
+        ScalableFilter16 => ScalableType16,
+        ScalableFilter32 => ScalableType32,
+        SemiSortedFilter9 => SemiSortedType9,
+        SemiSortedFilter13 => SemiSortedType13,
+        SemiSortedFilter17 => SemiSortedType17,
+        ScalableSemiSortedFilter9 => ScalableSemiSortedType9,
+        ScalableSemiSortedFilter13 => ScalableSemiSortedType13,
+        ScalableSemiSortedFilter17 => ScalableSemiSortedType17,
+        FrozenFilter6 => FrozenType6,
+        FrozenFilter8 => FrozenType8,
+        FrozenFilter12 => FrozenType12,
+        FrozenFilter16 => FrozenType16,
+        FrozenFilter32 => FrozenType32,
+        FrozenSemiSortedFilter9 => FrozenSemiSortedType9,
+        FrozenSemiSortedFilter13 => FrozenSemiSortedType13,
+        FrozenSemiSortedFilter17 => FrozenSemiSortedType17,
+        else => @compileError("not a filter type"),
+    };
+}
+
+// Something waiting for worker threads to be done reading a filter:
+// a writer's blocked client (see `blockOnReaders`), or the filter
+// itself when its key was freed meanwhile (see `freeUnread`).
+const Waiter = struct {
+    next: ?*Waiter,
+    filter: *c_void,
+    bc: ?*redis.RedisModuleBlockedClient,
+    free: ?fn (*c_void) void,
+    woken: bool,
+};
+
+// Protected by `workers.lockReaders`.
+var waiters: ?*Waiter = null;
+
+fn allocWaiter() *Waiter {
+    return @ptrCast(*Waiter, @alignCast(@alignOf(Waiter), redis.RedisModule_Alloc.?(@sizeOf(Waiter))));
+}
+
+// Sleeps until no worker thread is reading the filter, for writers
+// whose client can't be blocked (see `blockOnReaders`).
+// The main thread is the only one that can start new readers,
+// so once this returns the caller has the filter for itself.
+pub fn waitReaders(cf: var) void {
+    if (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) == 0) return;
+    workers.lockReaders();
+    defer workers.unlockReaders();
+    while (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) != 0) workers.waitReadersDone();
+}
+
+// Blocks the client until no worker thread is reading the filter, then
+// runs `rerun` (the command itself) again as the reply callback. Returns
+// false, without blocking, if nobody is reading the filter.
+// Waiters stay registered until their command ran again, and meanwhile
+// batches on the filter don't go to worker threads (see `hasWaiters`):
+// the command finds whatever the key holds by then, without readers.
+pub fn blockOnReaders(ctx: ?*redis.RedisModuleCtx, cf: var, rerun: redis.RedisModuleCmdFunc) bool {
+    if (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) == 0) return false;
+    const waiter = allocWaiter();
+    workers.lockReaders();
+    defer workers.unlockReaders();
+    if (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) == 0) {
+        redis.RedisModule_Free.?(waiter);
+        return false;
+    }
+    waiter.* = Waiter{
+        .next = waiters,
+        .filter = @ptrCast(*c_void, cf),
+        .bc = redis.RedisModule_BlockClient.?(ctx, rerun, null, freeWaiter, 0),
+        .free = null,
+        .woken = false,
+    };
+    waiters = waiter;
+    return true;
+}
+
+export fn freeWaiter(ctx: ?*redis.RedisModuleCtx, privdata: ?*c_void) void {
+    const waiter = @ptrCast(*Waiter, @alignCast(@alignOf(Waiter), privdata));
+    workers.lockReaders();
+    var it = &waiters;
+    while (it.*) |other| : (it = &other.next) {
+        if (other == waiter) {
+            it.* = waiter.next;
+            break;
+        }
+    }
+    workers.unlockReaders();
+    redis.RedisModule_Free.?(waiter);
+}
+
+// True if writers are waiting for worker threads to be done with the filter.
+pub fn hasWaiters(cf: var) bool {
+    workers.lockReaders();
+    defer workers.unlockReaders();
+    var it = waiters;
+    while (it) |waiter| : (it = waiter.next) {
+        if (waiter.filter == @ptrCast(*c_void, cf) and waiter.free == null) return true;
+    }
+    return false;
+}
+
+// Called by a worker thread when it's done reading the filter. The last
+// reader wakes up the writers waiting for it and, if the key was freed
+// meanwhile, frees the filter. Don't touch `cf` after this.
+pub fn releaseReader(cf: var) void {
+    var orphan: ?*Waiter = null;
+    workers.lockReaders();
+    if (@atomicRmw(usize, &cf.readers, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst) == 1) {
+        workers.readersDone();
+        var it = &waiters;
+        while (it.*) |waiter| {
+            if (waiter.filter == @ptrCast(*c_void, cf) and waiter.free != null) {
+                it.* = waiter.next;
+                orphan = waiter;
+                continue;
+            }
+            if (waiter.filter == @ptrCast(*c_void, cf) and !waiter.woken) {
+                waiter.woken = true;
+                _ = redis.RedisModule_UnblockClient.?(waiter.bc, waiter);
+            }
+            it = &waiter.next;
+        }
+    }
+    workers.unlockReaders();
+
+    if (orphan) |waiter| {
+        waiter.free.?(waiter.filter);
+        redis.RedisModule_Free.?(waiter);
+    }
+}
+
+// Frees the filter of a deleted key, or leaves it to its last reader:
+// freeing a key never waits for worker threads.
+pub fn freeUnread(comptime CFType: type, cf: *CFType) void {
+    const free = struct {
+        fn run(value: *c_void) void {
+            const self = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
+            if (comptime isFrozen(CFType)) {
+                freeFrozen(self);
+            } else if (comptime isScalable(CFType)) {
+                freeScalable(self);
+            } else {
+                freeFilter(self);
+            }
+        }
+    }.run;
+
+    if (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) != 0) {
+        const waiter = allocWaiter();
+        workers.lockReaders();
+        if (@atomicLoad(usize, &cf.readers, builtin.AtomicOrder.SeqCst) != 0) {
+            waiter.* = Waiter{ .next = waiters, .filter = @ptrCast(*c_void, cf), .bc = null, .free = free, .woken = false };
+            waiters = waiter;
+            workers.unlockReaders();
+            return;
+        }
+        workers.unlockReaders();
+        redis.RedisModule_Free.?(waiter);
+    }
+    free(@ptrCast(*c_void, cf));
+}
+
+// Resets the counters of a newly created (or loaded) key and points
+// the filter to them. Also counts the key in the module-wide metrics,
+// so it has to be called exactly once per key.
+pub fn initStats(cf: var) void {
+    cf.stats = cuckoo.Stats.init();
+    cf.threaded_stats = cuckoo.Stats.init();
+    if (comptime isScalable(@typeOf(cf).Child)) cf.cf.set_stats(&cf.stats) else cf.cf.stats = &cf.stats;
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+}
+
+// Adds the counters of a worker thread to `threaded_stats`.
+pub fn addThreadedStats(cf: var, stats: cuckoo.Stats) void {
+    if (comptime isFrozen(@typeOf(cf).Child)) return;
+    const dst = &cf.threaded_stats;
+    for (stats.kicks) |k, i| _ = @atomicRmw(u64, &dst.kicks[i], builtin.AtomicRmwOp.Add, k, builtin.AtomicOrder.SeqCst);
+    _ = @atomicRmw(u64, &dst.primary_hits, builtin.AtomicRmwOp.Add, stats.primary_hits, builtin.AtomicOrder.SeqCst);
+    _ = @atomicRmw(u64, &dst.alt_hits, builtin.AtomicRmwOp.Add, stats.alt_hits, builtin.AtomicOrder.SeqCst);
+    _ = @atomicRmw(u64, &dst.homeless_hits, builtin.AtomicRmwOp.Add, stats.homeless_hits, builtin.AtomicOrder.SeqCst);
+    _ = @atomicRmw(u64, &dst.misses, builtin.AtomicRmwOp.Add, stats.misses, builtin.AtomicOrder.SeqCst);
+}
+
+// Counters of the main thread and of the worker threads together.
+pub fn totalStats(cf: var) cuckoo.Stats {
+    var total = cf.stats;
+    const threaded = &cf.threaded_stats;
+    total.primary_hits += @atomicLoad(u64, &threaded.primary_hits, builtin.AtomicOrder.SeqCst);
+    total.alt_hits += @atomicLoad(u64, &threaded.alt_hits, builtin.AtomicOrder.SeqCst);
+    total.homeless_hits += @atomicLoad(u64, &threaded.homeless_hits, builtin.AtomicOrder.SeqCst);
+    total.misses += @atomicLoad(u64, &threaded.misses, builtin.AtomicOrder.SeqCst);
+    return total;
+}
+
+// Storage for the stages copied by `statsView`, nothing for plain filters.
+pub fn ViewStages(comptime CFType: type) type {
+    if (!isScalable(CFType)) return void;
+    var cf: CFType = undefined;
+    const scalableCFType = @typeOf(cf.cf);
+    return [scalableCFType.MaxStages]scalableCFType.Stage;
+}
+
+// A copy of the filter that counts into `stats` instead of the key's counters.
+// Meant for worker threads, it must not outlive the batch it was made for.
+pub fn statsView(comptime CFType: type, cf: *CFType, stats: *cuckoo.Stats, stages: *ViewStages(CFType)) @typeOf(cf.cf) {
+    if (comptime isScalable(CFType)) return cf.cf.view(stats, stages);
+    if (comptime isFrozen(CFType)) return cf.cf;
+    var view = cf.cf;
+    view.stats = stats;
+    return view;
+}
+
+// Only the newest stage of a scalable filter ever evicts fingerprints, so
+// it's the one holding the prng state (new stages inherit it, see `push_stage`).
+pub fn prngState(cf: var) [2]u64 {
+    return if (comptime isScalable(@typeOf(cf.*))) cf.cf.newest().prng_state else cf.cf.prng_state;
+}
+
+pub fn setPrngState(cf: var, state: [2]u64) void {
+    if (comptime isScalable(@typeOf(cf.*))) cf.cf.newest().prng_state = state else cf.cf.prng_state = state;
+}
+
+// Per-key settings that change how the filter behaves but not its layout,
+// set by CF.INIT and persisted as a single word of bits.
+// Keys saved before version 4 get `Default`, which is how they always behaved.
+// Bits 0: BFS insertion, 1-2: locality (0 is the whole table).
+pub const Options = struct {
+    insertion: cuckoo.Insertion,
+    locality: cuckoo.Locality,
+
+    pub const Default = Options{ .insertion = .RandomWalk, .locality = .Table };
+
+    const BFSBit: u64 = 1 << 0;
+    const LocalityShift = 1;
+    const LocalityMask: u64 = 3 << LocalityShift;
+
+    pub fn toBits(self: Options) u64 {
+        const bfs = if (self.insertion == .BFS) BFSBit else 0;
+        return bfs | (u64(@enumToInt(self.locality)) << LocalityShift);
+    }
+
+    pub fn fromBits(bits: u64) !Options {
+        if (bits & ~(BFSBit | LocalityMask) != 0) return error.UnknownOptions;
+        return Options{
+            .insertion = if (bits & BFSBit != 0) cuckoo.Insertion.BFS else cuckoo.Insertion.RandomWalk,
+            .locality = @intToEnum(cuckoo.Locality, @truncate(u2, bits >> LocalityShift)),
+        };
+    }
+};
+
+// Like the prng state, options live in the filter. All the stages of a
+// scalable filter share them (new stages inherit them, see `push_stage`).
+pub fn filterOptions(cf: var) Options {
+    const stage = if (comptime isScalable(@typeOf(cf.*))) cf.cf.newest() else &cf.cf;
+    return Options{ .insertion = stage.insertion, .locality = stage.locality };
+}
+
+pub fn applyOptions(cf: var, options: Options) void {
+    if (comptime isScalable(@typeOf(cf.*))) {
+        for (cf.cf.stages) |*stage| {
+            stage.insertion = options.insertion;
+            stage.set_locality(options.locality);
+        }
+    } else {
+        cf.cf.insertion = options.insertion;
+        cf.cf.set_locality(options.locality);
+    }
+}
+
+pub fn isScalable(comptime CFType: type) bool {
+    return switch (CFType) {
+        ScalableFilter6,
+        ScalableFilter8,
+        ScalableFilter12,
+        ScalableFilter16,
+        ScalableFilter32,
+        ScalableSemiSortedFilter9,
+        ScalableSemiSortedFilter13,
+        ScalableSemiSortedFilter17,
+        => true,
+        else => false,
+    };
+}
+
+pub fn isFrozen(comptime CFType: type) bool {
+    return switch (CFType) {
+        FrozenFilter6,
+        FrozenFilter8,
+        FrozenFilter12,
+        FrozenFilter16,
+        FrozenFilter32,
+        FrozenSemiSortedFilter9,
+        FrozenSemiSortedFilter13,
+        FrozenSemiSortedFilter17,
+        => true,
+        else => false,
+    };
+}
+
+// The type of a plain filter once frozen.
+pub fn FrozenOf(comptime CFType: type) type {
+    return switch (CFType) {
+        Filter6 => FrozenFilter6,
+        Filter8 => FrozenFilter8,
+        Filter12 => FrozenFilter12,
+        Filter16 => FrozenFilter16,
+        Filter32 => FrozenFilter32,
+        SemiSortedFilter9 => FrozenSemiSortedFilter9,
+        SemiSortedFilter13 => FrozenSemiSortedFilter13,
+        SemiSortedFilter17 => FrozenSemiSortedFilter17,
+        else => @compileError("only plain filters can be frozen"),
+    };
+}
+
+// Allocates zeroed bucket memory.
+// Calloc gets big allocations straight from fresh zeroed pages, so
+// we don't have to zero them ourselves and creating a filter of any
+// size takes constant time: pages get faulted in as they are used.
+// The same goes for anonymous mappings used for huge pages.
+pub fn allocBuckets(size: usize, storage: Storage) ![]align(@alignOf(usize)) u8 {
+    const memory = switch (storage) {
+        .Heap => @ptrCast([*]align(@alignOf(usize)) u8, @alignCast(@alignOf(usize), redis.RedisModule_Calloc.?(1, size)))[0..size],
+        .HugePages => try hugepages.alloc(size),
+    };
+    metrics.addBucketMemory(bucketsFootprint(size, storage));
+    return memory;
+}
+
+// A `std.mem.Allocator` on top of the Redis allocator, for scratch memory
+// that has to show up in `used_memory`. Can be used by any thread.
+// Alignment is that of `RedisModule_Alloc`, enough for any integer.
+pub const redis_allocator = &redis_allocator_state;
+var redis_allocator_state = std.mem.Allocator{
+    .reallocFn = redisRealloc,
+    .shrinkFn = redisShrink,
+};
+
+fn redisRealloc(self: *std.mem.Allocator, old_mem: []u8, old_align: u29, new_size: usize, new_align: u29) ![]u8 {
+    std.debug.assert(new_align <= @alignOf(usize));
+    const buf = if (old_mem.len == 0)
+        redis.RedisModule_Alloc.?(new_size)
+    else
+        redis.RedisModule_Realloc.?(old_mem.ptr, new_size);
+    return @ptrCast([*]u8, buf orelse return error.OutOfMemory)[0..new_size];
+}
+
+fn redisShrink(self: *std.mem.Allocator, old_mem: []u8, old_align: u29, new_size: usize, new_align: u29) []u8 {
+    if (new_size == 0) {
+        redis.RedisModule_Free.?(old_mem.ptr);
+        return old_mem[0..0];
+    }
+    const buf = redis.RedisModule_Realloc.?(old_mem.ptr, new_size) orelse return old_mem[0..new_size];
+    return @ptrCast([*]u8, buf)[0..new_size];
+}
+
+// Can be called by the lazy free thread.
+pub fn freeBuckets(bytes: []u8, storage: Storage) void {
+    metrics.subBucketMemory(bucketsFootprint(bytes.len, storage));
+    switch (storage) {
+        .Heap => redis.RedisModule_Free.?(bytes.ptr),
+        .HugePages => hugepages.free(bytes),
+    }
+}
+
+// Actual memory used by `len` bytes of buckets.
+fn bucketsFootprint(len: usize, storage: Storage) usize {
+    return switch (storage) {
+        .Heap => len,
+        .HugePages => hugepages.mappedSize(len),
+    };
+}
+
+// Allocates bucket memory and initializes a filter on it.
+// `size` is nominal (see `cuckoo.Filter6.bytes_for`): bit-packed
+// filters get less memory than that.
+pub fn allocFilter(comptime CF: type, size: usize, storage: Storage) !CF {
+    const memory = try allocBuckets(CF.bytes_for(size), storage);
+    return CF.init_zeroed(memory) catch |err| {
+        freeBuckets(memory, storage);
+        return err;
+    };
+}
+
+// Turns on change tracking for CF.DELTA and CF.SNAPSHOT, the first time one
+// of them is used on a key. Tracking isn't persisted, after a restart it
+// starts again with a new random id: clients send back the id they synced
+// with, and copies of another tracking (another filter, or the same one
+// before a restart or a replica promotion) get a full resync.
+// Epochs start from 1, so a delta since epoch 0 is the whole filter.
+pub fn trackChanges(cf: var) *cuckoo.Dirty {
+    if (cf.cf.dirty) |dirty| return dirty;
+    const len = cuckoo.Dirty.ranges_for(@sliceToBytes(cf.cf.buckets).len);
+    const dirty = @ptrCast(*cuckoo.Dirty, @alignCast(@alignOf(cuckoo.Dirty), redis.RedisModule_Alloc.?(@sizeOf(cuckoo.Dirty))));
+    const epochs = @ptrCast([*]u64, @alignCast(@alignOf(u64), redis.RedisModule_Alloc.?(len * @sizeOf(u64))))[0..len];
+    dirty.* = cuckoo.Dirty.init(epochs, trackingId(), 1);
+    cf.cf.dirty = dirty;
+    return dirty;
+}
+
+// Random, and positive as a RESP integer.
+fn trackingId() u64 {
+    var bytes: [8]u8 = undefined;
+    std.os.getRandomBytes(bytes[0..]) catch {
+        std.mem.writeIntSliceLittle(u64, bytes[0..], std.os.time.milliTimestamp());
+    };
+    return std.mem.readIntSliceLittle(u64, bytes[0..]) & std.math.maxInt(i64);
+}
+
+fn freeDirty(dirty: *cuckoo.Dirty) void {
+    redis.RedisModule_Free.?(dirty.range_epochs.ptr);
+    redis.RedisModule_Free.?(dirty);
+}
+
+// A windowed filter (`CF.INIT ... WINDOW generations interval`) is a scalable
+// filter whose stages, all of the same size, are used as a ring of generations:
+// inserts go to the current one, checks and removals probe the live ones and,
+// every `interval` milliseconds, the oldest live generation expires.
+// Zeroing a big generation takes a while, so the ring has one stage more than
+// the generations: the spare, the stage after the current one, is never probed
+// and gets zeroed a slice at a time by the module's window timer. Expired
+// generations are not probed either. Once the spare is all zeroes it becomes
+// the current generation (a swap) and the oldest expired generation becomes
+// the new spare. The current generation is always probed, so inserts never
+// get lost while a swap is pending.
+pub const Window = struct {
+    interval: u64,
+    current: usize,
+    // Start of the current interval: generations expire `interval` ms after it.
+    rotated_at: u64,
+    // Bytes at the start of the spare stage already zeroed.
+    cleared: usize,
+    // Generations past the window still waiting for their swap.
+    expired: usize,
+
+    // Whether stage `i` of a ring of `len` stages is probed. The spare is
+    // `len - 1` generations older than the current one, the expired ones
+    // come right before it.
+    pub fn is_live(self: Window, i: usize, len: usize) bool {
+        const age = (self.current + len - i) % len;
+        return age == 0 or age + self.expired < len - 1;
+    }
+
+    pub fn spare(self: Window, len: usize) usize {
+        return (self.current + 1) % len;
+    }
+
+    // Expires the generations whose interval has passed by `now`, and moves
+    // `rotated_at` forward by as many whole intervals, so that a window left
+    // alone for a while catches up at once and keeps its schedule.
+    // Returns how many intervals have passed.
+    pub fn expire_due(self: *Window, now: u64, len: usize) u64 {
+        if (now < self.rotated_at + self.interval) return 0;
+        const due = (now - self.rotated_at) / self.interval;
+        self.rotated_at += due * self.interval;
+        self.expire(due, len);
+        return due;
+    }
+
+    // At most every generation expires, current one included.
+    pub fn expire(self: *Window, n: u64, len: usize) void {
+        self.expired += @intCast(usize, std.math.min(n, u64(len - 1 - self.expired)));
+    }
+
+    pub fn can_swap(self: Window, stage_bytes: usize) bool {
+        return self.expired > 0 and self.cleared == stage_bytes;
+    }
+
+    // Makes the spare the current generation. Its stage needs a
+    // `forget()`, see `Scalable.swap`.
+    pub fn swap(self: *Window, len: usize) void {
+        self.current = self.spare(len);
+        self.cleared = 0;
+        self.expired -= 1;
+    }
+
+    // Bytes of the spare to zero every `period` ms: enough to zero
+    // a whole stage in half an interval.
+    pub fn clear_budget(self: Window, stage_bytes: usize, period: u64) usize {
+        const budget = @intCast(usize, std.math.min(u64(stage_bytes) * 2 * period / self.interval, WINDOW_CLEAR_MAX));
+        return std.math.max(budget, WINDOW_CLEAR_SIZE);
+    }
+
+    // For windows coming from RDB files or CF.LOADWINDOW, see `Scalable.check_window`.
+    pub fn validate(self: Window, len: usize, stage_bytes: usize) !void {
+        if (self.interval == 0 or len < 2 or self.current >= len or
+            self.cleared > stage_bytes or self.expired > len - 1) return error.BadWindow;
+    }
+};
+
+// Every generation takes a stage, and so does the spare.
+pub const MAX_GENERATIONS = 31;
+
+// Bytes of spare stages zeroed every time the window timer runs: at least
+// WINDOW_CLEAR_SIZE per filter, and at most WINDOW_CLEAR_MAX in total,
+// shared by all the windowed filters (see `window_clear_next`).
+pub const WINDOW_CLEAR_SIZE = 64 * 1024;
+pub const WINDOW_CLEAR_MAX = 16 * 1024 * 1024;
+
+// Where the window timer finds windowed filters. The timer opens the keys
+// by name at every run, so it never holds pointers to a filter: keys that
+// are gone, or were moved to another database, get looked up in every
+// database (`UnknownDb`), and are forgotten if they aren't found.
+// Keys loaded from RDB start out like that. Only used by the main thread.
+pub const WindowKey = struct {
+    next: ?*WindowKey,
+    db: c_int,
+    name: ?*redis.RedisModuleString,
+};
+
+pub const UnknownDb: c_int = -1;
+
+pub var window_keys: ?*WindowKey = null;
+
+// The first key whose spare didn't get all the zeroing it needed the last
+// time the window timer ran, when WINDOW_CLEAR_MAX ran out: the next run
+// starts from it, so that all the filters get their turn.
+pub var window_clear_next: ?*WindowKey = null;
+
+// Not every Redis version tells the database of a key being loaded,
+// looked up at module load.
+pub var getDbIdFromIO: ?extern fn (?*redis.RedisModuleIO) c_int = null;
+
+pub fn hasWindowKey(db: c_int, name: ?*redis.RedisModuleString) bool {
+    var it = window_keys;
+    while (it) |wk| : (it = wk.next) {
+        if (wk.db == db and redis.RedisModule_StringCompare.?(wk.name, name) == 0) return true;
+    }
+    return false;
+}
+
+pub fn addWindowKey(db: c_int, name: ?*const redis.RedisModuleString) void {
+    const copy = redis.RedisModule_CreateStringFromString.?(null, name);
+    if (hasWindowKey(db, copy)) return redis.RedisModule_FreeString.?(null, copy);
+    const wk = @ptrCast(*WindowKey, @alignCast(@alignOf(WindowKey), redis.RedisModule_Alloc.?(@sizeOf(WindowKey))));
+    wk.* = WindowKey{ .next = window_keys, .db = db, .name = copy };
+    window_keys = wk;
+}
+
+pub fn freeWindowKey(wk: *WindowKey) void {
+    redis.RedisModule_FreeString.?(null, wk.name);
+    redis.RedisModule_Free.?(wk);
+}
+
+// A scalable filter is a stack of filters (stages) of increasing size.
+// New fingerprints always go into the newest stage. As soon as the newest
+// stage becomes too full a new one, `growth` times bigger, is pushed on top,
+// so the filter never reports being too full until `MaxStages` is reached.
+// Checks and removals probe every stage, starting from the newest one.
+// Each stage adds its own false positives, so the error rate of the whole
+// filter grows with the number of stages.
+pub fn Scalable(comptime CF: type) type {
+    return struct {
+        stages: []CF,
+        growth: usize,
+        broken: bool,
+        storage: Storage,
+        stats: ?*cuckoo.Stats,
+        window: ?Window,
+
+        pub const FPType = CF.FPType;
+        pub const Stage = CF;
+        pub const MaxStages = 32;
+        const Self = @This();
+
+        // Creates a scalable filter with a single stage of `size` bytes.
+        pub fn init(size: usize, growth: usize, storage: Storage) !Self {
+            var self = Self{
+                .stages = @ptrCast([*]CF, @alignCast(@alignOf(CF), redis.RedisModule_Alloc.?(@sizeOf(CF))))[0..1],
+                .growth = growth,
+                .broken = false,
+                .storage = storage,
+                .stats = null,
+                .window = null,
+            };
+            self.stages[0] = allocFilter(CF, size, storage) catch |err| {
+                redis.RedisModule_Free.?(self.stages.ptr);
+                return err;
+            };
+            return self;
+        }
+
+        // Creates a windowed filter with `generations` generations of `size`
+        // bytes (plus the spare), rotating every `interval` milliseconds.
+        pub fn init_windowed(size: usize, generations: usize, interval: u64, storage: Storage, now: u64) !Self {
+            if (generations == 0 or generations + 1 > MaxStages) return error.BadWindow;
+            var self = try init(size, 1, storage);
+            errdefer self.deinit();
+            var i: usize = 0;
+            while (i < generations) : (i += 1) try self.grow();
+
+            // The spare comes zeroed from allocBuckets.
+            self.window = Window{
+                .interval = interval,
+                .current = 0,
+                .rotated_at = now,
+                .cleared = @sliceToBytes(self.stages[1].buckets).len,
+                .expired = 0,
+            };
+            return self;
+        }
+
+        pub fn deinit(self: *Self) void {
+            for (self.stages) |*stage| freeBuckets(@sliceToBytes(stage.buckets), self.storage);
+            redis.RedisModule_Free.?(self.stages.ptr);
+        }
+
+        // The stage that receives new fingerprints.
+        pub fn newest(self: *Self) *CF {
+            if (self.window) |window| return &self.stages[window.current];
+            return &self.stages[self.stages.len - 1];
+        }
+
+        // Stages of windowed filters that are not probed: the spare and
+        // the expired generations (see `Window`).
+        fn is_live(self: *const Self, i: usize) bool {
+            const window = self.window orelse return true;
+            return window.is_live(i, self.stages.len);
+        }
+
+        fn spare(self: *Self) *CF {
+            return &self.stages[self.window.?.spare(self.stages.len)];
+        }
+
+        // All the stages of a windowed filter have the same size.
+        pub fn stage_bytes(self: *const Self) usize {
+            return @sliceToBytes(self.stages[0].buckets).len;
+        }
+
+        // Zeroes up to `max_bytes` more bytes of the spare stage.
+        // Worker threads never read the spare, so it can run while
+        // they read the rest of the filter.
+        pub fn clear(self: *Self, max_bytes: usize) void {
+            const bytes = @sliceToBytes(self.spare().buckets);
+            const window = &self.window.?;
+            const end = window.cleared + std.math.min(bytes.len - window.cleared, max_bytes);
+            std.mem.set(u8, bytes[window.cleared..end], 0);
+            window.cleared = end;
+        }
+
+        // Whether `window` fits the stages: windows need at least two
+        // stages, all of the same size.
+        pub fn check_window(self: *const Self, window: Window) !void {
+            for (self.stages) |*stage| {
+                if (@sliceToBytes(stage.buckets).len != self.stage_bytes()) return error.BadWindow;
+            }
+            return window.validate(self.stages.len, self.stage_bytes());
+        }
+
+        pub fn can_swap(self: *const Self) bool {
+            return self.window.?.can_swap(self.stage_bytes());
+        }
+
+        // Starts filling the spare stage, once `can_swap()`. The oldest
+        // expired generation becomes the new spare: it gets forgotten right
+        // away and zeroed later. Changes what readers probe, so it needs
+        // the filter for itself.
+        pub fn swap(self: *Self) void {
+            const previous = self.newest();
+            self.window.?.swap(self.stages.len);
+            self.newest().prng_state = previous.prng_state;
+            self.spare().forget();
+        }
+
+        // Pushes an already initialized filter on top of the stack.
+        pub fn push_stage(self: *Self, stage: CF) !void {
+            if (self.stages.len == MaxStages) return error.TooFull;
+            const n = self.stages.len + 1;
+            const ptr = redis.RedisModule_Realloc.?(self.stages.ptr, n * @sizeOf(CF));
+            self.stages = @ptrCast([*]CF, @alignCast(@alignOf(CF), ptr))[0..n];
+            self.stages[n - 1] = stage;
+            self.stages[n - 1].stats = self.stats;
+            self.stages[n - 1].prng_state = self.stages[n - 2].prng_state;
+            self.stages[n - 1].insertion = self.stages[n - 2].insertion;
+            self.stages[n - 1].set_locality(self.stages[n - 2].locality);
+        }
+
+        // Points all the stages, and the ones pushed later, to `stats`.
+        pub fn set_stats(self: *Self, stats: ?*cuckoo.Stats) void {
+            self.stats = stats;
+            for (self.stages) |*stage| stage.stats = stats;
+        }
+
+        // A copy of the filter whose stages, copied into `stages`, count into `stats`.
+        pub fn view(self: *const Self, stats: *cuckoo.Stats, stages: *[MaxStages]CF) Self {
+            var copy = self.*;
+            for (self.stages) |stage, i| {
+                stages[i] = stage;
+                stages[i].stats = stats;
+            }
+            copy.stages = stages[0..self.stages.len];
+            copy.stats = stats;
+            return copy;
+        }
+
+        fn grow(self: *Self) !void {
+            if (self.stages.len == MaxStages) return error.TooFull;
+            const size = std.math.min(self.newest().nominal_size() * self.growth, MAX_SIZE);
+            const stage = try allocFilter(CF, size, self.storage);
+            self.push_stage(stage) catch |err| {
+                freeBuckets(@sliceToBytes(stage.buckets), self.storage);
+                return err;
+            };
+        }
+
+        pub fn count(self: *Self) !usize {
+            if (self.broken) return error.Broken;
+            var total: usize = 0;
+            for (self.stages) |*stage, i| {
+                if (self.is_live(i)) total += try stage.count();
+            }
+            return total;
+        }
+
+        pub fn maybe_contains(self: *Self, hash: u64, fingerprint: FPType) !bool {
+            if (self.broken) return error.Broken;
+            var misses: usize = 0;
+            var i = self.stages.len;
+            while (i > 0) {
+                i -= 1;
+                if (!self.is_live(i)) continue;
+                if (try self.stages[i].maybe_contains(hash, fingerprint)) {
+                    self.uncount_misses(misses);
+                    return true;
+                }
+                misses += 1;
+            }
+            self.uncount_misses(misses - 1);
+            return false;
+        }
+
+        // Every stage counts its own misses, but a lookup
+        // is a miss only when it misses all of them.
+        fn uncount_misses(self: *Self, n: usize) void {
+            if (self.stats) |stats| stats.misses -= n;
+        }
+
+        pub fn remove(self: *Self, hash: u64, fingerprint: FPType) !void {
+            if (self.broken) return error.Broken;
+
+            // Looking for the right stage is not a lookup
+            const stats = self.stats;
+            self.set_stats(null);
+            defer self.set_stats(stats);
+
+            var i = self.stages.len;
+            while (i > 0) {
+                i -= 1;
+                if (!self.is_live(i)) continue;
+                if (try self.stages[i].maybe_contains(hash, fingerprint)) return self.stages[i].remove(hash, fingerprint);
+            }
+
+            // Windowed filters forget items on their own, clients can't know
+            // when: deleting one that expired meanwhile is not a misuse.
+            if (self.window != null) return error.NotFound;
+
+            // Same as a single filter: deleting a fingerprint that was never
+            // added means the user is not in sync with the filter anymore.
+            self.broken = true;
+            return error.Broken;
+        }
+
+        pub fn add(self: *Self, hash: u64, fingerprint: FPType) !void {
+            if (self.broken) return error.Broken;
+            try self.newest().add(hash, fingerprint);
+
+            // The newest stage is now holding a homeless fingerprint, leave it
+            // there and start filling a new stage. Once we are out of stages
+            // (or memory) the filter will start returning `error.TooFull`.
+            // Windowed filters never grow.
+            if (self.window == null and self.newest().is_toofull()) self.grow() catch {};
+        }
+
+        pub fn is_broken(self: *Self) bool {
+            if (self.broken) return true;
+            for (self.stages) |*stage, i| {
+                if (self.is_live(i) and stage.is_broken()) return true;
+            }
+            return false;
+        }
+
+        pub fn is_toofull(self: *Self) bool {
+            return self.newest().is_toofull();
+        }
+
+        pub fn fix_toofull(self: *Self) !void {
+            if (self.broken) return error.Broken;
+            return self.newest().fix_toofull();
+        }
+
+        // Batch functions go through the single-item ones: every item
+        // might hit a different stage, or trigger the creation of a new one.
+        pub fn maybe_contains_batch(self: *Self, hashes: []const u64, fingerprints: []const FPType, results: []cuckoo.BatchResult) void {
+            self.maybe_contains_batch_from(cuckoo.SliceSource(FPType){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        pub fn add_batch(self: *Self, hashes: []const u64, fingerprints: []const FPType, results: []cuckoo.BatchResult) void {
+            self.add_batch_from(cuckoo.SliceSource(FPType){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        pub fn remove_batch(self: *Self, hashes: []const u64, fingerprints: []const FPType, results: []cuckoo.BatchResult) void {
+            self.remove_batch_from(cuckoo.SliceSource(FPType){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        pub fn maybe_contains_batch_from(self: *Self, source: var, results: []cuckoo.BatchResult) void {
+            var i: usize = 0;
+            while (i < source.len()) : (i += 1) {
+                const item = source.get(i);
+                results[i] = if (self.maybe_contains(item.hash, item.fingerprint)) |found|
+                    (if (found) cuckoo.BatchResult.Ok else cuckoo.BatchResult.NotFound)
+                else |err| switch (err) {
+                    error.Broken => cuckoo.BatchResult.Broken,
+                };
+            }
+        }
+
+        pub fn add_batch_from(self: *Self, source: var, results: []cuckoo.BatchResult) void {
+            var i: usize = 0;
+            while (i < source.len()) : (i += 1) {
+                const item = source.get(i);
+                results[i] = if (self.add(item.hash, item.fingerprint)) cuckoo.BatchResult.Ok else |err| switch (err) {
+                    error.Broken => cuckoo.BatchResult.Broken,
+                    error.TooFull => cuckoo.BatchResult.TooFull,
+                };
+            }
+        }
+
+        pub fn remove_batch_from(self: *Self, source: var, results: []cuckoo.BatchResult) void {
+            var i: usize = 0;
+            while (i < source.len()) : (i += 1) {
+                const item = source.get(i);
+                results[i] = if (self.remove(item.hash, item.fingerprint)) cuckoo.BatchResult.Ok else |err| switch (err) {
+                    error.Broken => cuckoo.BatchResult.Broken,
+                    error.NotFound => cuckoo.BatchResult.NotFound,
+                };
+            }
+        }
+    };
+}
+
+// A plain filter turned into a static one by CF.FREEZE. The item key (see
+// `cuckoo.Filter8.item_key`) of every fingerprint goes into an xor filter,
+// and lookups check the key that the cuckoo filter would have matched: a
+// frozen filter answers like the filter it comes from, plus the false
+// positives of the xor filter. Its fingerprints are `XorBits` wide, which
+// keeps those at half the nominal error rate of the cuckoo filter
+// (`MaxError`): 2 bits less than the cuckoo fingerprints with 4 slots per
+// bucket, 1 bit less with 2. That's about 1.23 * `XorBits` bits per item.
+// Items are gone, only their keys are left: no adds, no removals.
+pub fn Frozen(comptime CF: type) type {
+    return struct {
+        shape: cuckoo.Shape,
+        fpcount: usize,
+        xor: XorFilter,
+
+        pub const FPType = CF.FPType;
+        pub const IsSemiSorted = CF.IsSemiSorted;
+        pub const XorBits = CF.FPType.bit_count + 1 - std.math.log2(2 * CF.BucketSize);
+        pub const XorFilter = xorfilter.Xor(XorBits);
+        const Self = @This();
+
+        // Only reads `cf`, so it can run on a worker thread.
+        // The sorted keys and the scratch memory of the xor filter (see
+        // `scratch_bytes`) come from the Redis allocator and are gone by
+        // the time it returns. Gives up with `error.Cancelled` as soon as
+        // it sees `cancelled` set, see `Freezing`.
+        pub fn build(cf: *CF, storage: Storage, cancelled: *const usize) !Self {
+            const allocator = redis_allocator;
+            var n: usize = 0;
+            var it = cf.item_keys();
+            while (it.next()) |_| : (n += 1) {
+                if (n % FreezeCheckPeriod == 0) try checkCancelled(cancelled);
+            }
+
+            const keys = try allocator.alloc(u64, n);
+            defer allocator.free(keys);
+            it = cf.item_keys();
+            for (keys) |*key, i| {
+                if (i % FreezeCheckPeriod == 0) try checkCancelled(cancelled);
+                key.* = it.next().?;
+            }
+
+            // Copies of a fingerprint give the same key, the xor filter wants it once.
+            std.sort.sort(u64, keys, std.sort.asc(u64));
+            try checkCancelled(cancelled);
+            var unique: usize = 0;
+            for (keys) |key| {
+                if (unique > 0 and keys[unique - 1] == key) continue;
+                keys[unique] = key;
+                unique += 1;
+            }
+
+            const memory = try allocBuckets(XorFilter.bytes_for(unique), storage);
+            errdefer freeBuckets(memory, storage);
+            return Self{
+                .shape = cf.shape(),
+                .fpcount = cf.fpcount,
+                .xor = try XorFilter.build(memory, keys[0..unique], allocator),
+            };
+        }
+
+        // Memory `build` needs on top of the frozen filter for `n`
+        // fingerprints, about 50 bytes each: the keys, then the xor filter's.
+        pub fn scratch_bytes(n: usize) usize {
+            return n * @sizeOf(u64) + XorFilter.scratch_bytes(n);
+        }
+
+        // Adopts fingerprint memory saved by a previous build (RDB, CF.LOADFROZEN).
+        pub fn load(bucket_count: usize, locality: cuckoo.Locality, fpcount: usize, seed: u64, block_length: usize, memory: []u8) !Self {
+            if (bucket_count < 2 or bucket_count & (bucket_count - 1) != 0) return error.BadLength;
+            return Self{
+                .shape = CF.shape_for(bucket_count, locality),
+                .fpcount = fpcount,
+                .xor = try XorFilter.init(seed, block_length, memory),
+            };
+        }
+
+        // Same interface as cuckoo filters, for the read commands.
+        // A frozen filter is never broken nor too full: both would have
+        // stopped CF.FREEZE.
+        pub fn count(self: *Self) error{Broken}!usize {
+            return self.fpcount;
+        }
+
+        pub fn maybe_contains(self: *Self, hash: u64, fingerprint: FPType) error{Broken}!bool {
+            return self.xor.contains(CF.item_key(self.shape, hash, fingerprint));
+        }
+
+        pub fn is_broken(self: *Self) bool {
+            return false;
+        }
+
+        pub fn is_toofull(self: *Self) bool {
+            return false;
+        }
+
+        pub fn maybe_contains_batch(self: *Self, hashes: []const u64, fingerprints: []const FPType, results: []cuckoo.BatchResult) void {
+            self.maybe_contains_batch_from(cuckoo.SliceSource(FPType){ .hashes = hashes, .fingerprints = fingerprints }, results);
+        }
+
+        // Like cuckoo filter batches: the slots of a whole window get
+        // prefetched before any of its items is checked.
+        pub fn maybe_contains_batch_from(self: *Self, source: var, results: []cuckoo.BatchResult) void {
+            var keys: [cuckoo.BatchWindow]u64 = undefined;
+            const n = source.len();
+            var start: usize = 0;
+            while (start < n) : (start += cuckoo.BatchWindow) {
+                const len = std.math.min(cuckoo.BatchWindow, n - start);
+                for (keys[0..len]) |*key, i| {
+                    const item = source.get(start + i);
+                    key.* = CF.item_key(self.shape, item.hash, item.fingerprint);
+                    self.xor.prefetch(key.*);
+                }
+                for (keys[0..len]) |key, i| {
+                    results[start + i] = if (self.xor.contains(key)) cuckoo.BatchResult.Ok else cuckoo.BatchResult.NotFound;
+                }
+            }
+        }
+
+        // Fingerprint memory written by CF.LOADCHUNK.
+        pub fn apply_delta(self: *Self, offset: usize, bytes: []const u8) !void {
+            const memory = self.xor.fingerprints;
+            if (offset > memory.len or bytes.len > memory.len - offset) return error.OutOfBounds;
+            std.mem.copy(u8, memory[offset..], bytes);
+        }
+    };
+}
+
+// Biggest scratch memory (see `Frozen.scratch_bytes`) CF.FREEZE can take,
+// enough for about 85 million fingerprints.
+pub const FREEZE_SCRATCH_MAX = 4 * 1024 * 1024 * 1024;
+
+pub fn freezeScratch(cf: var) usize {
+    return Frozen(@typeOf(cf.cf)).scratch_bytes(cf.cf.fpcount);
+}
+
+// Fingerprints read by `Frozen.build` between two looks at `cancelled`.
+const FreezeCheckPeriod = 64 * 1024;
+
+fn checkCancelled(cancelled: *const usize) !void {
+    if (@atomicLoad(usize, cancelled, builtin.AtomicOrder.SeqCst) != 0) return error.Cancelled;
+}
+
+// Builds the frozen version of a plain filter, see CF.FREEZE.
+// Can run on a worker thread, as a reader of `cf`.
+pub fn freeze(comptime CFType: type, cf: *CFType, cancelled: *const usize) !*FrozenOf(CFType) {
+    const FrozenType = FrozenOf(CFType);
+    const frozen = @ptrCast(*FrozenType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(FrozenType))));
+    errdefer redis.RedisModule_Free.?(frozen);
+    frozen.* = FrozenType{
+        .readers = 0,
+        .storage = cf.storage,
+        .hasher = cf.hasher,
+        .cf = try @typeOf(frozen.cf).build(&cf.cf, cf.storage, cancelled),
+    };
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+    return frozen;
+}
+
+pub fn freeFrozen(cf: var) void {
+    freeBuckets(cf.cf.xor.fingerprints, cf.storage);
+    redis.RedisModule_Free.?(cf);
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+}
+
+// A plain filter being frozen on the background thread. The job is one of
+// the filter's readers, and commands that write to it fail instead of
+// waiting (see `isFreezing`) until the main thread swaps in the frozen filter.
+// The key can still be deleted or overwritten: freeing the filter, maybe
+// on the lazy free thread, sets `cancelled` (so that the frozen filter
+// doesn't end up in a new key that reused the same memory, and the build
+// stops early) and, unless the job is `built` already, leaves the filter
+// to the job to free (see `cancelFreezing`), without waiting for it.
+pub const Freezing = struct {
+    next: ?*Freezing,
+    source: *c_void,
+    cancelled: usize,
+    built: bool,
+};
+
+var freezing: ?*Freezing = null;
+var freezing_count: usize = 0;
+var freezing_lock: usize = 0;
+
+fn lockFreezing() void {
+    while (@atomicRmw(usize, &freezing_lock, builtin.AtomicRmwOp.Xchg, 1, builtin.AtomicOrder.SeqCst) != 0) workers.yield();
+}
+
+fn unlockFreezing() void {
+    _ = @atomicRmw(usize, &freezing_lock, builtin.AtomicRmwOp.Xchg, 0, builtin.AtomicOrder.SeqCst);
+}
+
+pub fn startFreezing(f: *Freezing) void {
+    lockFreezing();
+    defer unlockFreezing();
+    f.next = freezing;
+    freezing = f;
+    _ = @atomicRmw(usize, &freezing_count, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+}
+
+// Returns false if the filter was freed in the meantime.
+pub fn stopFreezing(f: *Freezing) bool {
+    lockFreezing();
+    defer unlockFreezing();
+    var it = &freezing;
+    while (it.*) |other| : (it = &other.next) {
+        if (other == f) {
+            it.* = f.next;
+            break;
+        }
+    }
+    _ = @atomicRmw(usize, &freezing_count, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+    return f.cancelled == 0;
+}
+
+// Called by the job once done reading the source, before it stops being
+// one of its readers. Returns true if the filter was freed in the
+// meantime: then it's up to the job to free it, see `freeUnread`.
+pub fn doneFreezing(f: *Freezing) bool {
+    lockFreezing();
+    defer unlockFreezing();
+    f.built = true;
+    return f.cancelled != 0;
+}
+
+// Cancelled entries are freezes of a filter that was freed: a new key
+// that got the same memory is not being frozen.
+pub fn isFreezing(cf: var) bool {
+    if (@atomicLoad(usize, &freezing_count, builtin.AtomicOrder.SeqCst) == 0) return false;
+    lockFreezing();
+    defer unlockFreezing();
+    var it = freezing;
+    while (it) |f| : (it = f.next) {
+        if (f.source == @ptrCast(*c_void, cf) and f.cancelled == 0) return true;
+    }
+    return false;
+}
+
+// Returns true if a freeze is still reading `cf`, which is now the job's to free.
+fn cancelFreezing(cf: var) bool {
+    if (@atomicLoad(usize, &freezing_count, builtin.AtomicOrder.SeqCst) == 0) return false;
+    lockFreezing();
+    defer unlockFreezing();
+    var handed = false;
+    var it = freezing;
+    while (it) |f| : (it = f.next) {
+        if (f.source == @ptrCast(*c_void, cf) and f.cancelled == 0) {
+            _ = @atomicRmw(usize, &f.cancelled, builtin.AtomicRmwOp.Xchg, 1, builtin.AtomicOrder.SeqCst);
+            handed = handed or !f.built;
+        }
+    }
+    return handed;
+}
+
 pub fn RegisterTypes(ctx: *redis.RedisModuleCtx) !void {
 
+    // 6 bit fingerprint, bit-packed
+    Type6 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kfp06", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoad6, CFSave6, CFRewrite6, CFFree6, CFMemUsage6, CFFreeEffort6));
+    if (Type6 == null) return error.RegisterError;
+
     // 8 bit fingerprint
-    Type8 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-1", CUCKOO_FILTER_ENCODING_VERSION, &redis.RedisModuleTypeMethods{
-        .version = redis.REDISMODULE_TYPE_METHOD_VERSION,
-        .rdb_load = CFLoad8,
-        .rdb_save = CFSave8,
-        .aof_rewrite = CFRewrite,
-        .free = CFFree8,
-        .mem_usage = CFMemUsage8,
-        .digest = CFDigest,
-    });
+    Type8 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-1", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoad8, CFSave8, CFRewrite8, CFFree8, CFMemUsage8, CFFreeEffort8));
     if (Type8 == null) return error.RegisterError;
 
+    // 12 bit fingerprint, bit-packed
+    Type12 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kfp12", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoad12, CFSave12, CFRewrite12, CFFree12, CFMemUsage12, CFFreeEffort12));
+    if (Type12 == null) return error.RegisterError;
+
     // 16 bit fingerprint
-    Type16 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-2", CUCKOO_FILTER_ENCODING_VERSION, &redis.RedisModuleTypeMethods{
-        .version = redis.REDISMODULE_TYPE_METHOD_VERSION,
-        .rdb_load = CFLoad16,
-        .rdb_save = CFSave16,
-        .aof_rewrite = CFRewrite,
-        .free = CFFree16,
-        .mem_usage = CFMemUsage16,
-        .digest = CFDigest,
-    });
+    Type16 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-2", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoad16, CFSave16, CFRewrite16, CFFree16, CFMemUsage16, CFFreeEffort16));
     if (Type16 == null) return error.RegisterError;
 
     // 32 bit fingerprint
-    Type32 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-4", CUCKOO_FILTER_ENCODING_VERSION, &redis.RedisModuleTypeMethods{
+    Type32 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kff-4", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoad32, CFSave32, CFRewrite32, CFFree32, CFMemUsage32, CFFreeEffort32));
+    if (Type32 == null) return error.RegisterError;
+
+    // Scalable, 6 bit fingerprint
+    ScalableType6 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-ksp06", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoad6, CFScalableSave6, CFScalableRewrite6, CFScalableFree6, CFScalableMemUsage6, CFScalableFreeEffort6));
+    if (ScalableType6 == null) return error.RegisterError;
+
+    // Scalable, 8 bit fingerprint
+    ScalableType8 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-ksc-1", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoad8, CFScalableSave8, CFScalableRewrite8, CFScalableFree8, CFScalableMemUsage8, CFScalableFreeEffort8));
+    if (ScalableType8 == null) return error.RegisterError;
+
+    // Scalable, 12 bit fingerprint
+    ScalableType12 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-ksp12", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoad12, CFScalableSave12, CFScalableRewrite12, CFScalableFree12, CFScalableMemUsage12, CFScalableFreeEffort12));
+    if (ScalableType12 == null) return error.RegisterError;
+
+    // Scalable, 16 bit fingerprint
+    ScalableType16 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-ksc-2", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoad16, CFScalableSave16, CFScalableRewrite16, CFScalableFree16, CFScalableMemUsage16, CFScalableFreeEffort16));
+    if (ScalableType16 == null) return error.RegisterError;
+
+    // Scalable, 32 bit fingerprint
+    ScalableType32 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-ksc-4", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoad32, CFScalableSave32, CFScalableRewrite32, CFScalableFree32, CFScalableMemUsage32, CFScalableFreeEffort32));
+    if (ScalableType32 == null) return error.RegisterError;
+
+    // 9 bit fingerprint, semi-sorted
+    SemiSortedType9 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kss09", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoadSemiSorted9, CFSaveSemiSorted9, CFRewriteSemiSorted9, CFFreeSemiSorted9, CFMemUsageSemiSorted9, CFFreeEffortSemiSorted9));
+    if (SemiSortedType9 == null) return error.RegisterError;
+
+    // 13 bit fingerprint, semi-sorted
+    SemiSortedType13 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kss13", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoadSemiSorted13, CFSaveSemiSorted13, CFRewriteSemiSorted13, CFFreeSemiSorted13, CFMemUsageSemiSorted13, CFFreeEffortSemiSorted13));
+    if (SemiSortedType13 == null) return error.RegisterError;
+
+    // 17 bit fingerprint, semi-sorted
+    SemiSortedType17 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kss17", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFLoadSemiSorted17, CFSaveSemiSorted17, CFRewriteSemiSorted17, CFFreeSemiSorted17, CFMemUsageSemiSorted17, CFFreeEffortSemiSorted17));
+    if (SemiSortedType17 == null) return error.RegisterError;
+
+    // Scalable, 9 bit fingerprint, semi-sorted
+    ScalableSemiSortedType9 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kcs09", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoadSemiSorted9, CFScalableSaveSemiSorted9, CFScalableRewriteSemiSorted9, CFScalableFreeSemiSorted9, CFScalableMemUsageSemiSorted9, CFScalableFreeEffortSemiSorted9));
+    if (ScalableSemiSortedType9 == null) return error.RegisterError;
+
+    // Scalable, 13 bit fingerprint, semi-sorted
+    ScalableSemiSortedType13 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kcs13", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoadSemiSorted13, CFScalableSaveSemiSorted13, CFScalableRewriteSemiSorted13, CFScalableFreeSemiSorted13, CFScalableMemUsageSemiSorted13, CFScalableFreeEffortSemiSorted13));
+    if (ScalableSemiSortedType13 == null) return error.RegisterError;
+
+    // Scalable, 17 bit fingerprint, semi-sorted
+    ScalableSemiSortedType17 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kcs17", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFScalableLoadSemiSorted17, CFScalableSaveSemiSorted17, CFScalableRewriteSemiSorted17, CFScalableFreeSemiSorted17, CFScalableMemUsageSemiSorted17, CFScalableFreeEffortSemiSorted17));
+    if (ScalableSemiSortedType17 == null) return error.RegisterError;
+
+    // Frozen, 6 bit fingerprint
+    FrozenType6 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzp06", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoad6, CFFrozenSave6, CFFrozenRewrite6, CFFrozenFree6, CFFrozenMemUsage6, CFFrozenFreeEffort6));
+    if (FrozenType6 == null) return error.RegisterError;
+
+    // Frozen, 8 bit fingerprint
+    FrozenType8 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzp08", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoad8, CFFrozenSave8, CFFrozenRewrite8, CFFrozenFree8, CFFrozenMemUsage8, CFFrozenFreeEffort8));
+    if (FrozenType8 == null) return error.RegisterError;
+
+    // Frozen, 12 bit fingerprint
+    FrozenType12 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzp12", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoad12, CFFrozenSave12, CFFrozenRewrite12, CFFrozenFree12, CFFrozenMemUsage12, CFFrozenFreeEffort12));
+    if (FrozenType12 == null) return error.RegisterError;
+
+    // Frozen, 16 bit fingerprint
+    FrozenType16 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzp16", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoad16, CFFrozenSave16, CFFrozenRewrite16, CFFrozenFree16, CFFrozenMemUsage16, CFFrozenFreeEffort16));
+    if (FrozenType16 == null) return error.RegisterError;
+
+    // Frozen, 32 bit fingerprint
+    FrozenType32 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzp32", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoad32, CFFrozenSave32, CFFrozenRewrite32, CFFrozenFree32, CFFrozenMemUsage32, CFFrozenFreeEffort32));
+    if (FrozenType32 == null) return error.RegisterError;
+
+    // Frozen, 9 bit fingerprint, semi-sorted
+    FrozenSemiSortedType9 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzs09", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoadSemiSorted9, CFFrozenSaveSemiSorted9, CFFrozenRewriteSemiSorted9, CFFrozenFreeSemiSorted9, CFFrozenMemUsageSemiSorted9, CFFrozenFreeEffortSemiSorted9));
+    if (FrozenSemiSortedType9 == null) return error.RegisterError;
+
+    // Frozen, 13 bit fingerprint, semi-sorted
+    FrozenSemiSortedType13 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzs13", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoadSemiSorted13, CFFrozenSaveSemiSorted13, CFFrozenRewriteSemiSorted13, CFFrozenFreeSemiSorted13, CFFrozenMemUsageSemiSorted13, CFFrozenFreeEffortSemiSorted13));
+    if (FrozenSemiSortedType13 == null) return error.RegisterError;
+
+    // Frozen, 17 bit fingerprint, semi-sorted
+    FrozenSemiSortedType17 = redis.RedisModule_CreateDataType.?(ctx, c"ccf-kzs17", CUCKOO_FILTER_ENCODING_VERSION, &typeMethods(CFFrozenLoadSemiSorted17, CFFrozenSaveSemiSorted17, CFFrozenRewriteSemiSorted17, CFFrozenFreeSemiSorted17, CFFrozenMemUsageSemiSorted17, CFFrozenFreeEffortSemiSorted17));
+    if (FrozenSemiSortedType17 == null) return error.RegisterError;
+}
+
+fn typeMethods(
+    rdb_load: redis.RedisModuleTypeLoadFunc,
+    rdb_save: redis.RedisModuleTypeSaveFunc,
+    aof_rewrite: redis.RedisModuleTypeRewriteFunc,
+    free: redis.RedisModuleTypeFreeFunc,
+    mem_usage: redis.RedisModuleTypeMemUsageFunc,
+    free_effort: redis.RedisModuleTypeFreeEffortFunc,
+) redis.RedisModuleTypeMethods {
+    return redis.RedisModuleTypeMethods{
         .version = redis.REDISMODULE_TYPE_METHOD_VERSION,
-        .rdb_load = CFLoad32,
-        .rdb_save = CFSave32,
-        .aof_rewrite = CFRewrite,
-        .free = CFFree32,
-        .mem_usage = CFMemUsage32,
+        .rdb_load = rdb_load,
+        .rdb_save = rdb_save,
+        .aof_rewrite = aof_rewrite,
+        .free = free,
+        .mem_usage = mem_usage,
         .digest = CFDigest,
-    });
-    if (Type32 == null) return error.RegisterError;
+        .aux_load = null,
+        .aux_save = null,
+        .aux_save_triggers = 0,
+        .free_effort = free_effort,
+        .unlink = null,
+        .copy = null,
+        .defrag = null,
+    };
 }
 
+export fn CFLoad6(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFLoadImpl(Filter6, rdb, encver);
+}
 export fn CFLoad8(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
     return CFLoadImpl(Filter8, rdb, encver);
 }
+export fn CFLoad12(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFLoadImpl(Filter12, rdb, encver);
+}
 export fn CFLoad16(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
     return CFLoadImpl(Filter16, rdb, encver);
 }
 export fn CFLoad32(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
     return CFLoadImpl(Filter32, rdb, encver);
 }
-inline fn CFLoadImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
-    if (encver != CUCKOO_FILTER_ENCODING_VERSION) {
-        // We should actually log an error here, or try to implement
-        // the ability to load older versions of our data structure.
-        return null;
+export fn CFLoadSemiSorted9(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFLoadImpl(SemiSortedFilter9, rdb, encver);
+}
+export fn CFLoadSemiSorted13(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFLoadImpl(SemiSortedFilter13, rdb, encver);
+}
+export fn CFLoadSemiSorted17(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFLoadImpl(SemiSortedFilter17, rdb, encver);
+}
+inline fn CFLoadImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    if (!supportedEncver(rdb, encver)) return null;
+
+    // Allocate cf struct
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+
+    // Load
+    const prng_state = [2]u64{ redis.RedisModule_LoadUnsigned.?(rdb), redis.RedisModule_LoadUnsigned.?(rdb) };
+    const hasher = loadHasher(rdb, encver);
+    const options = loadOptions(rdb, encver);
+    cf.* = CFType{
+        .readers = 0,
+        .storage = default_storage,
+        .hasher = hasher,
+        .stats = undefined,
+        .threaded_stats = undefined,
+        .cf = loadFilter(@typeOf(cf.cf), rdb, encver, default_storage),
+    };
+    setPrngState(cf, prng_state);
+    applyOptions(cf, options);
+    initStats(cf);
+
+    return cf;
+}
+
+export fn CFScalableLoad6(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableFilter6, rdb, encver);
+}
+export fn CFScalableLoad8(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableFilter8, rdb, encver);
+}
+export fn CFScalableLoad12(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableFilter12, rdb, encver);
+}
+export fn CFScalableLoad16(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableFilter16, rdb, encver);
+}
+export fn CFScalableLoad32(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableFilter32, rdb, encver);
+}
+export fn CFScalableLoadSemiSorted9(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableSemiSortedFilter9, rdb, encver);
+}
+export fn CFScalableLoadSemiSorted13(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableSemiSortedFilter13, rdb, encver);
+}
+export fn CFScalableLoadSemiSorted17(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFScalableLoadImpl(ScalableSemiSortedFilter17, rdb, encver);
+}
+inline fn CFScalableLoadImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    if (!supportedEncver(rdb, encver)) return null;
+
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    const scalableCFType = @typeOf(cf.cf);
+    const stageCFType = @typeOf(cf.cf.stages[0]);
+
+    const prng_state = [2]u64{ redis.RedisModule_LoadUnsigned.?(rdb), redis.RedisModule_LoadUnsigned.?(rdb) };
+    cf.hasher = loadHasher(rdb, encver);
+    const options = loadOptions(rdb, encver);
+    cf.readers = 0;
+    const growth = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    const broken = redis.RedisModule_LoadUnsigned.?(rdb) != 0;
+    const stage_count = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    if (stage_count == 0 or stage_count > scalableCFType.MaxStages) @panic("trying to load corrupted scalable filter from RDB!");
+
+    const stages = @ptrCast([*]stageCFType, @alignCast(@alignOf(stageCFType), redis.RedisModule_Alloc.?(stage_count * @sizeOf(stageCFType))));
+    for (stages[0..stage_count]) |*stage| stage.* = loadFilter(stageCFType, rdb, encver, default_storage);
+
+    cf.cf = scalableCFType{
+        .stages = stages[0..stage_count],
+        .growth = growth,
+        .broken = broken,
+        .storage = default_storage,
+        .stats = null,
+        .window = null,
+    };
+    if (encver >= 6) cf.cf.window = loadWindow(rdb, &cf.cf);
+    if (cf.cf.window != null) addLoadedWindowKey(rdb);
+    setPrngState(cf, prng_state);
+    applyOptions(cf, options);
+    initStats(cf);
+
+    return cf;
+}
+
+// Version 1 is from before the module was rewritten in Zig, its layout is
+// not known to this code. Redis refuses to start when a load returns null.
+fn supportedEncver(rdb: ?*redis.RedisModuleIO, encver: c_int) bool {
+    if (encver >= 2 and encver <= CUCKOO_FILTER_ENCODING_VERSION) return true;
+    redis.RedisModule_LogIOError.?(rdb, c"warning", c"cuckoofilter: can't load encoding version %d (supported: 2 to %d)", encver, c_int(CUCKOO_FILTER_ENCODING_VERSION));
+    return false;
+}
+
+// Version 2 keys were saved without a hash function, they get the default one.
+fn loadHasher(rdb: ?*redis.RedisModuleIO, encver: c_int) hashing.Hasher {
+    if (encver < 3) return hashing.Hasher.Default;
+    const kind = hashing.fromId(redis.RedisModule_LoadUnsigned.?(rdb)) catch @panic("trying to load a filter with an unknown hash function from RDB!");
+    return hashing.Hasher{ .kind = kind, .seed = redis.RedisModule_LoadUnsigned.?(rdb) };
+}
+
+fn saveHasher(rdb: ?*redis.RedisModuleIO, hasher: hashing.Hasher) void {
+    redis.RedisModule_SaveUnsigned.?(rdb, hashing.toId(hasher.kind));
+    redis.RedisModule_SaveUnsigned.?(rdb, hasher.seed);
+}
+
+fn loadOptions(rdb: ?*redis.RedisModuleIO, encver: c_int) Options {
+    if (encver < 4) return Options.Default;
+    return Options.fromBits(redis.RedisModule_LoadUnsigned.?(rdb)) catch @panic("trying to load a filter with unknown options from RDB!");
+}
+
+// Loads a single filter saved by `saveFilter`.
+fn loadFilter(comptime realCFType: type, rdb: ?*redis.RedisModuleIO, encver: c_int, storage: Storage) realCFType {
+    return realCFType{
+        .rand_fn = null,
+        .prng_state = cuckoo.DefaultPrngState,
+        .insertion = .RandomWalk,
+        .locality = .Table,
+        .alt_masks = []usize{ 0, 0 },
+        .stats = null,
+        .dirty = null,
+        .homeless_fp = @intCast(realCFType.FPType, redis.RedisModule_LoadUnsigned.?(rdb)),
+        .homeless_bucket_idx = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb)),
+        .fpcount = redis.RedisModule_LoadUnsigned.?(rdb),
+        .broken = redis.RedisModule_LoadUnsigned.?(rdb) != 0,
+        .buckets = blk: {
+            const memory = if (encver < 5) loadBucketsBuffer(rdb, storage) else loadBuckets(rdb, storage);
+            break :blk realCFType.bytesToBuckets(memory) catch @panic("trying to load corrupted buckets from RDB!");
+        },
+    };
+}
+
+// Bucket memory up to version 4, a single string.
+// Heap filters adopt the buffer allocated by Redis, huge pages
+// filters need a copy.
+fn loadBucketsBuffer(rdb: ?*redis.RedisModuleIO, storage: Storage) []align(@alignOf(usize)) u8 {
+    var bytes_len: usize = undefined;
+    const buckets_ptr = @alignCast(@alignOf(usize), redis.RedisModule_LoadStringBuffer.?(rdb, &bytes_len))[0..bytes_len];
+    if (storage == .Heap) {
+        metrics.addBucketMemory(bytes_len);
+        return buckets_ptr;
     }
 
-    // Allocate cf struct
-    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    // Same as running out of memory for the Redis allocator.
+    const memory = allocBuckets(bytes_len, storage) catch @panic("could not allocate huge pages while loading RDB!");
+    std.mem.copy(u8, memory, buckets_ptr);
+    redis.RedisModule_Free.?(buckets_ptr.ptr);
+    return memory;
+}
 
-    // Load
-    const realCFType = @typeOf(cf.cf);
-    cf.* = CFType{
-        .s = [2]u64{ redis.RedisModule_LoadUnsigned.?(rdb), redis.RedisModule_LoadUnsigned.?(rdb) },
-        .cf = realCFType{
-            .rand_fn = null,
-            .homeless_fp = @intCast(realCFType.FPType, redis.RedisModule_LoadUnsigned.?(rdb)),
-            .homeless_bucket_idx = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb)),
-            .fpcount = redis.RedisModule_LoadUnsigned.?(rdb),
-            .broken = redis.RedisModule_LoadUnsigned.?(rdb) != 0,
-            .buckets = blk: {
-                var bytes_len: usize = undefined;
-                const buckets_ptr = @alignCast(@alignOf(usize), redis.RedisModule_LoadStringBuffer.?(rdb, &bytes_len))[0..bytes_len];
-                break :blk realCFType.bytesToBuckets(buckets_ptr) catch @panic("trying to load corrupted buckets from RDB!");
-            },
-        },
-    };
+// Bucket memory written by `saveBuckets`. It starts out zeroed (and,
+// being fresh pages, not even committed), so only non-empty chunks get
+// copied in, one at a time: loading never takes twice the filter memory.
+fn loadBuckets(rdb: ?*redis.RedisModuleIO, storage: Storage) []align(@alignOf(usize)) u8 {
+    const len = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    const chunk_size = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    if (len == 0 or len > MAX_SIZE or chunk_size == 0 or chunk_size > MAX_SIZE) @panic("trying to load corrupted buckets from RDB!");
 
-    return cf;
+    const memory = allocBuckets(len, storage) catch @panic("could not allocate huge pages while loading RDB!");
+    var offset: usize = 0;
+    while (true) {
+        const empty = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+        const chunks_left = (memory.len - offset + chunk_size - 1) / chunk_size;
+        if (empty > chunks_left) @panic("trying to load corrupted buckets from RDB!");
+        offset = std.math.min(offset + empty * chunk_size, memory.len);
+        if (offset == memory.len) break;
+
+        var chunk_len: usize = undefined;
+        const chunk = redis.RedisModule_LoadStringBuffer.?(rdb, &chunk_len)[0..chunk_len];
+        defer redis.RedisModule_Free.?(chunk.ptr);
+        if (chunk_len != std.math.min(chunk_size, memory.len - offset)) @panic("trying to load corrupted buckets from RDB!");
+        std.mem.copy(u8, memory[offset..], chunk);
+        offset += chunk_len;
+    }
+    return memory;
 }
 
+export fn CFSave6(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFSaveImpl(Filter6, rdb, value);
+}
 export fn CFSave8(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
     CFSaveImpl(Filter8, rdb, value);
 }
+export fn CFSave12(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFSaveImpl(Filter12, rdb, value);
+}
 export fn CFSave16(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
     CFSaveImpl(Filter16, rdb, value);
 }
 export fn CFSave32(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
     CFSaveImpl(Filter32, rdb, value);
 }
+export fn CFSaveSemiSorted9(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFSaveImpl(SemiSortedFilter9, rdb, value);
+}
+export fn CFSaveSemiSorted13(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFSaveImpl(SemiSortedFilter13, rdb, value);
+}
+export fn CFSaveSemiSorted17(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFSaveImpl(SemiSortedFilter17, rdb, value);
+}
 inline fn CFSaveImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
 
     // Write cuckoo struct data
-    redis.RedisModule_SaveUnsigned.?(rdb, cf.s[0]);
-    redis.RedisModule_SaveUnsigned.?(rdb, cf.s[1]);
-    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.homeless_fp);
-    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.homeless_bucket_idx);
-    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.fpcount);
+    const prng_state = prngState(cf);
+    redis.RedisModule_SaveUnsigned.?(rdb, prng_state[0]);
+    redis.RedisModule_SaveUnsigned.?(rdb, prng_state[1]);
+    saveHasher(rdb, cf.hasher);
+    redis.RedisModule_SaveUnsigned.?(rdb, filterOptions(cf).toBits());
+    saveFilter(rdb, &cf.cf);
+}
+
+export fn CFScalableSave6(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableFilter6, rdb, value);
+}
+export fn CFScalableSave8(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableFilter8, rdb, value);
+}
+export fn CFScalableSave12(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableFilter12, rdb, value);
+}
+export fn CFScalableSave16(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableFilter16, rdb, value);
+}
+export fn CFScalableSave32(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableFilter32, rdb, value);
+}
+export fn CFScalableSaveSemiSorted9(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableSemiSortedFilter9, rdb, value);
+}
+export fn CFScalableSaveSemiSorted13(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableSemiSortedFilter13, rdb, value);
+}
+export fn CFScalableSaveSemiSorted17(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFScalableSaveImpl(ScalableSemiSortedFilter17, rdb, value);
+}
+inline fn CFScalableSaveImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
+
+    const prng_state = prngState(cf);
+    redis.RedisModule_SaveUnsigned.?(rdb, prng_state[0]);
+    redis.RedisModule_SaveUnsigned.?(rdb, prng_state[1]);
+    saveHasher(rdb, cf.hasher);
+    redis.RedisModule_SaveUnsigned.?(rdb, filterOptions(cf).toBits());
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.growth);
     if (cf.cf.broken) redis.RedisModule_SaveUnsigned.?(rdb, 1) else redis.RedisModule_SaveUnsigned.?(rdb, 0);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.stages.len);
 
-    // Write buckets
-    const bytes = @sliceToBytes(cf.cf.buckets);
-    redis.RedisModule_SaveStringBuffer.?(rdb, bytes.ptr, bytes.len);
+    // Stages are saved oldest first
+    for (cf.cf.stages) |*stage| saveFilter(rdb, stage);
+    saveWindow(rdb, cf.cf.window);
 }
 
+// An interval of 0 means that the filter is not windowed.
+fn loadWindow(rdb: ?*redis.RedisModuleIO, cf: var) ?Window {
+    const interval = redis.RedisModule_LoadUnsigned.?(rdb);
+    if (interval == 0) return null;
+    const window = Window{
+        .interval = interval,
+        .current = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb)),
+        .rotated_at = redis.RedisModule_LoadUnsigned.?(rdb),
+        .cleared = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb)),
+        .expired = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb)),
+    };
+    cf.check_window(window) catch @panic("trying to load corrupted windowed filter from RDB!");
+    return window;
+}
+
+// Set once the missing key name has been logged, not to log it for
+// every windowed filter in the RDB file.
+var warned_no_key_name = false;
+
+// When Redis doesn't tell the database of the key being loaded, the window
+// timer looks for it once loading is over. On Redis versions that don't tell
+// the key name, the windows of filters loaded from RDB don't move (RESTORE
+// still gets tracked, by its keyspace event): the filters load anyway, not
+// to lose the data, with a warning.
+fn addLoadedWindowKey(rdb: ?*redis.RedisModuleIO) void {
+    const name = if (redis.RedisModule_GetKeyNameFromIO) |getKeyName| getKeyName(rdb) else null;
+    if (name == null) {
+        if (!warned_no_key_name) redis.RedisModule_LogIOError.?(rdb, c"warning", c"cuckoofilter: this Redis version doesn't tell the names of the keys being loaded, windows loaded from RDB won't move until the filters are renamed or restored");
+        warned_no_key_name = true;
+        return;
+    }
+    addWindowKey(if (getDbIdFromIO) |getDbId| getDbId(rdb) else UnknownDb, name);
+}
+
+fn saveWindow(rdb: ?*redis.RedisModuleIO, window: ?Window) void {
+    const w = window orelse return redis.RedisModule_SaveUnsigned.?(rdb, 0);
+    redis.RedisModule_SaveUnsigned.?(rdb, w.interval);
+    redis.RedisModule_SaveUnsigned.?(rdb, w.current);
+    redis.RedisModule_SaveUnsigned.?(rdb, w.rotated_at);
+    redis.RedisModule_SaveUnsigned.?(rdb, w.cleared);
+    redis.RedisModule_SaveUnsigned.?(rdb, w.expired);
+}
+
+// Writes the fields and the buckets of a single filter.
+fn saveFilter(rdb: ?*redis.RedisModuleIO, cf: var) void {
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.homeless_fp);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.homeless_bucket_idx);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.fpcount);
+    if (cf.broken) redis.RedisModule_SaveUnsigned.?(rdb, 1) else redis.RedisModule_SaveUnsigned.?(rdb, 0);
+
+    saveBuckets(rdb, @sliceToBytes(cf.buckets));
+}
+
+// Writes the length of bucket memory and the chunk size, then each
+// chunk that has at least one fingerprint, preceded by the number of
+// empty chunks skipped since the previous one. A last count covers
+// the empty chunks at the end, so it's always there (possibly 0).
+fn saveBuckets(rdb: ?*redis.RedisModuleIO, bytes: []const u8) void {
+    redis.RedisModule_SaveUnsigned.?(rdb, bytes.len);
+    redis.RedisModule_SaveUnsigned.?(rdb, RDB_CHUNK_SIZE);
+    var empty: u64 = 0;
+    var offset: usize = 0;
+    while (offset < bytes.len) : (offset += RDB_CHUNK_SIZE) {
+        const chunk = bytes[offset..std.math.min(offset + RDB_CHUNK_SIZE, bytes.len)];
+        if (is_zeroed(chunk)) {
+            empty += 1;
+            continue;
+        }
+        redis.RedisModule_SaveUnsigned.?(rdb, empty);
+        redis.RedisModule_SaveStringBuffer.?(rdb, chunk.ptr, chunk.len);
+        empty = 0;
+    }
+    redis.RedisModule_SaveUnsigned.?(rdb, empty);
+}
+
+export fn CFFree6(cf: ?*c_void) void {
+    CFFreeImpl(Filter6, cf);
+}
 export fn CFFree8(cf: ?*c_void) void {
     CFFreeImpl(Filter8, cf);
 }
+export fn CFFree12(cf: ?*c_void) void {
+    CFFreeImpl(Filter12, cf);
+}
 export fn CFFree16(cf: ?*c_void) void {
     CFFreeImpl(Filter16, cf);
 }
 export fn CFFree32(cf: ?*c_void) void {
     CFFreeImpl(Filter32, cf);
 }
+export fn CFFreeSemiSorted9(cf: ?*c_void) void {
+    CFFreeImpl(SemiSortedFilter9, cf);
+}
+export fn CFFreeSemiSorted13(cf: ?*c_void) void {
+    CFFreeImpl(SemiSortedFilter13, cf);
+}
+export fn CFFreeSemiSorted17(cf: ?*c_void) void {
+    CFFreeImpl(SemiSortedFilter17, cf);
+}
 inline fn CFFreeImpl(comptime CFType: type, value: ?*c_void) void {
     const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
-    redis.RedisModule_Free.?(cf.cf.buckets.ptr);
+    // Freezes can take a while, don't wait for them.
+    if (cancelFreezing(cf)) return;
+    freeUnread(CFType, cf);
+}
+
+// Frees a plain filter that nobody reads anymore.
+pub fn freeFilter(cf: var) void {
+    freeBuckets(@sliceToBytes(cf.cf.buckets), cf.storage);
+    if (cf.cf.dirty) |dirty| freeDirty(dirty);
+    redis.RedisModule_Free.?(cf);
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+}
+
+export fn CFScalableFree6(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableFilter6, cf);
+}
+export fn CFScalableFree8(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableFilter8, cf);
+}
+export fn CFScalableFree12(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableFilter12, cf);
+}
+export fn CFScalableFree16(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableFilter16, cf);
+}
+export fn CFScalableFree32(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableFilter32, cf);
+}
+export fn CFScalableFreeSemiSorted9(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableSemiSortedFilter9, cf);
+}
+export fn CFScalableFreeSemiSorted13(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableSemiSortedFilter13, cf);
+}
+export fn CFScalableFreeSemiSorted17(cf: ?*c_void) void {
+    CFScalableFreeImpl(ScalableSemiSortedFilter17, cf);
+}
+inline fn CFScalableFreeImpl(comptime CFType: type, value: ?*c_void) void {
+    freeUnread(CFType, @ptrCast(*CFType, @alignCast(@alignOf(usize), value)));
+}
+
+fn freeScalable(cf: var) void {
+    cf.cf.deinit();
     redis.RedisModule_Free.?(cf);
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Sub, 1, builtin.AtomicOrder.SeqCst);
+}
+
+export fn CFFreeEffort6(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(Filter6, value);
+}
+export fn CFFreeEffort8(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(Filter8, value);
+}
+export fn CFFreeEffort12(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(Filter12, value);
+}
+export fn CFFreeEffort16(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(Filter16, value);
+}
+export fn CFFreeEffort32(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(Filter32, value);
+}
+export fn CFFreeEffortSemiSorted9(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(SemiSortedFilter9, value);
+}
+export fn CFFreeEffortSemiSorted13(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(SemiSortedFilter13, value);
+}
+export fn CFFreeEffortSemiSorted17(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFreeEffortImpl(SemiSortedFilter17, value);
+}
+inline fn CFFreeEffortImpl(comptime CFType: type, value: ?*const c_void) usize {
+    const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    return @sliceToBytes(cf.cf.buckets).len / FREE_EFFORT_UNIT;
+}
+
+export fn CFScalableFreeEffort6(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableFilter6, value);
+}
+export fn CFScalableFreeEffort8(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableFilter8, value);
+}
+export fn CFScalableFreeEffort12(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableFilter12, value);
+}
+export fn CFScalableFreeEffort16(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableFilter16, value);
+}
+export fn CFScalableFreeEffort32(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableFilter32, value);
+}
+export fn CFScalableFreeEffortSemiSorted9(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableSemiSortedFilter9, value);
+}
+export fn CFScalableFreeEffortSemiSorted13(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableSemiSortedFilter13, value);
+}
+export fn CFScalableFreeEffortSemiSorted17(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFScalableFreeEffortImpl(ScalableSemiSortedFilter17, value);
+}
+inline fn CFScalableFreeEffortImpl(comptime CFType: type, value: ?*const c_void) usize {
+    const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    var effort: usize = cf.cf.stages.len;
+    for (cf.cf.stages) |stage| effort += @sliceToBytes(stage.buckets).len / FREE_EFFORT_UNIT;
+    return effort;
 }
 
+export fn CFMemUsage6(value: ?*const c_void) usize {
+    return CFMemUsageImpl(Filter6, value);
+}
 export fn CFMemUsage8(value: ?*const c_void) usize {
     return CFMemUsageImpl(Filter8, value);
 }
+export fn CFMemUsage12(value: ?*const c_void) usize {
+    return CFMemUsageImpl(Filter12, value);
+}
 export fn CFMemUsage16(value: ?*const c_void) usize {
     return CFMemUsageImpl(Filter16, value);
 }
 export fn CFMemUsage32(value: ?*const c_void) usize {
     return CFMemUsageImpl(Filter32, value);
 }
+export fn CFMemUsageSemiSorted9(value: ?*const c_void) usize {
+    return CFMemUsageImpl(SemiSortedFilter9, value);
+}
+export fn CFMemUsageSemiSorted13(value: ?*const c_void) usize {
+    return CFMemUsageImpl(SemiSortedFilter13, value);
+}
+export fn CFMemUsageSemiSorted17(value: ?*const c_void) usize {
+    return CFMemUsageImpl(SemiSortedFilter17, value);
+}
 inline fn CFMemUsageImpl(comptime CFType: type, value: ?*const c_void) usize {
     const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    const dirty = if (cf.cf.dirty) |d| @sizeOf(cuckoo.Dirty) + @sliceToBytes(d.range_epochs).len else 0;
+    return @sizeOf(CFType) + bucketsFootprint(@sliceToBytes(cf.cf.buckets).len, cf.storage) + dirty;
+}
+
+export fn CFScalableMemUsage6(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableFilter6, value);
+}
+export fn CFScalableMemUsage8(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableFilter8, value);
+}
+export fn CFScalableMemUsage12(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableFilter12, value);
+}
+export fn CFScalableMemUsage16(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableFilter16, value);
+}
+export fn CFScalableMemUsage32(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableFilter32, value);
+}
+export fn CFScalableMemUsageSemiSorted9(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableSemiSortedFilter9, value);
+}
+export fn CFScalableMemUsageSemiSorted13(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableSemiSortedFilter13, value);
+}
+export fn CFScalableMemUsageSemiSorted17(value: ?*const c_void) usize {
+    return CFScalableMemUsageImpl(ScalableSemiSortedFilter17, value);
+}
+inline fn CFScalableMemUsageImpl(comptime CFType: type, value: ?*const c_void) usize {
+    const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    var total: usize = @sizeOf(CFType) + @sliceToBytes(cf.cf.stages).len;
+    for (cf.cf.stages) |stage| total += bucketsFootprint(@sliceToBytes(stage.buckets).len, cf.cf.storage);
+    return total;
+}
+
+export fn CFRewrite6(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(Filter6, aof, key, value);
+}
+export fn CFRewrite8(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(Filter8, aof, key, value);
+}
+export fn CFRewrite12(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(Filter12, aof, key, value);
+}
+export fn CFRewrite16(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(Filter16, aof, key, value);
+}
+export fn CFRewrite32(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(Filter32, aof, key, value);
+}
+export fn CFRewriteSemiSorted9(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(SemiSortedFilter9, aof, key, value);
+}
+export fn CFRewriteSemiSorted13(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(SemiSortedFilter13, aof, key, value);
+}
+export fn CFRewriteSemiSorted17(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFRewriteImpl(SemiSortedFilter17, aof, key, value);
+}
+
+// The filter is rewritten as a CF.LOADHEADER command, which recreates the key
+// with all the fields of the struct and zeroed buckets, followed by CF.LOADCHUNK
+// commands that copy the bucket memory back in, at most AOF_CHUNK_SIZE bytes
+// at a time. Chunks that contain only empty buckets are skipped.
+inline fn CFRewriteImpl(comptime CFType: type, aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
     const realCFType = @typeOf(cf.cf);
-    return @sizeOf(CFType) + (@sliceToBytes(cf.cf.buckets).len * @sizeOf(realCFType.FPType));
+    redis.RedisModule_EmitAOF.?(
+        aof,
+        c"CF.LOADHEADER",
+        c"sclllllllccccclcccc",
+        key,
+        fpsizeArg(realCFType.FPType),
+        @intCast(c_longlong, cf.cf.nominal_size()),
+        @bitCast(c_longlong, prngState(cf)[0]),
+        @bitCast(c_longlong, prngState(cf)[1]),
+        c_longlong(cf.cf.homeless_fp),
+        @intCast(c_longlong, homelessBucketIdx(&cf.cf)),
+        @intCast(c_longlong, cf.cf.fpcount),
+        c_longlong(@boolToInt(cf.cf.broken)),
+        c"ENCODING",
+        encodingArg(realCFType),
+        c"HASH",
+        hashArg(cf.hasher.kind),
+        c"SEED",
+        @bitCast(c_longlong, cf.hasher.seed),
+        c"INSERTION",
+        insertionArg(filterOptions(cf).insertion),
+        c"LOCALITY",
+        localityArg(filterOptions(cf).locality),
+    );
+    emitChunks(aof, key, @sliceToBytes(cf.cf.buckets));
+}
+
+export fn CFScalableRewrite6(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableFilter6, aof, key, value);
+}
+export fn CFScalableRewrite8(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableFilter8, aof, key, value);
+}
+export fn CFScalableRewrite12(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableFilter12, aof, key, value);
+}
+export fn CFScalableRewrite16(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableFilter16, aof, key, value);
+}
+export fn CFScalableRewrite32(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableFilter32, aof, key, value);
+}
+export fn CFScalableRewriteSemiSorted9(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableSemiSortedFilter9, aof, key, value);
+}
+export fn CFScalableRewriteSemiSorted13(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableSemiSortedFilter13, aof, key, value);
+}
+export fn CFScalableRewriteSemiSorted17(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFScalableRewriteImpl(ScalableSemiSortedFilter17, aof, key, value);
+}
+
+// Same as plain filters, with the first stage carried by CF.LOADHEADER
+// (plus the GROWTH option) and every other stage pushed by CF.LOADSTAGE.
+// CF.LOADCHUNK always writes into the newest stage. Windowed filters
+// end with a CF.LOADWINDOW, once all the stages are there.
+inline fn CFScalableRewriteImpl(comptime CFType: type, aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
+    const scalableCFType = @typeOf(cf.cf);
+    const first = &cf.cf.stages[0];
+    redis.RedisModule_EmitAOF.?(
+        aof,
+        c"CF.LOADHEADER",
+        c"sclllllllclccccclcccccl",
+        key,
+        fpsizeArg(scalableCFType.FPType),
+        @intCast(c_longlong, first.nominal_size()),
+        @bitCast(c_longlong, prngState(cf)[0]),
+        @bitCast(c_longlong, prngState(cf)[1]),
+        c_longlong(first.homeless_fp),
+        @intCast(c_longlong, homelessBucketIdx(first)),
+        @intCast(c_longlong, first.fpcount),
+        c_longlong(@boolToInt(first.broken)),
+        c"GROWTH",
+        @intCast(c_longlong, cf.cf.growth),
+        c"ENCODING",
+        encodingArg(@typeOf(first.*)),
+        c"HASH",
+        hashArg(cf.hasher.kind),
+        c"SEED",
+        @bitCast(c_longlong, cf.hasher.seed),
+        c"INSERTION",
+        insertionArg(filterOptions(cf).insertion),
+        c"LOCALITY",
+        localityArg(filterOptions(cf).locality),
+        c"BROKEN",
+        c_longlong(@boolToInt(cf.cf.broken)),
+    );
+    emitChunks(aof, key, @sliceToBytes(first.buckets));
+
+    for (cf.cf.stages[1..]) |*stage| {
+        redis.RedisModule_EmitAOF.?(
+            aof,
+            c"CF.LOADSTAGE",
+            c"slllll",
+            key,
+            @intCast(c_longlong, stage.nominal_size()),
+            c_longlong(stage.homeless_fp),
+            @intCast(c_longlong, homelessBucketIdx(stage)),
+            @intCast(c_longlong, stage.fpcount),
+            c_longlong(@boolToInt(stage.broken)),
+        );
+        emitChunks(aof, key, @sliceToBytes(stage.buckets));
+    }
+
+    if (cf.cf.window) |window| {
+        redis.RedisModule_EmitAOF.?(
+            aof,
+            c"CF.LOADWINDOW",
+            c"slllll",
+            key,
+            @intCast(c_longlong, window.interval),
+            @intCast(c_longlong, window.current),
+            @intCast(c_longlong, window.rotated_at),
+            @intCast(c_longlong, window.cleared),
+            @intCast(c_longlong, window.expired),
+        );
+    }
+}
+
+// The fpsize argument of CF.INIT (and CF.LOADHEADER) for a fingerprint type.
+// Semi-sorted filters are created with the fpsize of the plain
+// filter that has their same memory layout.
+fn fpsizeArg(comptime FPType: type) [*c]const u8 {
+    return switch (FPType) {
+        u6 => c"6b",
+        u8, u9 => c"1",
+        u12, u13 => c"12b",
+        u16, u17 => c"2",
+        u32 => c"4",
+        else => @compileError("unsupported fingerprint type"),
+    };
+}
+
+// The ENCODING option of CF.INIT (and CF.LOADHEADER) for a filter type.
+fn encodingArg(comptime realCFType: type) [*c]const u8 {
+    return if (realCFType.IsSemiSorted) c"semisorted" else c"plain";
+}
+
+// The HASH option of CF.INIT (and CF.LOADHEADER).
+pub fn hashArg(kind: hashing.Hash) [*c]const u8 {
+    return switch (kind) {
+        .XXH3 => c"xxh3",
+        .XXH64 => c"xxh64",
+    };
+}
+
+// The INSERTION option of CF.INIT (and CF.LOADHEADER).
+pub fn insertionArg(insertion: cuckoo.Insertion) [*c]const u8 {
+    return switch (insertion) {
+        .RandomWalk => c"randomwalk",
+        .BFS => c"bfs",
+    };
+}
+
+// The LOCALITY option of CF.INIT (and CF.LOADHEADER).
+pub fn localityArg(locality: cuckoo.Locality) [*c]const u8 {
+    return switch (locality) {
+        .Table => c"table",
+        .Line => c"line",
+        .Page => c"page",
+        .HugePage => c"hugepage",
+    };
+}
+
+// `homeless_bucket_idx` is meaningless when there is no homeless fp
+fn homelessBucketIdx(cf: var) usize {
+    return if (cf.homeless_fp == 0) 0 else cf.homeless_bucket_idx;
+}
+
+fn emitChunks(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, bytes: []const u8) void {
+    var offset: usize = 0;
+    while (offset < bytes.len) : (offset += AOF_CHUNK_SIZE) {
+        const chunk = bytes[offset..std.math.min(offset + AOF_CHUNK_SIZE, bytes.len)];
+        if (is_zeroed(chunk)) continue;
+        redis.RedisModule_EmitAOF.?(aof, c"CF.LOADCHUNK", c"slb", key, @intCast(c_longlong, offset), chunk.ptr, chunk.len);
+    }
+}
+
+// Checks a word at a time, RDB saves scan all of bucket memory with it.
+fn is_zeroed(bytes: []const u8) bool {
+    var i: usize = 0;
+    while (i + @sizeOf(usize) <= bytes.len) : (i += @sizeOf(usize)) {
+        if (std.mem.readIntSliceNative(usize, bytes[i .. i + @sizeOf(usize)]) != 0) return false;
+    }
+    for (bytes[i..]) |b| {
+        if (b != 0) return false;
+    }
+    return true;
+}
+
+export fn CFFrozenLoad6(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenFilter6, rdb, encver);
+}
+export fn CFFrozenLoad8(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenFilter8, rdb, encver);
+}
+export fn CFFrozenLoad12(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenFilter12, rdb, encver);
+}
+export fn CFFrozenLoad16(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenFilter16, rdb, encver);
+}
+export fn CFFrozenLoad32(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenFilter32, rdb, encver);
+}
+export fn CFFrozenLoadSemiSorted9(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenSemiSortedFilter9, rdb, encver);
+}
+export fn CFFrozenLoadSemiSorted13(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenSemiSortedFilter13, rdb, encver);
+}
+export fn CFFrozenLoadSemiSorted17(rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    return CFFrozenLoadImpl(FrozenSemiSortedFilter17, rdb, encver);
+}
+inline fn CFFrozenLoadImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, encver: c_int) ?*c_void {
+    if (!supportedEncver(rdb, encver)) return null;
+
+    var cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), redis.RedisModule_Alloc.?(@sizeOf(CFType))));
+    cf.readers = 0;
+    cf.storage = default_storage;
+    cf.hasher = loadHasher(rdb, encver);
+    const bucket_count = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    const locality = redis.RedisModule_LoadUnsigned.?(rdb);
+    const fpcount = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    const seed = redis.RedisModule_LoadUnsigned.?(rdb);
+    const block_length = @intCast(usize, redis.RedisModule_LoadUnsigned.?(rdb));
+    if (locality > @enumToInt(cuckoo.Locality.HugePage)) @panic("trying to load corrupted frozen filter from RDB!");
+    const memory = loadBuckets(rdb, default_storage);
+    cf.cf = @typeOf(cf.cf).load(bucket_count, @intToEnum(cuckoo.Locality, @intCast(u2, locality)), fpcount, seed, block_length, memory) catch @panic("trying to load corrupted frozen filter from RDB!");
+    _ = @atomicRmw(usize, &metrics.filters, builtin.AtomicRmwOp.Add, 1, builtin.AtomicOrder.SeqCst);
+
+    return cf;
+}
+
+export fn CFFrozenSave6(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenFilter6, rdb, value);
+}
+export fn CFFrozenSave8(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenFilter8, rdb, value);
+}
+export fn CFFrozenSave12(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenFilter12, rdb, value);
+}
+export fn CFFrozenSave16(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenFilter16, rdb, value);
+}
+export fn CFFrozenSave32(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenFilter32, rdb, value);
+}
+export fn CFFrozenSaveSemiSorted9(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenSemiSortedFilter9, rdb, value);
+}
+export fn CFFrozenSaveSemiSorted13(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenSemiSortedFilter13, rdb, value);
+}
+export fn CFFrozenSaveSemiSorted17(rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    CFFrozenSaveImpl(FrozenSemiSortedFilter17, rdb, value);
+}
+// The shape of the cuckoo filter it comes from, the xor filter's seed and
+// block length, then its fingerprints, in chunks like bucket memory.
+inline fn CFFrozenSaveImpl(comptime CFType: type, rdb: ?*redis.RedisModuleIO, value: ?*c_void) void {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
+    saveHasher(rdb, cf.hasher);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.shape.bucket_count);
+    redis.RedisModule_SaveUnsigned.?(rdb, @enumToInt(cf.cf.shape.locality));
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.fpcount);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.xor.seed);
+    redis.RedisModule_SaveUnsigned.?(rdb, cf.cf.xor.block_length);
+    saveBuckets(rdb, cf.cf.xor.fingerprints);
+}
+
+export fn CFFrozenRewrite6(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenFilter6, aof, key, value);
+}
+export fn CFFrozenRewrite8(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenFilter8, aof, key, value);
+}
+export fn CFFrozenRewrite12(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenFilter12, aof, key, value);
+}
+export fn CFFrozenRewrite16(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenFilter16, aof, key, value);
+}
+export fn CFFrozenRewrite32(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenFilter32, aof, key, value);
+}
+export fn CFFrozenRewriteSemiSorted9(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenSemiSortedFilter9, aof, key, value);
+}
+export fn CFFrozenRewriteSemiSorted13(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenSemiSortedFilter13, aof, key, value);
+}
+export fn CFFrozenRewriteSemiSorted17(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    CFFrozenRewriteImpl(FrozenSemiSortedFilter17, aof, key, value);
+}
+// A CF.LOADFROZEN with everything but the fingerprints,
+// which follow in CF.LOADCHUNK commands.
+inline fn CFFrozenRewriteImpl(comptime CFType: type, aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {
+    const cf = @ptrCast(*CFType, @alignCast(@alignOf(usize), value));
+    const frozenCFType = @typeOf(cf.cf);
+    redis.RedisModule_EmitAOF.?(
+        aof,
+        c"CF.LOADFROZEN",
+        c"sccclcllll",
+        key,
+        fpsizeArg(frozenCFType.FPType),
+        encodingArg(frozenCFType),
+        hashArg(cf.hasher.kind),
+        @bitCast(c_longlong, cf.hasher.seed),
+        localityArg(cf.cf.shape.locality),
+        @intCast(c_longlong, cf.cf.shape.bucket_count),
+        @intCast(c_longlong, cf.cf.fpcount),
+        @bitCast(c_longlong, cf.cf.xor.seed),
+        @intCast(c_longlong, cf.cf.xor.block_length),
+    );
+    emitChunks(aof, key, cf.cf.xor.fingerprints);
+}
+
+// What a freeze replicates: the key gets replaced by the same commands
+// an AOF rewrite would emit for the frozen filter, so that replicas and
+// AOF replays don't build it again on their main thread.
+pub fn replicateFrozen(ctx: ?*redis.RedisModuleCtx, key: ?*redis.RedisModuleString, cf: var) void {
+    const frozenCFType = @typeOf(cf.cf);
+    _ = redis.RedisModule_Replicate.?(ctx, c"del", c"s", key);
+    _ = redis.RedisModule_Replicate.?(
+        ctx,
+        c"cf.loadfrozen",
+        c"sccclcllll",
+        key,
+        fpsizeArg(frozenCFType.FPType),
+        encodingArg(frozenCFType),
+        hashArg(cf.hasher.kind),
+        @bitCast(c_longlong, cf.hasher.seed),
+        localityArg(cf.cf.shape.locality),
+        @intCast(c_longlong, cf.cf.shape.bucket_count),
+        @intCast(c_longlong, cf.cf.fpcount),
+        @bitCast(c_longlong, cf.cf.xor.seed),
+        @intCast(c_longlong, cf.cf.xor.block_length),
+    );
+    const bytes = cf.cf.xor.fingerprints;
+    var offset: usize = 0;
+    while (offset < bytes.len) : (offset += AOF_CHUNK_SIZE) {
+        const chunk = bytes[offset..std.math.min(offset + AOF_CHUNK_SIZE, bytes.len)];
+        if (is_zeroed(chunk)) continue;
+        _ = redis.RedisModule_Replicate.?(ctx, c"cf.loadchunk", c"slb", key, @intCast(c_longlong, offset), chunk.ptr, chunk.len);
+    }
+}
+
+export fn CFFrozenFree6(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenFilter6, cf);
+}
+export fn CFFrozenFree8(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenFilter8, cf);
+}
+export fn CFFrozenFree12(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenFilter12, cf);
+}
+export fn CFFrozenFree16(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenFilter16, cf);
+}
+export fn CFFrozenFree32(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenFilter32, cf);
+}
+export fn CFFrozenFreeSemiSorted9(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenSemiSortedFilter9, cf);
+}
+export fn CFFrozenFreeSemiSorted13(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenSemiSortedFilter13, cf);
+}
+export fn CFFrozenFreeSemiSorted17(cf: ?*c_void) void {
+    CFFrozenFreeImpl(FrozenSemiSortedFilter17, cf);
+}
+inline fn CFFrozenFreeImpl(comptime CFType: type, value: ?*c_void) void {
+    freeUnread(CFType, @ptrCast(*CFType, @alignCast(@alignOf(usize), value)));
+}
+
+export fn CFFrozenFreeEffort6(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenFilter6, value);
+}
+export fn CFFrozenFreeEffort8(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenFilter8, value);
+}
+export fn CFFrozenFreeEffort12(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenFilter12, value);
+}
+export fn CFFrozenFreeEffort16(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenFilter16, value);
+}
+export fn CFFrozenFreeEffort32(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenFilter32, value);
+}
+export fn CFFrozenFreeEffortSemiSorted9(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenSemiSortedFilter9, value);
+}
+export fn CFFrozenFreeEffortSemiSorted13(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenSemiSortedFilter13, value);
+}
+export fn CFFrozenFreeEffortSemiSorted17(key: ?*redis.RedisModuleString, value: ?*const c_void) usize {
+    return CFFrozenFreeEffortImpl(FrozenSemiSortedFilter17, value);
+}
+inline fn CFFrozenFreeEffortImpl(comptime CFType: type, value: ?*const c_void) usize {
+    const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    return cf.cf.xor.fingerprints.len / FREE_EFFORT_UNIT;
 }
 
-export fn CFRewrite(aof: ?*redis.RedisModuleIO, key: ?*redis.RedisModuleString, value: ?*c_void) void {}
+export fn CFFrozenMemUsage6(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenFilter6, value);
+}
+export fn CFFrozenMemUsage8(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenFilter8, value);
+}
+export fn CFFrozenMemUsage12(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenFilter12, value);
+}
+export fn CFFrozenMemUsage16(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenFilter16, value);
+}
+export fn CFFrozenMemUsage32(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenFilter32, value);
+}
+export fn CFFrozenMemUsageSemiSorted9(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenSemiSortedFilter9, value);
+}
+export fn CFFrozenMemUsageSemiSorted13(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenSemiSortedFilter13, value);
+}
+export fn CFFrozenMemUsageSemiSorted17(value: ?*const c_void) usize {
+    return CFFrozenMemUsageImpl(FrozenSemiSortedFilter17, value);
+}
+inline fn CFFrozenMemUsageImpl(comptime CFType: type, value: ?*const c_void) usize {
+    const cf = @ptrCast(*const CFType, @alignCast(@alignOf(usize), value));
+    return @sizeOf(CFType) + bucketsFootprint(cf.cf.xor.fingerprints.len, cf.storage);
+}
 
 export fn CFDigest(digest: ?*redis.RedisModuleDigest, value: ?*c_void) void {}
+
+test "windows expire whole intervals and keep their schedule" {
+    var window = Window{ .interval = 1000, .current = 0, .rotated_at = 5000, .cleared = 0, .expired = 0 };
+    std.testing.expect(window.expire_due(5999, 4) == 0);
+    std.testing.expect(window.expire_due(6500, 4) == 1);
+    std.testing.expect(window.rotated_at == 6000);
+    std.testing.expect(window.expired == 1);
+
+    // Left alone for a while: every generation expires at once
+    std.testing.expect(window.expire_due(60200, 4) == 54);
+    std.testing.expect(window.rotated_at == 60000);
+    std.testing.expect(window.expired == 3);
+}
+
+test "expired generations and the spare are not probed" {
+    // Ring of 4: generation 1 is the current one, then come 0 and 3, 2 is the spare.
+    var window = Window{ .interval = 1000, .current = 1, .rotated_at = 0, .cleared = 0, .expired = 0 };
+    std.testing.expect(window.spare(4) == 2);
+    std.testing.expect(window.is_live(1, 4) and window.is_live(0, 4) and window.is_live(3, 4));
+    std.testing.expect(!window.is_live(2, 4));
+
+    window.expire(1, 4);
+    std.testing.expect(window.is_live(1, 4) and window.is_live(0, 4));
+    std.testing.expect(!window.is_live(3, 4) and !window.is_live(2, 4));
+
+    // The current generation is probed until the spare takes over
+    window.expire(5, 4);
+    std.testing.expect(window.expired == 3);
+    std.testing.expect(window.is_live(1, 4));
+    std.testing.expect(!window.is_live(0, 4) and !window.is_live(3, 4) and !window.is_live(2, 4));
+}
+
+test "swaps wait for the spare to be zeroed" {
+    var window = Window{ .interval = 1000, .current = 3, .rotated_at = 0, .cleared = 100, .expired = 0 };
+    std.testing.expect(!window.can_swap(4096));
+    window.expire(2, 4);
+    std.testing.expect(!window.can_swap(4096));
+    window.cleared = 4096;
+    std.testing.expect(window.can_swap(4096));
+
+    // The oldest expired generation becomes the spare
+    window.swap(4);
+    std.testing.expect(window.current == 0 and window.cleared == 0 and window.expired == 1);
+    std.testing.expect(window.spare(4) == 1);
+    std.testing.expect(window.is_live(0, 4) and window.is_live(3, 4));
+    std.testing.expect(!window.is_live(2, 4) and !window.is_live(1, 4));
+}
+
+test "the window timer zeroes a stage in half an interval" {
+    const window = Window{ .interval = 10 * 1000, .current = 0, .rotated_at = 0, .cleared = 0, .expired = 0 };
+    std.testing.expect(window.clear_budget(100 << 20, 100) == 2 << 20);
+    std.testing.expect(window.clear_budget(1 << 30, 100) == WINDOW_CLEAR_MAX);
+    std.testing.expect(window.clear_budget(1024, 100) == WINDOW_CLEAR_SIZE);
+}
+
+test "windows from RDB and CF.LOADWINDOW must fit the stages" {
+    const ok = Window{ .interval = 1000, .current = 3, .rotated_at = 0, .cleared = 4096, .expired = 3 };
+    try ok.validate(4, 4096);
+    std.testing.expectError(error.BadWindow, ok.validate(1, 4096));
+
+    var bad = ok;
+    bad.interval = 0;
+    std.testing.expectError(error.BadWindow, bad.validate(4, 4096));
+    bad = ok;
+    bad.current = 4;
+    std.testing.expectError(error.BadWindow, bad.validate(4, 4096));
+    bad = ok;
+    bad.cleared = 4097;
+    std.testing.expectError(error.BadWindow, bad.validate(4, 4096));
+    bad = ok;
+    bad.expired = 4;
+    std.testing.expectError(error.BadWindow, bad.validate(4, 4096));
+
+    // Stages of different sizes can't make a window
+    const CF = cuckoo.Filter8;
+    const len = CF.bytes_for(1024);
+    var memory: [2 * 1024]u8 align(CF.Align) = undefined;
+    var stages = []CF{
+        CF.init(@alignCast(CF.Align, memory[0..len])) catch unreachable,
+        CF.init(@alignCast(CF.Align, memory[len .. len + len / 2])) catch unreachable,
+    };
+    var cf = Scalable(CF){ .stages = stages[0..], .growth = 2, .broken = false, .storage = .Heap, .stats = null, .window = null };
+    std.testing.expectError(error.BadWindow, cf.check_window(Window{ .interval = 1000, .current = 0, .rotated_at = 0, .cleared = 0, .expired = 0 }));
+}
+
+test "windowed filters forget expired generations" {
+    const CF = cuckoo.Filter8;
+    const len = CF.bytes_for(1024);
+    var memory: [4 * 1024]u8 align(CF.Align) = undefined;
+    var stages: [4]CF = undefined;
+    for (stages) |*stage, i| stage.* = CF.init(@alignCast(CF.Align, memory[i * len .. (i + 1) * len])) catch unreachable;
+    var cf = Scalable(CF){ .stages = stages[0..], .growth = 1, .broken = false, .storage = .Heap, .stats = null, .window = null };
+    cf.window = Window{ .interval = 1000, .current = 0, .rotated_at = 0, .cleared = cf.stage_bytes(), .expired = 0 };
+
+    cf.add(2, 41) catch unreachable;
+    cf.window.?.expire(1, 4);
+    std.testing.expect(cf.can_swap());
+    cf.swap();
+    cf.add(3, 42) catch unreachable;
+    std.testing.expect(cf.maybe_contains(2, 41) catch unreachable);
+    std.testing.expect(cf.maybe_contains(3, 42) catch unreachable);
+
+    // Only the current generation is left, until the spare is zeroed
+    cf.window.?.expire(3, 4);
+    std.testing.expect(!(cf.maybe_contains(2, 41) catch unreachable));
+    std.testing.expect(cf.maybe_contains(3, 42) catch unreachable);
+    std.testing.expect(1 == cf.count() catch unreachable);
+    cf.clear(100);
+    std.testing.expect(!cf.can_swap());
+    cf.clear(std.math.maxInt(usize));
+    std.testing.expect(cf.can_swap());
+    cf.swap();
+    std.testing.expect(!(cf.maybe_contains(3, 42) catch unreachable));
+    std.testing.expect(0 == cf.count() catch unreachable);
+
+    // Generations come back forgotten and zeroed
+    while (cf.window.?.expired > 0) {
+        cf.clear(std.math.maxInt(usize));
+        cf.swap();
+    }
+    std.testing.expect(cf.window.?.current == 0);
+    std.testing.expect(!(cf.maybe_contains(2, 41) catch unreachable));
+    std.testing.expect(0 == cf.count() catch unreachable);
+}
+
+test "removing an expired item doesn't break a windowed filter" {
+    const CF = cuckoo.Filter8;
+    const len = CF.bytes_for(1024);
+    var memory: [3 * 1024]u8 align(CF.Align) = undefined;
+    var stages: [3]CF = undefined;
+    for (stages) |*stage, i| stage.* = CF.init(@alignCast(CF.Align, memory[i * len .. (i + 1) * len])) catch unreachable;
+    var cf = Scalable(CF){ .stages = stages[0..], .growth = 1, .broken = false, .storage = .Heap, .stats = null, .window = null };
+    cf.window = Window{ .interval = 1000, .current = 0, .rotated_at = 0, .cleared = cf.stage_bytes(), .expired = 0 };
+
+    // 41 goes in a generation that expires after two rotations
+    cf.add(2, 41) catch unreachable;
+    cf.window.?.expire(1, 3);
+    cf.swap();
+    cf.add(3, 42) catch unreachable;
+    cf.window.?.expire(1, 3);
+    cf.clear(std.math.maxInt(usize));
+    cf.swap();
+    std.testing.expect(!(cf.maybe_contains(2, 41) catch unreachable));
+
+    std.testing.expectError(error.NotFound, cf.remove(2, 41));
+    std.testing.expect(!cf.broken);
+    std.testing.expect(cf.maybe_contains(3, 42) catch unreachable);
+    cf.remove(3, 42) catch unreachable;
+    std.testing.expect(!(cf.maybe_contains(3, 42) catch unreachable));
+
+    const hashes = []u64{ 2, 4 };
+    const fps = []u8{ 41, 43 };
+    var results: [2]cuckoo.BatchResult = undefined;
+    cf.add(4, 43) catch unreachable;
+    cf.remove_batch(hashes[0..], fps[0..], results[0..]);
+    std.testing.expect(results[0] == cuckoo.BatchResult.NotFound and results[1] == cuckoo.BatchResult.Ok);
+    std.testing.expect(0 == cf.count() catch unreachable);
+
+    // Plain scalable filters still break
+    cf.window = null;
+    std.testing.expectError(error.Broken, cf.remove(5, 44));
+    std.testing.expect(cf.broken);
+}
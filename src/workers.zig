@@ -0,0 +1,116 @@
+const c = @cImport({
+    @cInclude("pthread.h");
+    @cInclude("sched.h");
+});
+
+// A small pool of threads running tasks submitted by the main thread.
+// Used to spread big read-only batches over multiple cores.
+// Tasks are run in submission order, each by a single thread.
+// Long tasks (CF.FREEZE) go to a thread of their own instead, the
+// background one, so that batches never queue up behind them.
+
+pub const Task = struct {
+    next: ?*Task,
+    run: fn (*Task) void,
+};
+
+const Queue = struct {
+    mutex: c.pthread_mutex_t,
+    cond: c.pthread_cond_t,
+    head: ?*Task,
+    tail: ?*Task,
+    threads: usize,
+};
+
+var pool = Queue{ .mutex = undefined, .cond = undefined, .head = null, .tail = null, .threads = 0 };
+var background = Queue{ .mutex = undefined, .cond = undefined, .head = null, .tail = null, .threads = 0 };
+
+// Worker threads stop reading a filter under this lock, so that the
+// threads waiting for them can sleep instead of spinning (see `t_ccf.releaseReader`).
+var readers_mutex: c.pthread_mutex_t = undefined;
+var readers_done: c.pthread_cond_t = undefined;
+
+// Starts `n` worker threads, and the background thread unless `n` is 0.
+// Must be called once, at module load.
+pub fn start(n: usize) !void {
+    if (c.pthread_mutex_init(&readers_mutex, null) != 0) return error.ThreadError;
+    if (c.pthread_cond_init(&readers_done, null) != 0) return error.ThreadError;
+    if (n == 0) return;
+    try startQueue(&pool, n);
+    try startQueue(&background, 1);
+}
+
+fn startQueue(queue: *Queue, n: usize) !void {
+    if (c.pthread_mutex_init(&queue.mutex, null) != 0) return error.ThreadError;
+    if (c.pthread_cond_init(&queue.cond, null) != 0) return error.ThreadError;
+
+    var i: usize = 0;
+    while (i < n) : (i += 1) {
+        var tid: c.pthread_t = undefined;
+        if (c.pthread_create(&tid, null, worker_main, @ptrCast(*c_void, queue)) != 0) return error.ThreadError;
+        _ = c.pthread_detach(tid);
+        queue.threads += 1;
+    }
+}
+
+// Number of running worker threads, 0 means that everything
+// has to run on the main thread.
+pub fn count() usize {
+    return pool.threads;
+}
+
+pub fn submit(task: *Task) void {
+    push(&pool, task);
+}
+
+// Runs `task` on the background thread, after the background tasks
+// submitted before it. Only valid when `count()` is not 0.
+pub fn submitBackground(task: *Task) void {
+    push(&background, task);
+}
+
+fn push(queue: *Queue, task: *Task) void {
+    task.next = null;
+    _ = c.pthread_mutex_lock(&queue.mutex);
+    if (queue.tail) |t| t.next = task else queue.head = task;
+    queue.tail = task;
+    _ = c.pthread_cond_signal(&queue.cond);
+    _ = c.pthread_mutex_unlock(&queue.mutex);
+}
+
+pub fn lockReaders() void {
+    _ = c.pthread_mutex_lock(&readers_mutex);
+}
+
+pub fn unlockReaders() void {
+    _ = c.pthread_mutex_unlock(&readers_mutex);
+}
+
+// Sleeps until the next `readersDone`, with the readers lock held.
+pub fn waitReadersDone() void {
+    _ = c.pthread_cond_wait(&readers_done, &readers_mutex);
+}
+
+pub fn readersDone() void {
+    _ = c.pthread_cond_broadcast(&readers_done);
+}
+
+// Gives up the CPU, used when spinning on a condition
+// that depends on the progress of worker threads.
+pub fn yield() void {
+    _ = c.sched_yield();
+}
+
+extern fn worker_main(arg: ?*c_void) ?*c_void {
+    const queue = @ptrCast(*Queue, @alignCast(@alignOf(Queue), arg));
+    while (true) {
+        _ = c.pthread_mutex_lock(&queue.mutex);
+        while (queue.head == null) _ = c.pthread_cond_wait(&queue.cond, &queue.mutex);
+        const task = queue.head.?;
+        queue.head = task.next;
+        if (queue.head == null) queue.tail = null;
+        _ = c.pthread_mutex_unlock(&queue.mutex);
+
+        task.run(task);
+    }
+}
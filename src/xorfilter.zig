@@ -0,0 +1,310 @@
+const std = @import("std");
+const mem = std.mem;
+const testing = std.testing;
+const cuckoo = @import("./lib/zig-cuckoofilter.zig");
+
+// Xor filters (Graf and Lemire, "Xor Filters: Faster and Smaller Than Bloom
+// and Cuckoo Filters"), used by frozen filters (see CF.FREEZE).
+// A static set of 64 bit keys: every key maps to three slots, one in each
+// third of the table, and the xor of their fingerprints is the fingerprint
+// of the key. That takes about 1.23 slots per key, and a lookup is three
+// independent loads and a compare, no branches.
+// Fingerprints are `bits` wide and packed back to back, slot `i` lives in
+// bits [i*bits, (i+1)*bits) of the little endian fingerprint memory.
+// The filter doesn't own its memory, see `bytes_for`.
+pub fn Xor(comptime bits: comptime_int) type {
+    return struct {
+        seed: u64,
+        block_length: usize,
+        fingerprints: []u8,
+
+        pub const Fingerprint = @IntType(false, bits);
+        const Self = @This();
+
+        // Builds that fail to peel all the keys start over with the next
+        // seed, each attempt succeeds with a probability close to 90%.
+        const MaxAttempts = 64;
+
+        // Seeds are picked from a fixed sequence: the same keys always
+        // give the same filter, on masters and replicas alike.
+        const FirstSeed = 0x726564697363636f;
+
+        comptime {
+            // Lookups read 8 bytes, a fingerprint has to fit in them at any bit offset.
+            if (bits < 1 or bits > 57) @compileError("xor fingerprints must be 1 to 57 bits wide");
+        }
+
+        // Number of slots for `n` keys, a multiple of 3.
+        pub fn capacity(n: usize) usize {
+            const slots = 32 + (n * 123 + 99) / 100;
+            return (slots + 2) / 3 * 3;
+        }
+
+        // Fingerprint memory for `slots` slots. Lookups read 8 bytes at
+        // a time, the padding at the end keeps them inside the allocation.
+        pub fn bytes_for_slots(slots: usize) usize {
+            return (slots * bits + 7) / 8 + 8;
+        }
+
+        pub fn bytes_for(n: usize) usize {
+            return bytes_for_slots(capacity(n));
+        }
+
+        // Adopts the fingerprints of a filter built elsewhere
+        // (e.g. saved to RDB), `memory` has to stay around as long as the filter.
+        pub fn init(seed: u64, block_length: usize, memory: []u8) !Self {
+            if (block_length == 0 or block_length > std.math.maxInt(u32)) return error.BadLength;
+            if (memory.len != bytes_for_slots(3 * block_length)) return error.BadLength;
+            return Self{
+                .seed = seed,
+                .block_length = block_length,
+                .fingerprints = memory,
+            };
+        }
+
+        // Scratch memory of `build` for `n` keys: 20 bytes per slot and 16 per key.
+        pub fn scratch_bytes(n: usize) usize {
+            return capacity(n) * 20 + n * 16;
+        }
+
+        // Builds a filter of `keys`, which must not contain duplicates, in
+        // `memory`, zeroed and `bytes_for(keys.len)` bytes long.
+        // Scratch memory (see `scratch_bytes`) comes from `allocator`.
+        pub fn build(memory: []u8, keys: []const u64, allocator: *mem.Allocator) !Self {
+            const slots = capacity(keys.len);
+            var self = try init(0, slots / 3, memory);
+
+            const counts = try allocator.alloc(u32, slots);
+            defer allocator.free(counts);
+            const xors = try allocator.alloc(u64, slots);
+            defer allocator.free(xors);
+            const queue = try allocator.alloc(usize, slots);
+            defer allocator.free(queue);
+            const stack = try allocator.alloc(Peeled, keys.len);
+            defer allocator.free(stack);
+
+            var seed_state: u64 = FirstSeed;
+            var attempt: usize = 0;
+            while (attempt < MaxAttempts) : (attempt += 1) {
+                self.seed = splitmix64(&seed_state);
+                if (self.peel(keys, counts, xors, queue, stack)) {
+                    self.assign(stack);
+                    return self;
+                }
+            }
+            return error.BuildFailed;
+        }
+
+        // A key that was the only one left in one of its slots.
+        const Peeled = struct {
+            hash: u64,
+            slot: usize,
+        };
+
+        // Removes, one at a time, keys that are alone in one of their slots,
+        // pushing them on `stack`. Each slot only keeps how many keys are
+        // left in it and the xor of their hashes: when a single key is left,
+        // that's its hash. Fails when some keys can't be peeled.
+        fn peel(self: *const Self, keys: []const u64, counts: []u32, xors: []u64, queue: []usize, stack: []Peeled) bool {
+            mem.set(u32, counts, 0);
+            mem.set(u64, xors, 0);
+            for (keys) |key| {
+                const hash = self.hash_of(key);
+                for (self.slots_of(hash)) |slot| {
+                    counts[slot] += 1;
+                    xors[slot] ^= hash;
+                }
+            }
+
+            // A slot drops to one key at most once, the queue never overflows.
+            var queued: usize = 0;
+            for (counts) |count, slot| {
+                if (count == 1) {
+                    queue[queued] = slot;
+                    queued += 1;
+                }
+            }
+
+            var peeled: usize = 0;
+            while (queued > 0) {
+                queued -= 1;
+                const slot = queue[queued];
+                // Emptied by another key peeled since it was queued.
+                if (counts[slot] != 1) continue;
+                const hash = xors[slot];
+                stack[peeled] = Peeled{ .hash = hash, .slot = slot };
+                peeled += 1;
+                for (self.slots_of(hash)) |other| {
+                    counts[other] -= 1;
+                    xors[other] ^= hash;
+                    if (counts[other] == 1) {
+                        queue[queued] = other;
+                        queued += 1;
+                    }
+                }
+            }
+            return peeled == keys.len;
+        }
+
+        // In reverse peeling order, the slot a key was peeled from is never
+        // touched by the keys that come after it: setting it last makes the
+        // xor of the three slots match the key's fingerprint.
+        fn assign(self: *Self, stack: []const Peeled) void {
+            var i = stack.len;
+            while (i > 0) {
+                i -= 1;
+                const p = stack[i];
+                var fp = fingerprint_of(p.hash);
+                for (self.slots_of(p.hash)) |slot| {
+                    if (slot != p.slot) fp ^= self.get(slot);
+                }
+                self.set(p.slot, fp);
+            }
+        }
+
+        pub fn contains(self: *const Self, key: u64) bool {
+            const hash = self.hash_of(key);
+            const s = self.slots_of(hash);
+            return fingerprint_of(hash) == self.get(s[0]) ^ self.get(s[1]) ^ self.get(s[2]);
+        }
+
+        // Starts loading the three slots of `key`, for batches.
+        pub fn prefetch(self: *const Self, key: u64) void {
+            for (self.slots_of(self.hash_of(key))) |slot| cuckoo.prefetch(&self.fingerprints[slot * bits / 8]);
+        }
+
+        inline fn hash_of(self: *const Self, key: u64) u64 {
+            // Murmur3's finalizer, a bijection: distinct keys never share a hash.
+            var h = key +% self.seed;
+            h = (h ^ (h >> 33)) *% 0xff51afd7ed558ccd;
+            h = (h ^ (h >> 33)) *% 0xc4ceb9fe1a85ec53;
+            return h ^ (h >> 33);
+        }
+
+        inline fn slots_of(self: *const Self, hash: u64) [3]usize {
+            const n = self.block_length;
+            return []usize{
+                reduce(hash, n),
+                reduce(std.math.rotl(u64, hash, 21), n) + n,
+                reduce(std.math.rotl(u64, hash, 42), n) + 2 * n,
+            };
+        }
+
+        // Maps the low 32 bits of `hash` to [0, n) without a division.
+        inline fn reduce(hash: u64, n: usize) usize {
+            return @intCast(usize, (u64(@truncate(u32, hash)) * u64(n)) >> 32);
+        }
+
+        inline fn fingerprint_of(hash: u64) Fingerprint {
+            return @truncate(Fingerprint, hash ^ (hash >> 32));
+        }
+
+        inline fn get(self: *const Self, slot: usize) Fingerprint {
+            const bit = slot * bits;
+            const word = mem.readIntSliceLittle(u64, self.fingerprints[bit / 8 .. bit / 8 + 8]);
+            return @truncate(Fingerprint, word >> @intCast(u6, bit % 8));
+        }
+
+        fn set(self: *Self, slot: usize, fp: Fingerprint) void {
+            const bit = slot * bits;
+            const bytes = self.fingerprints[bit / 8 .. bit / 8 + 8];
+            const shift = @intCast(u6, bit % 8);
+            const mask = u64(std.math.maxInt(Fingerprint)) << shift;
+            const word = mem.readIntSliceLittle(u64, bytes);
+            mem.writeIntSliceLittle(u64, bytes, (word & ~mask) | (u64(fp) << shift));
+        }
+    };
+}
+
+fn splitmix64(state: *u64) u64 {
+    state.* +%= 0x9e3779b97f4a7c15;
+    var z = state.*;
+    z = (z ^ (z >> 30)) *% 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) *% 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+var test_scratch: [1 << 21]u8 = undefined;
+var test_memory: [1 << 16]u8 = undefined;
+
+fn test_keys(keys: []u64, from: u64) void {
+    var state = from;
+    for (keys) |*key| key.* = splitmix64(&state);
+}
+
+test "no false negatives" {
+    inline for ([]comptime_int{ 4, 7, 8, 13, 31 }) |bits| {
+        const X = Xor(bits);
+        var keys: [10000]u64 = undefined;
+        test_keys(keys[0..], 1);
+        var fba = std.heap.FixedBufferAllocator.init(test_scratch[0..]);
+        const memory = test_memory[0..X.bytes_for(keys.len)];
+        mem.set(u8, memory, 0);
+
+        const xf = X.build(memory, keys[0..], &fba.allocator) catch unreachable;
+        for (keys) |key| testing.expect(xf.contains(key));
+    }
+}
+
+test "false positive rate follows the fingerprint size" {
+    const X = Xor(8);
+    var keys: [10000]u64 = undefined;
+    test_keys(keys[0..], 1);
+    var fba = std.heap.FixedBufferAllocator.init(test_scratch[0..]);
+    const memory = test_memory[0..X.bytes_for(keys.len)];
+    mem.set(u8, memory, 0);
+    const xf = X.build(memory, keys[0..], &fba.allocator) catch unreachable;
+
+    // Other keys from the same generator, expected rate 1/256.
+    var others: [100000]u64 = undefined;
+    test_keys(others[0..], 1 + keys.len);
+    var hits: usize = 0;
+    for (others) |key| hits += @boolToInt(xf.contains(key));
+    testing.expect(hits > others.len / 512 and hits < others.len / 128);
+}
+
+test "builds are deterministic" {
+    const X = Xor(13);
+    var keys: [1000]u64 = undefined;
+    test_keys(keys[0..], 42);
+    var first: [X.bytes_for(1000)]u8 = undefined;
+    var second: [X.bytes_for(1000)]u8 = undefined;
+    mem.set(u8, first[0..], 0);
+    mem.set(u8, second[0..], 0);
+
+    var fba = std.heap.FixedBufferAllocator.init(test_scratch[0..]);
+    const a = X.build(first[0..], keys[0..], &fba.allocator) catch unreachable;
+    fba = std.heap.FixedBufferAllocator.init(test_scratch[0..]);
+    const b = X.build(second[0..], keys[0..], &fba.allocator) catch unreachable;
+    testing.expect(a.seed == b.seed);
+    testing.expect(mem.eql(u8, first[0..], second[0..]));
+
+    // And survive being saved and loaded back.
+    const c = X.init(a.seed, a.block_length, second[0..]) catch unreachable;
+    for (keys) |key| testing.expect(c.contains(key));
+    testing.expectError(error.BadLength, X.init(a.seed, a.block_length + 1, second[0..]));
+}
+
+test "empty set" {
+    const X = Xor(16);
+    var fba = std.heap.FixedBufferAllocator.init(test_scratch[0..]);
+    const memory = test_memory[0..X.bytes_for(0)];
+    mem.set(u8, memory, 0);
+    const xf = X.build(memory, []u64{}, &fba.allocator) catch unreachable;
+    var hits: usize = 0;
+    var key: u64 = 0;
+    while (key < 1000) : (key += 1) hits += @boolToInt(xf.contains(key));
+    testing.expect(hits < 5);
+}
+
+test "scratch_bytes covers the build" {
+    const X = Xor(8);
+    var keys: [10000]u64 = undefined;
+    test_keys(keys[0..], 7);
+    // A few bytes more for the alignment of each allocation.
+    var fba = std.heap.FixedBufferAllocator.init(test_scratch[0 .. X.scratch_bytes(keys.len) + 32]);
+    const memory = test_memory[0..X.bytes_for(keys.len)];
+    mem.set(u8, memory, 0);
+    const xf = X.build(memory, keys[0..], &fba.allocator) catch unreachable;
+    for (keys) |key| testing.expect(xf.contains(key));
+}